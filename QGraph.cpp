@@ -27,8 +27,27 @@
 #include <cmath>
 #include <QFileDialog>
 #include <QFontMetrics>
+#include <QFile>
+#include <QTextStream>
+#include <QCoreApplication>
+#include <QHash>
+#include <QMutexLocker>
+#include <QtAlgorithms>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QTimerEvent>
+#include <QtMath>
 #include <algorithm>
 #include <limits>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "QGraphShm.h"
+#endif
 
 using namespace std;
 
@@ -40,10 +59,29 @@ QGraph::QGraph(QWidget *parent) :
     limitedX(false),
     limitedY(false),
     zoomLimit(true),
+    autoscaleY(false),
+    statisticsReadout(false),
+    pollTimer(0),
+    stripChart(false),
+    stripWindow(1.0),
+    stripRight(0.0),
+    persistence(false),
+    persistenceDecay(500.0),
+    persistenceReset(false),
     rightClickMenu(true),
+    historyIndex(0),
+    historyLimit(32),
+    historyCacheBytes(64*1024*1024),
+    historyCoalesce(false),
+    viewGeneration(0),
+    viewLayerGeneration(0),
+    sceneStale(false),
+    axisFontHeight(0),
     zooming(false),
     panning(false),
     tracking(false),
+    trackingSet(0),
+    trackingIndex(0),
     sizeYLabel(0),
     sizeXLabel(0),
     sizeTitle(0),
@@ -59,24 +97,52 @@ QGraph::QGraph(QWidget *parent) :
     leftBorder(10),
     topBorder(10),
     rightBorder(10),
-    bottomBorder(10)
+    bottomBorder(10),
+    instrumented(false),
+    frameStatsEnabled(false),
+    frameStatsOverlay(false),
+    frameOpen(false),
+    frameStart(0),
+    frameCounter(0),
+    currentStats(),
+    lastStats(),
+    tracing(false),
+    traceWritten(0)
 {
     scene = new QGraphicsScene();
     scene->addLine(0,10,10,10);
     graphImage = QImage(400, 300, QImage::Format_ARGB32);
+    graphImage.fill(Qt::white);
     setMouseTracking(true);
     setFocusPolicy(Qt::StrongFocus);
+    statsClock.start();
+    setPersistenceColors(QVector<QColor>());
 
     menuSavePicture = menu.addAction(tr("&Save Picture"));
     connect(menuSavePicture, SIGNAL(triggered()), this, SLOT(onMenuSavePicture()));
 
     menu.addSeparator();
 
+    menuZoomBack = menu.addAction(tr("Zoom &Back"));
+    menuZoomBack->setEnabled(false);
+    connect(menuZoomBack, SIGNAL(triggered()), this, SLOT(onMenuZoomBack()));
+
+    menuZoomForward = menu.addAction(tr("Zoom &Forward"));
+    menuZoomForward->setEnabled(false);
+    connect(menuZoomForward, SIGNAL(triggered()), this, SLOT(onMenuZoomForward()));
+
+    menu.addSeparator();
+
     menuGrid = menu.addAction(tr("&Grid"));
     menuGrid->setCheckable(true);
     menuGrid->setChecked(grid);
     connect(menuGrid, SIGNAL(triggered(bool)), this, SLOT(onMenuGrid(bool)));
 
+    menuAutoscaleY = menu.addAction(tr("Autoscale &Y"));
+    menuAutoscaleY->setCheckable(true);
+    menuAutoscaleY->setChecked(autoscaleY);
+    connect(menuAutoscaleY, SIGNAL(triggered(bool)), this, SLOT(onMenuAutoscaleY(bool)));
+
     menuAntializing = menu.addAction(tr("&Antializing"));
     menuAntializing->setCheckable(true);
     menuAntializing->setChecked(antializing);
@@ -119,16 +185,23 @@ QGraph::QGraph(QWidget *parent) :
 
     menuDefaultBorder = menu.addAction(tr("&Default Border"));
     connect(menuDefaultBorder, SIGNAL(triggered()), this, SLOT(onMenuDefaultBorder()));
+
+    QGraphScheduler::instance()->registerGraph(this);
 }
 
 QGraph::~QGraph()
 {
-
+    if(axisGroup)
+        axisGroup->removeGraph(this);
+    QGraphScheduler::instance()->unregisterGraph(this);
+    if(tracing)
+        stopTrace();
 }
 
 void QGraph::setAntializing(bool antializing)
 {
     this->antializing = antializing;
+    viewGeneration++;
     if(autoRefresh)
     {
         repaint();
@@ -138,8 +211,11 @@ void QGraph::setAntializing(bool antializing)
 
 void QGraph::clearData()
 {
+    viewGeneration++;
     lines.clear();
+    waterfalls.clear();
     scene->clear();
+    tracking = false;
 }
 
 void QGraph::setData(QVector<double> xData, QVector<double> yData, GraphStyle style, double barWidth, QPen pen, QBrush brush)
@@ -148,23 +224,23 @@ void QGraph::setData(QVector<double> xData, QVector<double> yData, GraphStyle st
     appendData(xData, yData, style, barWidth, pen, brush);
 }
 
-void QGraph::setData(QVector< QVector<double> > xData, QVector< QVector<double> > yData, QVector<GraphStyle> styles, QVector<double> barWidths, QVector<QPen> pens, QVector<QBrush> brushes)
+void QGraph::setData(const QVector< QVector<double> >& xData, const QVector< QVector<double> >& yData, const QVector<GraphStyle>& styles, const QVector<double>& barWidths, const QVector<QPen>& pens, const QVector<QBrush>& brushes)
 {
-    lines.clear();
-    for(int set=0; set<xData.size(); set++)
+    clearData();
+    int sets = qMin(xData.size(), yData.size());
+    for(int set=0; set<sets; set++)
     {
         LineInfo line;
-        line.xData = xData[set];
-        line.yData = yData[set];
+        line.source = QSharedPointer<QGraphDataSource>(new QGraphVectorSource(xData[set], yData[set]));
         if(styles.size() != xData.size())
-            line.style =Line;
-        else
             line.style = Line;
+        else
+            line.style = styles[set];
 
         if(barWidths.size() != xData.size())
-            line.barWidth = barWidths[set];
-        else
             line.barWidth = 0.9;
+        else
+            line.barWidth = barWidths[set];
 
         if(pens.size() != xData.size())
             line.pen = QPen(Qt::black, 0);
@@ -175,6 +251,7 @@ void QGraph::setData(QVector< QVector<double> > xData, QVector< QVector<double>
             line.brush = QBrush(Qt::transparent);
         else
             line.brush = brushes[set];
+        lines.push_back(line);
     }
     if(autoRefresh)
     {
@@ -185,10 +262,29 @@ void QGraph::setData(QVector< QVector<double> > xData, QVector< QVector<double>
 }
 
 void QGraph::appendData(QVector<double> xData, QVector<double> yData, GraphStyle style, double barWidth, QPen pen, QBrush brush)
+{
+    appendSource(QSharedPointer<QGraphDataSource>(new QGraphVectorSource(xData, yData)), style, barWidth, pen, brush);
+}
+
+/**
+  \fn void QGraph::appendUniformData(double x0, double dx, QVector<double> yData, GraphStyle style, double barWidth, QPen pen, QBrush brush)
+  Adds a uniformly sampled trace. No x vector is stored, sample i is
+  drawn at x0+i*dx. dx must be positive.
+ **/
+void QGraph::appendUniformData(double x0, double dx, QVector<double> yData, GraphStyle style, double barWidth, QPen pen, QBrush brush)
+{
+    appendSource(QSharedPointer<QGraphDataSource>(new QGraphVectorSource(x0, dx, yData)), style, barWidth, pen, brush);
+}
+
+/**
+  \fn void QGraph::appendSource(QSharedPointer<QGraphDataSource> source, GraphStyle style, double barWidth, QPen pen, QBrush brush)
+  Adds a trace whose samples are provided by source. The source is
+  shared, not copied, so the same source can be shown by several graphs.
+ **/
+void QGraph::appendSource(QSharedPointer<QGraphDataSource> source, GraphStyle style, double barWidth, QPen pen, QBrush brush)
 {
     LineInfo line;
-    line.xData = xData;
-    line.yData = yData;
+    line.source = source;
     line.style = style;
     line.barWidth = barWidth;
     line.pen = pen;
@@ -202,136 +298,354 @@ void QGraph::appendData(QVector<double> xData, QVector<double> yData, GraphStyle
     }
 }
 
-void QGraph::useLimit(bool limitedX, bool limitedY)
+/**
+  \fn QSharedPointer<QGraphDataSource> QGraph::getSource(int set)
+  Returns the source of a trace, e.g. to derive a filtered trace from it
+  with QGraphDerivedSource. Returns a null pointer for invalid sets.
+ **/
+QSharedPointer<QGraphDataSource> QGraph::getSource(int set)
 {
-    this->limitedX = limitedX;
-    this->limitedY = limitedY;
+    if(set < 0 || set >= lines.size())
+        return QSharedPointer<QGraphDataSource>();
+    return lines[set].source;
+}
+
+/**
+  \fn int QGraph::appendWaterfall(QSharedPointer<QGraphWaterfall> waterfall)
+  Adds a matrix trace which is drawn below the line traces. Returns its
+  index for pushWaterfallRow().
+ **/
+int QGraph::appendWaterfall(QSharedPointer<QGraphWaterfall> waterfall)
+{
+    waterfalls.push_back(waterfall);
     if(autoRefresh)
-        dataMinMax();
+        refresh();
+    return waterfalls.size()-1;
 }
 
-void QGraph::useZoomLimit(bool zoomLimit)
+/**
+  \fn void QGraph::pushWaterfallRow(int waterfall, const QVector<double>& row)
+  Scrolls a waterfall by one row. Only the new row is colour mapped and
+  the line traces are not rebuilt, so this is cheap enough for every
+  new spectrum.
+ **/
+void QGraph::pushWaterfallRow(int waterfall, const QVector<double>& row)
 {
-    this->zoomLimit =  zoomLimit;
+    if(waterfall < 0 || waterfall >= waterfalls.size() || row.size() < waterfalls[waterfall]->columns())
+        return;
+    waterfalls[waterfall]->pushRow(row.constData());
+    viewGeneration++;
     if(autoRefresh)
     {
-        //dataMinMax();
-        //insertLines();
-        refresh();
+        repaint();
+        update();
     }
 }
 
-void QGraph::limitX(double xmin, double xmax)
+/**
+  \fn int QGraph::appendMappedFile(QString fileName, QGraphMappedSource::SampleType type, int channels, double sampleRate, QGraphMappedSource::Layout layout, qint64 headerBytes, QVector<QPen> pens)
+  Maps a raw binary recording into memory and adds one trace per channel.
+  The file is not read, only the pages required for the current view are
+  loaded by the operating system. The summaries that make zoomed out
+  views exact are built in the background, the graph is redrawn when
+  they are ready. The x coordinate of a sample is its index divided by
+  sampleRate. Returns the number of added traces, 0 if
+  the file could not be mapped.
+ **/
+int QGraph::appendMappedFile(QString fileName, QGraphMappedSource::SampleType type, int channels, double sampleRate, QGraphMappedSource::Layout layout, qint64 headerBytes, QVector<QPen> pens)
 {
-    limitedX = true;
-    dataMinX = xmin;
-    dataMaxX = xmax;
-    if(autoRefresh)
+    if(channels <= 0 || sampleRate <= 0)
+        return 0;
+    QSharedPointer<QGraphMappedFile> file(new QGraphMappedFile(fileName));
+    if(!file->isValid())
+        return 0;
+
+    for(int channel=0; channel<channels; channel++)
     {
-        //dataMinMax();
-        //insertLines();
-        refresh();
+        LineInfo line;
+        line.source = QSharedPointer<QGraphDataSource>(new QGraphMappedSource(file, type, channels, channel, sampleRate, layout, headerBytes));
+        line.style = Line;
+        line.barWidth = 0.9;
+        line.pen = pens.size() == channels ? pens[channel] : QPen(Qt::black, 0);
+        line.brush = QBrush(Qt::transparent);
+        lines.push_back(line);
     }
+    QGraphMappedSummary::start(QGraphMappedSummary::of(file, type, channels, layout, headerBytes), this);
+    if(autoRefresh)
+        refresh();
+    return channels;
 }
 
-void QGraph::limitY(double ymin, double ymax)
+/**
+  \fn int QGraph::appendSharedMemory(QString name, QVector<QPen> pens, int pollInterval)
+  Attaches to a shared-memory ring buffer written by another process
+  with the producer library in QGraphShm.h and adds one trace per
+  channel. The samples are read in place without locking. Every
+  pollInterval milliseconds the write index is checked and the graph is
+  refreshed if new samples arrived; use 0 to refresh manually. Returns
+  the number of added traces, 0 if the ring could not be attached.
+ **/
+int QGraph::appendSharedMemory(QString name, QVector<QPen> pens, int pollInterval)
 {
-    limitedY = true;
-    dataMinY = ymin;
-    dataMaxY = ymax;
+    QSharedPointer<QGraphSharedRing> ring(new QGraphSharedRing(name));
+    if(!ring->isValid())
+        return 0;
+
+    int channels = ring->channels();
+    for(int channel=0; channel<channels; channel++)
+    {
+        LineInfo line;
+        line.source = QSharedPointer<QGraphDataSource>(new QGraphSharedSource(ring, channel));
+        line.style = Line;
+        line.barWidth = 0.9;
+        line.pen = pens.size() == channels ? pens[channel] : QPen(Qt::black, 0);
+        line.brush = QBrush(Qt::transparent);
+        lines.push_back(line);
+    }
+    if(pollInterval > 0 && pollTimer == 0)
+        pollTimer = startTimer(pollInterval);
     if(autoRefresh)
+        refresh();
+    return channels;
+}
+
+/*
+  Polls the shared-memory traces. Only the write indices are read here,
+  the samples are read when the frame is built.
+ */
+void QGraph::timerEvent(QTimerEvent* event)
+{
+    if(event->timerId() != pollTimer)
     {
-        //dataMinMax();
-        //insertLines();
+        QWidget::timerEvent(event);
+        return;
+    }
+    if(!autoRefresh)
+        return;
+    bool changed = false;
+    for(int set=0; set<lines.size(); set++)
+        changed = lines[set].source->sync() || changed;
+    if(changed)
+        QGraphScheduler::instance()->request(this, QGraphScheduler::Refresh);
+}
+
+// Called by QGraphScheduler for the work queued with request()
+void QGraph::runScheduled(QGraphScheduler::Work work)
+{
+    if(work == QGraphScheduler::Refresh)
         refresh();
+    else if(work == QGraphScheduler::Import)
+        refreshImport();
+    else if(work == QGraphScheduler::Redraw)
+    {
+        insertLines();
+        update();
     }
 }
 
-void QGraph::refresh()
+/**
+  \fn bool QGraph::saveRecording(QString fileName, bool compress)
+  Writes all traces with their styles into a QGraph recording file. The
+  samples are stored in chunks, optionally compressed, together with
+  min/max summaries which make the overview of huge files fast to load.
+  Returns false if the file could not be written.
+ **/
+bool QGraph::saveRecording(QString fileName, bool compress)
 {
-    dataMinMax();
-    textSize();
-    insertLines();
-    update();
+    QGraphRecordingWriter writer;
+    for(int set=0; set<lines.size(); set++)
+    {
+        double x0 = 0.0;
+        double dx = 0.0;
+        if(!lines[set].source->uniformX(x0, dx))
+            dx = 0.0;
+        int trace = writer.addTrace(x0, dx);
+        writer.setTraceStyle(trace, lines[set].style, lines[set].barWidth, lines[set].pen.color().rgba(), lines[set].pen.widthF(), lines[set].brush.color().rgba());
+    }
+    const int blockSize = 4096;
+    if(!writer.open(fileName, blockSize, compress))
+        return false;
+
+    QVector<double> x(blockSize);
+    QVector<double> y(blockSize);
+    for(int set=0; set<lines.size(); set++)
+    {
+        const QGraphDataSource* source = lines[set].source.data();
+        qint64 size = source->size();
+        for(qint64 from=0; from<size; from+=blockSize)
+        {
+            qint64 count = qMin(qint64(blockSize), size-from);
+            source->readX(from, count, x.data());
+            source->readY(from, count, y.data());
+            if(!writer.append(set, x.constData(), y.constData(), count))
+                return false;
+        }
+    }
+    return writer.close();
 }
 
 /**
-  \fn void QGraph::setAutoRefresh(bool autoRefresh)
-  Sets the variable autoRefresh.
-  This variable controls if the graph should be automatically refreshed
-  when it is required. For exaple when you add data with appenData() it
-  might be unefficient to redraw the whole graph because you want to add
-  more data. You can call refresh() to manually update the graph.
+  \fn int QGraph::loadRecording(QString fileName)
+  Opens a QGraph recording file and adds one trace per recorded trace.
+  Only the file index and the summaries needed for the current view are
+  read, samples are loaded when they are displayed. Returns the number
+  of added traces, 0 if the file could not be opened.
  **/
-void QGraph::setAutoRefresh(bool autoRefresh)
+int QGraph::loadRecording(QString fileName)
 {
-    this->autoRefresh = autoRefresh;
+    QSharedPointer<QGraphRecording> recording = QGraphRecording::open(fileName);
+    if(!recording)
+        return 0;
+    for(int trace=0; trace<recording->traceCount(); trace++)
+    {
+        const QGraphRecording::TraceHeader& header = recording->traceHeader(trace);
+        LineInfo line;
+        line.source = QSharedPointer<QGraphDataSource>(new QGraphFileSource(recording, trace));
+        line.style = header.style <= Scatter ? GraphStyle(header.style) : Line;
+        line.barWidth = header.barWidth;
+        line.pen = QPen(QColor::fromRgba(header.penColor), header.penWidth);
+        line.brush = QBrush(QColor::fromRgba(header.brushColor));
+        lines.push_back(line);
+    }
+    if(autoRefresh)
+        refresh();
+    return recording->traceCount();
 }
 
-void QGraph::setRightClickMenu(bool menu)
+/**
+  \fn QGraphImporter* QGraph::importCsv(QString fileName, int xColumn, QVector<QPen> pens)
+  Starts loading a CSV file in the background and adds one trace per
+  column except xColumn (the row number is used as x if xColumn < 0).
+  A header line and the delimiter (comma, semicolon, tab or spaces) are
+  detected. The graph shows the data while it is loaded. The returned
+  importer reports progress, can be canceled and deletes itself after
+  finished(), it is 0 if the file could not be opened.
+ **/
+QGraphImporter* QGraph::importCsv(QString fileName, int xColumn, QVector<QPen> pens)
 {
-    rightClickMenu = menu;
+    QGraphImporter* importer = new QGraphImporter(this);
+    if(!importer->startCsv(fileName, xColumn))
+    {
+        delete importer;
+        return 0;
+    }
+    return addImporter(importer, pens);
 }
 
-bool QGraph::getRightClickMenu()
+/**
+  \fn QGraphImporter* QGraph::importBinary(QString fileName, QGraphMappedSource::SampleType type, int channels, double sampleRate, qint64 headerBytes, QVector<QPen> pens)
+  Starts loading an interleaved raw binary file in the background and
+  adds one trace per channel, see importCsv(). Unlike appendMappedFile()
+  the samples are copied into memory, so the file can be removed or
+  overwritten afterwards.
+ **/
+QGraphImporter* QGraph::importBinary(QString fileName, QGraphMappedSource::SampleType type, int channels, double sampleRate, qint64 headerBytes, QVector<QPen> pens)
 {
-    return rightClickMenu;
+    QGraphImporter* importer = new QGraphImporter(this);
+    if(!importer->startBinary(fileName, type, channels, sampleRate, headerBytes))
+    {
+        delete importer;
+        return 0;
+    }
+    return addImporter(importer, pens);
 }
 
-void QGraph::setTitle(QString title, QFont font, QPen pen)
+QGraphImporter* QGraph::addImporter(QGraphImporter* importer, const QVector<QPen>& pens)
 {
-    this->titleFont = font;
-    this->title = title;
-    this->titlePen = pen;
-    if(title.isEmpty())
-        titleEnabled = false;
-    else
-        titleEnabled = true;
-    menuTitle->setChecked(titleEnabled);
-    if(autoRefresh)
+    const QVector< QSharedPointer<QGraphChunkedSource<double> > >& sources = importer->sources();
+    for(int set=0; set<sources.size(); set++)
     {
-        repaint();
-        update();
+        LineInfo line;
+        line.source = sources[set];
+        line.style = Line;
+        line.barWidth = 0.9;
+        line.pen = pens.size() == sources.size() ? pens[set] : QPen(Qt::black, 0);
+        line.brush = QBrush(Qt::transparent);
+        lines.push_back(line);
     }
+    connect(importer, SIGNAL(dataAvailable()), this, SLOT(onImportData()));
+    connect(importer, SIGNAL(finished(bool)), this, SLOT(onImportFinished()));
+    connect(importer, SIGNAL(finished(bool)), importer, SLOT(deleteLater()));
+    importRefreshClock.invalidate();
+    if(autoRefresh)
+        refresh();
+    importView = srcRect;
+    return importer;
 }
 
-QString QGraph::getTitle()
+/**
+  \fn void QGraph::appendTrigger(QGraphTrigger* trigger, QPen pen)
+  Adds a trace which shows the latest capture of the trigger. The view
+  is fitted to the first capture, later captures keep the view, so the
+  aligned windows stay in place.
+ **/
+void QGraph::appendTrigger(QGraphTrigger* trigger, QPen pen)
 {
-    return title;
+    LineInfo line;
+    line.source = trigger->capture();
+    line.pen = pen;
+    line.brush = QBrush(Qt::transparent);
+    line.trigger = trigger;
+    lines.push_back(line);
+    connect(trigger, SIGNAL(captureReady()), this, SLOT(onTriggerCapture()), Qt::QueuedConnection);
+    if(autoRefresh)
+        refresh();
 }
 
-void QGraph::setXLabel(QString xLabel, QFont font, QPen pen)
+/**
+  \fn void QGraph::appendSpectrum(QGraphSpectrum* spectrum, QPen pen)
+  Adds a trace which shows the latest result of the spectrum. The view
+  is fitted to the first result and kept for later ones.
+ **/
+void QGraph::appendSpectrum(QGraphSpectrum* spectrum, QPen pen)
 {
-    this->xLabel = xLabel;
-    this->xLabelFont = font;
-    this->xLabelPen = pen;
-    if(xLabel.isEmpty())
-        xLabelEnabled = false;
-    else
-        xLabelEnabled = true;
-    menuXLabel->setChecked(xLabelEnabled);
+    LineInfo line;
+    line.source = spectrum->spectrum();
+    line.pen = pen;
+    line.brush = QBrush(Qt::transparent);
+    line.spectrum = spectrum;
+    lines.push_back(line);
+    connect(spectrum, SIGNAL(spectrumReady()), this, SLOT(onSpectrumReady()), Qt::QueuedConnection);
+    spectrum->update();
     if(autoRefresh)
-    {
-        repaint();
-        update();
-    }
+        refresh();
 }
 
-QString QGraph::getXLabel()
+/**
+  \fn void QGraph::setEnvelopeLine(int set, EnvelopeLine envelopeLine)
+  Selects the line drawn on top of the band of an Envelope trace: none,
+  the mean or the last value of the samples in each pixel column.
+ **/
+void QGraph::setEnvelopeLine(int set, EnvelopeLine envelopeLine)
 {
-    return xLabel;
+    if(set < 0 || set >= lines.size())
+        return;
+    lines[set].envelopeLine = envelopeLine;
+    viewGeneration++;
+    if(autoRefresh)
+    {
+        insertLines();
+        update();
+    }
 }
 
-void QGraph::setYLabel(QString yLabel, QFont font, QPen pen)
+/**
+  \fn void QGraph::setScatterPoints(int set, const QVector<QColor>& palette, const QVector<quint8>& colorIndices, const QVector<quint8>& sizes)
+  Sets the marker colours and sizes of a Scatter trace. Point i is drawn
+  in palette[colorIndices[i]] with a diameter of sizes[i] pixels. Points
+  without an entry use the first colour of the palette, or the pen
+  colour if the palette is empty, and the pen width, at least 5 pixels.
+ **/
+void QGraph::setScatterPoints(int set, const QVector<QColor>& palette, const QVector<quint8>& colorIndices, const QVector<quint8>& sizes)
 {
-    this->yLabel = yLabel;
-    this->yLabelFont = font;
-    this->yLabelPen = pen;
-    if(yLabel.isEmpty())
-        yLabelEnabled = false;
-    else
-        yLabelEnabled = true;
-    menuYLabel->setChecked(yLabelEnabled);
+    if(set < 0 || set >= lines.size())
+        return;
+    lines[set].scatterPalette.clear();
+    for(int i=0; i<palette.size() && i<256; i++)
+        lines[set].scatterPalette.push_back(palette[i].rgba());
+    lines[set].scatterColors = colorIndices;
+    lines[set].scatterSizes = sizes;
+    viewGeneration++;
     if(autoRefresh)
     {
         repaint();
@@ -339,46 +653,122 @@ void QGraph::setYLabel(QString yLabel, QFont font, QPen pen)
     }
 }
 
-QString QGraph::getYLabel()
+/*
+  Replaces all traces by the given sources and refreshes only once.
+ */
+void QGraph::setSources(const QVector< QSharedPointer<QGraphDataSource> >& sources, const QVector<QPen>& pens)
 {
-    return yLabel;
+    clearData();
+    lines.reserve(sources.size());
+    for(int set=0; set<sources.size(); set++)
+    {
+        LineInfo line;
+        line.source = sources[set];
+        line.style = Line;
+        line.barWidth = 0.9;
+        line.pen = pens.size() == sources.size() ? pens[set] : QPen(Qt::black, 0);
+        line.brush = QBrush(Qt::transparent);
+        lines.push_back(line);
+    }
+    if(autoRefresh)
+        refresh();
 }
 
-void QGraph::setUndertitle(QString undertitle, QFont font, QPen pen)
+void QGraph::useLimit(bool limitedX, bool limitedY)
 {
-    this->undertitle = undertitle;
-    this->undertitleFont = font;
-    this->undertitlePen = pen;
-    if(undertitle.isEmpty())
-        undertitleEnabled = false;
-    else
-        undertitleEnabled = true;
-    menuUndertitle->setChecked(undertitleEnabled);
+    this->limitedX = limitedX;
+    this->limitedY = limitedY;
+    persistenceReset = true;
+    if(autoRefresh)
+        dataMinMax();
+}
+
+/**
+  \fn void QGraph::setAutoscaleY(bool autoscaleY)
+  Fits the y axis to the data inside the visible x range after every
+  zoom, pan and refresh. The min/max of the visible samples is queried
+  from the range index of each trace, so this is O(log n) per trace
+  for sorted traces, also for traces that are still growing.
+ **/
+void QGraph::setAutoscaleY(bool autoscaleY)
+{
+    this->autoscaleY = autoscaleY;
+    menuAutoscaleY->setChecked(autoscaleY);
     if(autoRefresh)
     {
-        repaint();
+        insertLines();
         update();
     }
 }
 
-QString QGraph::getUndertitle()
+bool QGraph::getAutoscaleY()
 {
-    return undertitle;
+    return autoscaleY;
 }
 
-void QGraph::setXNumbersEnabled(bool xNumbersEnabled)
+/**
+  \fn QGraph::Statistics QGraph::visibleStatistics(int set)
+  Returns count, mean, RMS, min and max of the samples of a trace inside
+  the visible x range. For sorted traces this takes two binary searches
+  and range index queries, not a scan of the visible samples. count is 0
+  if no sample is visible.
+ **/
+QGraph::Statistics QGraph::visibleStatistics(int set)
 {
-    this->xNumbersEnabled = xNumbersEnabled;
-    if(autoRefresh)
+    Statistics statistics = {0, 0.0, 0.0, 0.0, 0.0};
+    if(set < 0 || set >= lines.size())
+        return statistics;
+    const QGraphDataSource* source = lines[set].source.data();
+    double left = qMin(srcRect.left(), srcRect.right());
+    double right = qMax(srcRect.left(), srcRect.right());
+    double sum = 0.0;
+    double sumSquares = 0.0;
+    if(source->sortedX())
     {
-        repaint();
-        update();
+        qint64 from, to;
+        visibleRange(source, left, right, from, to);
+        if(from >= to)
+            return statistics;
+        statistics.count = to-from;
+        source->sums(from, to, sum, sumSquares);
+        source->minMaxY(from, to, statistics.min, statistics.max);
+    }
+    else
+    {
+        statistics.min = numeric_limits<double>::infinity();
+        statistics.max = -numeric_limits<double>::infinity();
+        for(qint64 i=0; i<source->size(); i++)
+        {
+            if(source->x(i)<left || source->x(i)>right)
+                continue;
+            double y = source->y(i);
+            statistics.count++;
+            sum += y;
+            sumSquares += y*y;
+            statistics.min = qMin(statistics.min, y);
+            statistics.max = qMax(statistics.max, y);
+        }
+        if(statistics.count == 0)
+        {
+            statistics.min = 0.0;
+            statistics.max = 0.0;
+            return statistics;
+        }
     }
+    statistics.mean = sum/statistics.count;
+    statistics.rms = sqrt(qMax(sumSquares/statistics.count, 0.0));
+    return statistics;
 }
 
-void QGraph::setYNumbersEnabled(bool yNumbersEnabled)
+/**
+  \fn void QGraph::setStatisticsReadout(bool readout)
+  Shows the visibleStatistics() of the tracked trace below the tracking
+  readout while a point is tracked. They are updated with every zoom and
+  pan.
+ **/
+void QGraph::setStatisticsReadout(bool readout)
 {
-    this->yNumbersEnabled = yNumbersEnabled;
+    statisticsReadout = readout;
     if(autoRefresh)
     {
         repaint();
@@ -386,775 +776,6423 @@ void QGraph::setYNumbersEnabled(bool yNumbersEnabled)
     }
 }
 
-void QGraph::setLeftBorder(int leftBorder)
+bool QGraph::getStatisticsReadout()
 {
-    this->leftBorder = leftBorder;
+    return statisticsReadout;
 }
 
-void QGraph::setTopBorder(int topBorder)
+/**
+  \fn void QGraph::setStripChart(bool stripChart, double window)
+  Locks the x range to the newest window x units of data. The line
+  traces are kept rasterized in a data layer: refresh() scrolls it left
+  by the elapsed pixels and draws only the new columns on the right, so
+  an update costs O(new samples). Traces which are not sorted Line
+  traces, autoscaling y and data leaving the y range fall back to
+  drawing the whole window, the y range then fits the data in the
+  window unless it is limited with limitY().
+ **/
+void QGraph::setStripChart(bool stripChart, double window)
 {
-    this->topBorder = topBorder;
+    this->stripChart = stripChart;
+    stripWindow = window > 0.0 ? window : 1.0;
+    stripLayer = QImage();
+    if(autoRefresh)
+        refresh();
+}
+
+bool QGraph::getStripChart()
+{
+    return stripChart;
+}
+
+/**
+  \fn QGraphAxisGroup* QGraph::getAxisGroup()
+  Returns the group whose x axis this graph follows, 0 if it is not
+  linked. Graphs are linked with QGraphAxisGroup::addGraph().
+ **/
+QGraphAxisGroup* QGraph::getAxisGroup()
+{
+    return axisGroup;
+}
+
+/**
+  \fn void QGraph::setPersistence(bool persistence)
+  Switches to an analog scope like persistence view. Every refresh draws
+  the traces once into a coverage mask which is added to an intensity
+  buffer of the size of the plot area, after the buffer has decayed by
+  the time passed since the last refresh. The buffer is colour mapped and
+  shown instead of the traces. No history of the data is kept, so the
+  cost of a refresh does not depend on how many acquisitions were
+  overlaid. The markers of Scatter traces are added to the coverage
+  mask like the other traces. Zooming, panning, resizing and changing
+  the limits start a new accumulation. The view following the data
+  (refresh(), autoscale) does not.
+ **/
+void QGraph::setPersistence(bool persistence)
+{
+    this->persistence = persistence;
+    if(!persistence)
+    {
+        persistenceBuffer = QVector<float>();
+        persistenceHits = QImage();
+        persistenceImage = QImage();
+        persistenceArea = QRect();
+    }
+    if(autoRefresh)
+    {
+        insertLines();
+        update();
+    }
+}
+
+bool QGraph::getPersistence()
+{
+    return persistence;
+}
+
+/**
+  \fn void QGraph::setPersistenceDecay(double ms)
+  Sets the time constant of the persistence decay in milliseconds. The
+  intensity drops to 1/e after that time. 0 keeps everything.
+ **/
+void QGraph::setPersistenceDecay(double ms)
+{
+    persistenceDecay = qMax(ms, 0.0);
+}
+
+double QGraph::getPersistenceDecay()
+{
+    return persistenceDecay;
+}
+
+/**
+  \fn void QGraph::setPersistenceColors(const QVector<QColor>& colors)
+  Sets the colours of the persistence view from rarely to often hit
+  pixels, they are interpolated linearly. Pixels which are not hit stay
+  transparent. An empty vector selects blue, cyan, green, yellow, red.
+ **/
+void QGraph::setPersistenceColors(const QVector<QColor>& colors)
+{
+    QVector<QColor> stops = colors;
+    if(stops.isEmpty())
+        stops << Qt::blue << Qt::cyan << Qt::green << Qt::yellow << Qt::red;
+    QGraphKernels::colorTable(stops, persistenceLut);
+    persistenceLut[0] = qRgba(0, 0, 0, 0);
+    if(!persistenceImage.isNull())
+    {
+        for(int row=0; row<persistenceArea.height(); row++)
+            QGraphKernels::colorMap(persistenceBuffer.constData()+row*persistenceArea.width(), persistenceArea.width(), persistenceLut.constData(), reinterpret_cast<QRgb*>(persistenceImage.scanLine(row)));
+    }
+}
+
+/**
+  \fn void QGraph::clearPersistence()
+  Clears the accumulated intensities of the persistence view.
+ **/
+void QGraph::clearPersistence()
+{
+    persistenceBuffer.fill(0.0f);
+    if(!persistenceImage.isNull())
+        persistenceImage.fill(0);
+    if(autoRefresh)
+    {
+        repaint();
+        update();
+    }
+}
+
+void QGraph::useZoomLimit(bool zoomLimit)
+{
+    this->zoomLimit =  zoomLimit;
+    if(autoRefresh)
+    {
+        //dataMinMax();
+        //insertLines();
+        refresh();
+    }
+}
+
+/**
+  \fn void QGraph::zoomBack()
+  Goes back to the previous view of the zoom history. Zooming with the
+  mouse or wheel, panning and the double click record views. If the data
+  did not change since the view was shown, its cached image is reused
+  instead of rendering the traces again. Also bound to the back key
+  (Alt+Left on most platforms), the back mouse button and the menu.
+ **/
+void QGraph::zoomBack()
+{
+    if(!canZoomBack())
+        return;
+    beginViewChange();
+    showView(historyIndex-1);
+}
+
+/**
+  \fn void QGraph::zoomForward()
+  Goes forward again after zoomBack(), see there.
+ **/
+void QGraph::zoomForward()
+{
+    if(canZoomForward())
+        showView(historyIndex+1);
+}
+
+bool QGraph::canZoomBack()
+{
+    if(history.isEmpty())
+        return false;
+    // A view that was changed by other means, e.g. a linked graph, is left to the current entry
+    return historyIndex > 0 || srcRect != history[historyIndex].srcRect;
+}
+
+bool QGraph::canZoomForward()
+{
+    return historyIndex+1 < history.size() && srcRect == history[historyIndex].srcRect;
+}
+
+/**
+  \fn void QGraph::setZoomHistory(int entries, qint64 cacheBytes)
+  Limits the zoom history to the given number of views and the images
+  kept for them to cacheBytes. The views closest to the current one keep
+  their images. 0 entries disable the history.
+ **/
+void QGraph::setZoomHistory(int entries, qint64 cacheBytes)
+{
+    historyLimit = qMax(entries, 0);
+    historyCacheBytes = qMax(cacheBytes, qint64(0));
+    if(historyLimit == 0)
+    {
+        clearZoomHistory();
+        viewLayer = QImage();
+        return;
+    }
+    while(history.size() > historyLimit)
+    {
+        int drop = historyIndex > 0 ? 0 : history.size()-1;
+        history.remove(drop);
+        if(drop < historyIndex)
+            historyIndex--;
+    }
+    trimViewCache();
+    updateHistoryMenu();
+}
+
+/**
+  \fn void QGraph::clearZoomHistory()
+  Forgets all recorded views and their images.
+ **/
+void QGraph::clearZoomHistory()
+{
+    history.clear();
+    historyIndex = 0;
+    historyCoalesce = false;
+    updateHistoryMenu();
+}
+
+/*
+  Called before a user action changes srcRect. Makes sure the current
+  view is the current entry and hands it the cached data layer.
+ */
+void QGraph::beginViewChange()
+{
+    if(historyLimit <= 0)
+        return;
+    if(history.isEmpty() || srcRect != history[historyIndex].srcRect)
+    {
+        if(!history.isEmpty())
+            historyIndex++;
+        history.resize(historyIndex);
+        ViewEntry entry;
+        entry.srcRect = srcRect;
+        history.push_back(entry);
+        historyCoalesce = false;
+    }
+    storeViewLayer();
+}
+
+/*
+  Called after the new view was rendered. It becomes a new entry and
+  drops the entries ahead of the current one. With coalesce, changes in
+  quick succession (wheel steps) replace each other.
+ */
+void QGraph::endViewChange(bool coalesce)
+{
+    if(historyLimit <= 0 || history.isEmpty() || srcRect == history[historyIndex].srcRect)
+        return;
+    history.resize(historyIndex+1);
+    ViewEntry entry;
+    entry.srcRect = srcRect;
+    if(coalesce && historyCoalesce && historyIndex > 0 && historyClock.isValid() && historyClock.elapsed() < 500)
+        history[historyIndex] = entry;
+    else
+    {
+        history.push_back(entry);
+        historyIndex++;
+    }
+    historyCoalesce = coalesce;
+    historyClock.start();
+    while(history.size() > historyLimit)
+    {
+        history.remove(0);
+        historyIndex--;
+    }
+    trimViewCache();
+    updateHistoryMenu();
+}
+
+void QGraph::storeViewLayer()
+{
+    ViewEntry& entry = history[historyIndex];
+    if(viewLayer.isNull() || viewLayerRect != entry.srcRect || viewLayerGeneration != viewGeneration)
+        return;
+    entry.layer = viewLayer;
+    entry.layerArea = viewLayerArea;
+    entry.layerGeneration = viewLayerGeneration;
+    trimViewCache();
+}
+
+/*
+  Shows a recorded view. With a valid cached layer only the axes are
+  drawn and the layer is blitted, the scene is rebuilt later if needed.
+ */
+void QGraph::showView(int index)
+{
+    storeViewLayer();
+    historyIndex = index;
+    const ViewEntry& entry = history[index];
+    srcRect = entry.srcRect;
+    historyCoalesce = false;
+    persistenceReset = true;
+    if(!entry.layer.isNull() && entry.layerGeneration == viewGeneration && !persistence && !stripChart)
+    {
+        viewLayer = entry.layer;
+        viewLayerRect = entry.srcRect;
+        viewLayerArea = entry.layerArea;
+        viewLayerGeneration = entry.layerGeneration;
+        sceneStale = true;
+        xyPoints();
+        textSize();
+        repaint();
+    }
+    else
+        insertLines();
+    update();
+    updateHistoryMenu();
+    if(axisGroup)
+        axisGroup->follow(this);
+}
+
+/*
+  Drops cached layers, farthest from the current entry first, until
+  they fit into historyCacheBytes.
+ */
+void QGraph::trimViewCache()
+{
+    qint64 bytes = 0;
+    for(int i=0; i<history.size(); i++)
+        bytes += qint64(history[i].layer.bytesPerLine())*history[i].layer.height();
+    for(int distance=history.size(); distance>0 && bytes > historyCacheBytes; distance--)
+    {
+        int candidates[2] = {historyIndex-distance, historyIndex+distance};
+        for(int c=0; c<2; c++)
+        {
+            int i = candidates[c];
+            if(i < 0 || i >= history.size() || history[i].layer.isNull())
+                continue;
+            bytes -= qint64(history[i].layer.bytesPerLine())*history[i].layer.height();
+            history[i].layer = QImage();
+        }
+    }
+    if(bytes > historyCacheBytes && historyIndex < history.size())
+        history[historyIndex].layer = QImage();
+}
+
+void QGraph::updateHistoryMenu()
+{
+    menuZoomBack->setEnabled(canZoomBack());
+    menuZoomForward->setEnabled(canZoomForward());
+}
+
+void QGraph::limitX(double xmin, double xmax)
+{
+    limitedX = true;
+    dataMinX = xmin;
+    dataMaxX = xmax;
+    persistenceReset = true;
+    if(autoRefresh)
+    {
+        //dataMinMax();
+        //insertLines();
+        refresh();
+    }
+}
+
+void QGraph::limitY(double ymin, double ymax)
+{
+    limitedY = true;
+    dataMinY = ymin;
+    dataMaxY = ymax;
+    persistenceReset = true;
+    if(autoRefresh)
+    {
+        //dataMinMax();
+        //insertLines();
+        refresh();
+    }
+}
+
+void QGraph::refresh()
+{
+    viewGeneration++;
+    for(int set=0; set<lines.size(); set++)
+        lines[set].source->sync();
+    if(stripChart)
+    {
+        updateStripChart();
+        update();
+        return;
+    }
+    dataMinMax();
+    textSize();
+    insertLines();
+    update();
+}
+
+/**
+  \fn void QGraph::setAutoRefresh(bool autoRefresh)
+  Sets the variable autoRefresh.
+  This variable controls if the graph should be automatically refreshed
+  when it is required. For exaple when you add data with appenData() it
+  might be unefficient to redraw the whole graph because you want to add
+  more data. You can call refresh() to manually update the graph.
+ **/
+void QGraph::setAutoRefresh(bool autoRefresh)
+{
+    this->autoRefresh = autoRefresh;
+}
+
+void QGraph::setRightClickMenu(bool menu)
+{
+    rightClickMenu = menu;
+}
+
+bool QGraph::getRightClickMenu()
+{
+    return rightClickMenu;
+}
+
+void QGraph::setTitle(QString title, QFont font, QPen pen)
+{
+    this->titleFont = font;
+    this->title = title;
+    this->titlePen = pen;
+    if(title.isEmpty())
+        titleEnabled = false;
+    else
+        titleEnabled = true;
+    menuTitle->setChecked(titleEnabled);
+    if(autoRefresh)
+    {
+        repaint();
+        update();
+    }
+}
+
+QString QGraph::getTitle()
+{
+    return title;
+}
+
+void QGraph::setXLabel(QString xLabel, QFont font, QPen pen)
+{
+    this->xLabel = xLabel;
+    this->xLabelFont = font;
+    this->xLabelPen = pen;
+    if(xLabel.isEmpty())
+        xLabelEnabled = false;
+    else
+        xLabelEnabled = true;
+    menuXLabel->setChecked(xLabelEnabled);
+    if(autoRefresh)
+    {
+        repaint();
+        update();
+    }
+}
+
+QString QGraph::getXLabel()
+{
+    return xLabel;
+}
+
+void QGraph::setYLabel(QString yLabel, QFont font, QPen pen)
+{
+    this->yLabel = yLabel;
+    this->yLabelFont = font;
+    this->yLabelPen = pen;
+    if(yLabel.isEmpty())
+        yLabelEnabled = false;
+    else
+        yLabelEnabled = true;
+    menuYLabel->setChecked(yLabelEnabled);
+    if(autoRefresh)
+    {
+        repaint();
+        update();
+    }
+}
+
+QString QGraph::getYLabel()
+{
+    return yLabel;
+}
+
+void QGraph::setUndertitle(QString undertitle, QFont font, QPen pen)
+{
+    this->undertitle = undertitle;
+    this->undertitleFont = font;
+    this->undertitlePen = pen;
+    if(undertitle.isEmpty())
+        undertitleEnabled = false;
+    else
+        undertitleEnabled = true;
+    menuUndertitle->setChecked(undertitleEnabled);
+    if(autoRefresh)
+    {
+        repaint();
+        update();
+    }
+}
+
+QString QGraph::getUndertitle()
+{
+    return undertitle;
+}
+
+void QGraph::setXNumbersEnabled(bool xNumbersEnabled)
+{
+    this->xNumbersEnabled = xNumbersEnabled;
+    if(autoRefresh)
+    {
+        repaint();
+        update();
+    }
+}
+
+void QGraph::setYNumbersEnabled(bool yNumbersEnabled)
+{
+    this->yNumbersEnabled = yNumbersEnabled;
+    if(autoRefresh)
+    {
+        repaint();
+        update();
+    }
+}
+
+void QGraph::setLeftBorder(int leftBorder)
+{
+    this->leftBorder = leftBorder;
+}
+
+void QGraph::setTopBorder(int topBorder)
+{
+    this->topBorder = topBorder;
 }
 
 void QGraph::setRightBorder(int rightBorder)
 {
-    this->rightBorder = rightBorder;
+    this->rightBorder = rightBorder;
+}
+
+void QGraph::setBottomBorder(int bottomBorder)
+{
+    this->bottomBorder = bottomBorder;
+}
+
+void QGraph::setDefaultBorder()
+{
+    leftBorder = 10;
+    topBorder = 10;
+    rightBorder = 10;
+    bottomBorder = 10;
+}
+
+void QGraph::setNoBorder()
+{
+    leftBorder = 0;
+    topBorder = 0;
+    rightBorder = 0;
+    bottomBorder = 0;
+}
+
+
+void QGraph::repaint()
+{
+    StageTimer timer(this, &currentStats.renderMs, "render");
+
+    // The data layer of this view may still be cached, e.g. after going back in the zoom history
+    QRect area = QRectF(dstRect).normalized().toAlignedRect();
+    bool cachedLayer = !persistence && !stripChart && !viewLayer.isNull() && viewLayerRect == srcRect && viewLayerArea == area && viewLayerGeneration == viewGeneration;
+    if(!cachedLayer && sceneStale)
+        insertGeometry();
+
+    // Fill image white
+    graphImage.fill(Qt::white);
+
+    // Generate destination rect and mirror y coordinate
+    QPainter painter(&graphImage);
+
+    // Turn off antializing
+    painter.setRenderHint(QPainter::NonCosmeticDefaultPen);
+
+    // Draw surrounding rect
+    painter.setBrush(Qt::transparent);
+    painter.setPen(Qt::black);
+    painter.drawRect(dstRect);
+
+    // Draw the coordinate lines
+    for(int i=0; i<xPoints.size(); i++)
+    {
+        painter.drawLine(src2dstX(xPoints[i]), dstRect.y(), src2dstX(xPoints[i]), dstRect.y()-7);
+        painter.drawLine(src2dstX(xPoints[i]), dstRect.y()+dstRect.height(), src2dstX(xPoints[i]), dstRect.y()+dstRect.height()+7);
+    }
+    for(int i=0; i<yPoints.size(); i++)
+    {
+        painter.drawLine(dstRect.x(), src2dstY(yPoints[i]), dstRect.x()+7, src2dstY(yPoints[i]));
+        painter.drawLine(dstRect.x()+dstRect.width()-7, src2dstY(yPoints[i]), dstRect.x()+dstRect.width(), src2dstY(yPoints[i]));
+    }
+
+    // Draw the values for the coordinate lines from the cached labels
+    painter.setFont(axisLabelFont);
+    if(xNumbersEnabled)
+    {
+        for(int i=0; i<xPoints.size(); i++)
+        {
+            const QStaticText& label = tickLabel(xPoints[i]);
+            QSizeF size = label.size();
+            painter.drawStaticText(QPointF(src2dstX(xPoints[i])-size.width()/2, dstRect.y()+5+(20-size.height())/2), label);
+        }
+    }
+    if(yNumbersEnabled)
+    {
+        for(int i=0; i<yPoints.size(); i++)
+        {
+            const QStaticText& label = tickLabel(yPoints[i]);
+            painter.drawStaticText(QPointF(dstRect.x()-5-label.size().width(), src2dstY(yPoints[i])-8), label);
+        }
+    }
+
+    // Draw the grid
+    if(grid)
+    {
+        painter.setPen(QPen(Qt::black, 0, Qt::DotLine));
+        for(int i=0; i<xPoints.size(); i++)
+        {
+            painter.drawLine(src2dstX(xPoints[i]), dstRect.y(), src2dstX(xPoints[i]), dstRect.y()+dstRect.height());
+        }
+        for(int i=0; i<yPoints.size(); i++)
+        {
+            painter.drawLine(dstRect.x(), src2dstY(yPoints[i]), dstRect.x()+dstRect.width(), src2dstY(yPoints[i]));
+        }
+        painter.setPen(QPen(Qt::black, 0, Qt::SolidLine));
+    }
+
+    // Draw the title
+    if(!title.isEmpty() && titleEnabled)
+    {
+        QFont oldFont = painter.font();
+        painter.setFont(titleFont);
+        painter.setPen(titlePen);
+        painter.drawText(QRectF(0, 5, graphImage.width(), sizeTitle), Qt::AlignCenter | Qt::TextWordWrap, title);
+        painter.setFont(oldFont);
+    }
+
+    // Draw the undertitle
+    if(!undertitle.isEmpty() && undertitleEnabled)
+    {
+        QFont oldFont = painter.font();
+        painter.setFont(undertitleFont);
+        painter.setPen(undertitlePen);
+        painter.drawText(QRectF(0, graphImage.height()-sizeUndertitle, graphImage.width(), sizeUndertitle), Qt::AlignCenter | Qt::TextWordWrap, undertitle);
+        painter.setFont(oldFont);
+    }
+
+    // Draw the y label
+    if(!yLabel.isEmpty() && yLabelEnabled)
+    {
+        QFont oldFont = painter.font();
+        painter.setFont(yLabelFont);
+        painter.setPen(yLabelPen);
+        painter.rotate(-90);
+        painter.drawText(QRectF(-dstRect.y(), leftBorder, -dstRect.height(), sizeYLabel), Qt::AlignCenter | Qt::TextWordWrap, yLabel);
+        painter.rotate(90);
+        painter.setFont(oldFont);
+    }
+
+    // Draw the x label
+    if(!xLabel.isEmpty() && xLabelEnabled)
+    {
+        QFont oldFont = painter.font();
+        painter.setFont(xLabelFont);
+        painter.setPen(xLabelPen);
+        painter.drawText(QRectF(dstRect.x(), graphImage.height()-sizeXLabel - sizeUndertitle - bottomBorder, dstRect.width(), sizeXLabel), Qt::AlignCenter | Qt::TextWordWrap, xLabel);
+        painter.setFont(oldFont);
+    }
+
+    if(cachedLayer)
+        painter.drawImage(area.topLeft(), viewLayer);
+    else
+    {
+        // Turn on antializing if required
+        painter.setRenderHint(QPainter::Antialiasing, antializing);
+
+        // Draw the matrix traces below the line traces
+        drawWaterfalls(painter);
+
+        // Render the graph, or the accumulated intensities in persistence mode
+        if(persistence && !persistenceImage.isNull())
+            painter.drawImage(persistenceArea.topLeft(), persistenceImage);
+        else if(stripChart && !stripLayer.isNull() && stripSrcRect == srcRect && stripArea == area)
+            painter.drawImage(stripArea.topLeft(), stripLayer);
+        else
+            scene->render(&painter, dstRect, srcRect, Qt::IgnoreAspectRatio);
+
+        // Turn off antializing
+        painter.setRenderHint(QPainter::Antialiasing, false);
+
+        // Stamp the scatter markers directly into the image, the persistence view already holds them
+        bool scatter = false;
+        for(int set=0; set<lines.size() && !scatter; set++)
+            scatter = lines[set].style == Scatter;
+        if(scatter && !(persistence && !persistenceImage.isNull()))
+        {
+            painter.end();
+            // Sprites are only evicted between frames, stamps refer to their indices
+            if(sprites.size() >= 4096)
+            {
+                sprites.clear();
+                spriteIndex.clear();
+            }
+            for(int set=0; set<lines.size(); set++)
+                if(lines[set].style == Scatter)
+                    stampScatter(lines[set], graphImage, QPoint(0, 0));
+            painter.begin(&graphImage);
+            painter.setRenderHint(QPainter::NonCosmeticDefaultPen);
+        }
+
+        // Keep the data layer, before the overlays are drawn, for the zoom
+        // history and so scatter points are not stamped again for overlays
+        if((historyLimit > 0 || scatter) && !persistence && !stripChart)
+        {
+            viewLayer = graphImage.copy(area);
+            viewLayerRect = srcRect;
+            viewLayerArea = area;
+            viewLayerGeneration = viewGeneration;
+        }
+    }
+
+    // Draw tracking point
+    if(tracking && trackingSet < lines.size() && trackingIndex < lines[trackingSet].source->size())
+    {
+        double posX = lines[trackingSet].source->x(trackingIndex);
+        double posY = lines[trackingSet].source->y(trackingIndex);
+        int tracX = src2dstX(posX);
+        int tracY = src2dstY(posY);
+        painter.setPen(Qt::black);
+        //painter.drawRect(tracX-7, tracY-7, 15, 15);
+        painter.drawLine(tracX+1, tracY, tracX+10, tracY);
+        painter.drawLine(tracX-1, tracY, tracX-10, tracY);
+        painter.drawLine(tracX, tracY+1, tracX, tracY+10);
+        painter.drawLine(tracX, tracY-1, tracX, tracY-10);
+
+        painter.drawText(QRect(dstRect.x()+20, dstRect.y()+dstRect.height()+20, 200, 20), tr("X: ")+QString::number(posX));
+        painter.drawText(QRect(dstRect.x()+20, dstRect.y()+dstRect.height()+40, 200, 20), tr("Y: ")+QString::number(posY));
+    }
+
+    // Draw the statistics of the visible part of the tracked trace
+    if(statisticsReadout && tracking && trackingSet < lines.size())
+    {
+        Statistics statistics = visibleStatistics(trackingSet);
+        painter.setPen(Qt::black);
+        painter.drawText(QRect(dstRect.x()+20, dstRect.y()+dstRect.height()+60, 400, 20), tr("N: %1  Mean: %2  RMS: %3").arg(statistics.count).arg(statistics.mean).arg(statistics.rms));
+        painter.drawText(QRect(dstRect.x()+20, dstRect.y()+dstRect.height()+80, 400, 20), tr("Min: %1  Max: %2").arg(statistics.min).arg(statistics.max));
+    }
+
+    // Draw zoom rect
+    if(zooming)
+    {
+        painter.drawRect(zoomRect);
+    }
+
+    // Finish
+    painter.end();
+}
+
+void QGraph::dataMinMax()
+{
+    // Make sure an area is defined when no data is given
+    if(!limitedX)
+    {
+        dataMinX=0.0;
+        dataMaxX=1.0;
+    }
+    if(!limitedY)
+    {
+        dataMinY=0.0;
+        dataMaxY=1.0;
+    }
+    bool gotElement = false;
+    for(int set=0; set<lines.size() && !limitedX; set++)
+    {
+        const QGraphDataSource* source = lines[set].source.data();
+        if(source->size() == 0)
+            continue;
+        double min, max;
+        source->minMaxX(0, source->size(), min, max);
+        if(!gotElement)
+        {
+            dataMinX = min;
+            dataMaxX = max;
+            gotElement = true;
+        }
+        else
+        {
+            dataMinX = qMin(dataMinX, min);
+            dataMaxX = qMax(dataMaxX, max);
+        }
+    }
+    for(int w=0; w<waterfalls.size() && !limitedX; w++)
+    {
+        QRectF area = waterfalls[w]->rect().normalized();
+        dataMinX = gotElement ? qMin(dataMinX, area.left()) : area.left();
+        dataMaxX = gotElement ? qMax(dataMaxX, area.right()) : area.right();
+        gotElement = true;
+    }
+
+    gotElement = false;
+    for(int set=0; set<lines.size() && !limitedY; set++)
+    {
+        const QGraphDataSource* source = lines[set].source.data();
+        qint64 size = source->size();
+        double min = numeric_limits<double>::infinity();
+        double max = -numeric_limits<double>::infinity();
+        if(!limitedX)
+            source->minMaxY(0, size, min, max);
+        else if(!visibleMinMaxY(source, dataMinX, dataMaxX, min, max))
+            continue;
+        if(min > max)
+            continue;
+        if(!gotElement)
+        {
+            dataMinY = min;
+            dataMaxY = max;
+            gotElement = true;
+        }
+        else
+        {
+            dataMinY = qMin(dataMinY, min);
+            dataMaxY = qMax(dataMaxY, max);
+        }
+    }
+    for(int w=0; w<waterfalls.size() && !limitedY; w++)
+    {
+        QRectF area = waterfalls[w]->rect().normalized();
+        dataMinY = gotElement ? qMin(dataMinY, area.top()) : area.top();
+        dataMaxY = gotElement ? qMax(dataMaxY, area.bottom()) : area.bottom();
+        gotElement = true;
+    }
+    srcRect = QRectF(dataMinX, dataMinY, dataMaxX-dataMinX, dataMaxY-dataMinY);
+}
+
+/*
+  The samples [from, to) of a sorted trace have left <= x <= right.
+ */
+void QGraph::visibleRange(const QGraphDataSource* source, double left, double right, qint64& from, qint64& to)
+{
+    qint64 size = source->size();
+    from = source->lowerBound(left);
+    to = source->lowerBound(right);
+    while(to < size && source->x(to) <= right)
+        to++;
+}
+
+/*
+  Min/max of the samples with left <= x <= right. Sorted traces need
+  two binary searches and one range query. Returns false if there are
+  no such samples.
+ */
+bool QGraph::visibleMinMaxY(const QGraphDataSource* source, double left, double right, double& min, double& max)
+{
+    min = numeric_limits<double>::infinity();
+    max = -numeric_limits<double>::infinity();
+    qint64 size = source->size();
+    if(source->sortedX())
+    {
+        qint64 from, to;
+        visibleRange(source, left, right, from, to);
+        if(from < to)
+            source->minMaxY(from, to, min, max);
+    }
+    else
+    {
+        for(qint64 i=0; i<size; i++)
+        {
+            if(source->x(i)<left || source->x(i)>right)
+                continue;
+            min = qMin(min, source->y(i));
+            max = qMax(max, source->y(i));
+        }
+    }
+    return min <= max;
+}
+
+/*
+  Sets the y range of the view to the data in its x range.
+ */
+void QGraph::fitY()
+{
+    bool gotElement = false;
+    double minY = 0.0;
+    double maxY = 0.0;
+    double left = qMin(srcRect.left(), srcRect.right());
+    double right = qMax(srcRect.left(), srcRect.right());
+    for(int set=0; set<lines.size(); set++)
+    {
+        double min, max;
+        if(!visibleMinMaxY(lines[set].source.data(), left, right, min, max))
+            continue;
+        minY = gotElement ? qMin(minY, min) : min;
+        maxY = gotElement ? qMax(maxY, max) : max;
+        gotElement = true;
+    }
+    if(!gotElement)
+        return;
+    if(minY == maxY)
+    {
+        minY -= 0.5;
+        maxY += 0.5;
+    }
+    srcRect = QRectF(srcRect.x(), minY, srcRect.width(), maxY-minY);
+}
+
+void QGraph::xyPoints()
+{
+    // The ticks only depend on the range
+    if(srcRect == ticksRect)
+        return;
+    ticksRect = srcRect;
+
+    // Calculate the points, linked graphs share the x ticks
+    if(axisGroup)
+        xPoints = axisGroup->ticks(this, srcRect.x(), srcRect.x()+srcRect.width());
+    else
+        calcPoints(xPoints, srcRect.x(), srcRect.x()+srcRect.width());
+    calcPoints(yPoints, srcRect.y(), srcRect.y()+srcRect.height());
+}
+
+void QGraph::insertLines()
+{
+    if(autoscaleY)
+        fitY();
+    textSize();
+    insertGeometry();
+    if(persistence)
+        accumulatePersistence();
+    xyPoints();
+    repaint();
+}
+
+/*
+  Draws the visible points of a Scatter trace by copying cached marker
+  sprites into target, whose top left pixel is at origin in widget
+  coordinates. No painter or scene item is involved. An Alpha8 target
+  (the persistence mask) gets the coverage of the sprites. Points
+  outside the plot area are culled, sorted traces are only read in the
+  visible x range. A point is skipped if the same sprite was already
+  stamped at the same pixel in this frame, which removes most of the
+  work for dense clouds.
+ */
+void QGraph::stampScatter(const LineInfo& line, QImage& target, const QPoint& origin)
+{
+    const QGraphDataSource* source = line.source.data();
+    QRect clip = QRectF(dstRect).normalized().toAlignedRect().intersected(target.rect().translated(origin));
+    if(clip.isEmpty() || srcRect.width() == 0.0 || srcRect.height() == 0.0)
+        return;
+    qint64 from = 0;
+    qint64 to = source->size();
+    if(source->sortedX())
+        visibleRange(source, qMin(srcRect.left(), srcRect.right()), qMax(srcRect.left(), srcRect.right()), from, to);
+    if(from >= to)
+        return;
+
+    double ax = dstRect.width()/srcRect.width();
+    double bx = dstRect.x() - srcRect.x()*ax;
+    double ay = dstRect.height()/srcRect.height();
+    double by = dstRect.y() - srcRect.y()*ay;
+    int defaultSize = line.pen.widthF() > 1.0 ? qRound(line.pen.widthF()) : 5;
+    QRgb defaultColor = line.scatterPalette.isEmpty() ? line.pen.color().rgba() : line.scatterPalette[0];
+
+    scatterStamps.fill(0, clip.width()*clip.height());
+    bool mask = target.format() == QImage::Format_Alpha8;
+    uchar* bits = target.bits();
+    int stride = target.bytesPerLine();
+    quint64 lastKey = ~quint64(0);
+    int sprite = 0;
+
+    const qint64 block = 4096;
+    QVector<double> xs(block), ys(block);
+    for(qint64 i=from; i<to; i+=block)
+    {
+        int count = int(qMin(block, to-i));
+        source->readX(i, count, xs.data());
+        source->readY(i, count, ys.data());
+        for(int j=0; j<count; j++)
+        {
+            double px = xs[j]*ax+bx;
+            double py = ys[j]*ay+by;
+            // Also rejects NaN
+            if(!(px >= clip.left() && px < clip.right()+1 && py >= clip.top() && py < clip.bottom()+1))
+                continue;
+            qint64 index = i+j;
+            QRgb color = defaultColor;
+            if(index < line.scatterColors.size() && line.scatterColors[int(index)] < line.scatterPalette.size())
+                color = line.scatterPalette[line.scatterColors[int(index)]];
+            int size = index < line.scatterSizes.size() ? qMax(int(line.scatterSizes[int(index)]), 1) : defaultSize;
+            quint64 key = (quint64(color) << 8) | quint64(size);
+            if(key != lastKey)
+            {
+                sprite = scatterSprite(color, size);
+                lastKey = key;
+            }
+
+            int cx = int(px);
+            int cy = int(py);
+            quint32& stamp = scatterStamps[(cy-clip.top())*clip.width() + (cx-clip.left())];
+            if(stamp == quint32(sprite+1))
+                continue;
+            stamp = sprite+1;
+
+            const QImage& image = sprites[sprite];
+            int left = cx - size/2;
+            int top = cy - size/2;
+            int x0 = qMax(left, clip.left());
+            int x1 = qMin(left+size, clip.right()+1);
+            int y0 = qMax(top, clip.top());
+            int y1 = qMin(top+size, clip.bottom()+1);
+            for(int y=y0; y<y1; y++)
+            {
+                const QRgb* src = reinterpret_cast<const QRgb*>(image.constScanLine(y-top)) + (x0-left);
+                if(mask)
+                {
+                    uchar* dst = bits + (y-origin.y())*stride + (x0-origin.x());
+                    for(int x=0; x<x1-x0; x++)
+                        dst[x] = qMax(dst[x], uchar(qAlpha(src[x])));
+                    continue;
+                }
+                QRgb* dst = reinterpret_cast<QRgb*>(bits + (y-origin.y())*stride) + (x0-origin.x());
+                for(int x=0; x<x1-x0; x++)
+                {
+                    int alpha = qAlpha(src[x]);
+                    if(alpha == 255)
+                        dst[x] = src[x];
+                    else if(alpha)
+                        dst[x] = qRgb((qRed(src[x])*alpha + qRed(dst[x])*(255-alpha))/255,
+                                      (qGreen(src[x])*alpha + qGreen(dst[x])*(255-alpha))/255,
+                                      (qBlue(src[x])*alpha + qBlue(dst[x])*(255-alpha))/255);
+                }
+            }
+        }
+    }
+}
+
+/*
+  Returns the index of the round marker sprite of the given colour and
+  diameter, drawing it on first use.
+ */
+int QGraph::scatterSprite(QRgb color, int size)
+{
+    quint64 key = (quint64(color) << 8) | quint64(size);
+    QHash<quint64, int>::const_iterator found = spriteIndex.constFind(key);
+    if(found != spriteIndex.constEnd())
+        return found.value();
+    QImage image(size, size, QImage::Format_ARGB32);
+    image.fill(Qt::transparent);
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing, antializing && size > 2);
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(QColor::fromRgba(color));
+    if(size > 2)
+        painter.drawEllipse(QRectF(0, 0, size, size));
+    else
+        painter.drawRect(QRectF(0, 0, size, size));
+    painter.end();
+    sprites.push_back(image);
+    spriteIndex.insert(key, sprites.size()-1);
+    return sprites.size()-1;
+}
+
+/*
+  Draws the visible part of every waterfall with one blit. The part is
+  cut out of the image in image pixels, so zoomed in views do not scale
+  the whole image.
+ */
+void QGraph::drawWaterfalls(QPainter& painter)
+{
+    QRectF view = srcRect.normalized();
+    for(int w=0; w<waterfalls.size(); w++)
+    {
+        const QGraphWaterfall* waterfall = waterfalls[w].data();
+        QRectF area = waterfall->rect().normalized();
+        QRectF visible = area.intersected(view);
+        if(visible.isEmpty() || waterfall->columns() == 0 || waterfall->rows() == 0)
+            continue;
+        // Image row 0 of the window is the top of the area
+        QRect window = waterfall->window();
+        QRectF source((visible.left()-area.left())/area.width()*window.width(),
+                      window.y() + (area.bottom()-visible.bottom())/area.height()*window.height(),
+                      visible.width()/area.width()*window.width(),
+                      visible.height()/area.height()*window.height());
+        double left = (visible.left()-srcRect.x())/srcRect.width()*dstRect.width()+dstRect.x();
+        double right = (visible.right()-srcRect.x())/srcRect.width()*dstRect.width()+dstRect.x();
+        double top = (visible.bottom()-srcRect.y())/srcRect.height()*dstRect.height()+dstRect.y();
+        double bottom = (visible.top()-srcRect.y())/srcRect.height()*dstRect.height()+dstRect.y();
+        painter.drawImage(QRectF(left, top, right-left, bottom-top).normalized(), waterfall->image(), source);
+    }
+}
+
+/*
+  Moves the strip chart window to the newest sample. If the data layer
+  is still valid it is scrolled by whole pixels and only the new columns
+  are drawn, otherwise the whole window is drawn again.
+ */
+void QGraph::updateStripChart()
+{
+    double newest = -numeric_limits<double>::infinity();
+    bool incremental = !autoscaleY;
+    for(int set=0; set<lines.size(); set++)
+    {
+        const QGraphDataSource* source = lines[set].source.data();
+        if(source->size() > 0)
+            newest = qMax(newest, source->x(source->size()-1));
+        incremental = incremental && lines[set].style == Line && source->sortedX();
+    }
+    QRect area = QRectF(dstRect).normalized().toAlignedRect();
+    if(newest == -numeric_limits<double>::infinity() || area.isEmpty())
+    {
+        dataMinMax();
+        textSize();
+        insertLines();
+        return;
+    }
+
+    double pixel = stripWindow/area.width();
+    double shift = floor((newest-stripRight)/pixel);
+    // A scroll that leaves no old column to keep is a full redraw, the scene is not rebuilt for it
+    bool valid = incremental && !stripLayer.isNull() && area == stripArea && srcRect == stripSrcRect && shift >= 0.0 && shift < area.width()-2;
+
+    // New samples outside the y range require a new range
+    for(int set=0; set<lines.size() && valid; set++)
+    {
+        const QGraphDataSource* source = lines[set].source.data();
+        qint64 from = source->lowerBound(stripRight-2*pixel);
+        double min, max;
+        source->minMaxY(from, source->size(), min, max);
+        valid = min > max || (min >= qMin(srcRect.top(), srcRect.bottom()) && max <= qMax(srcRect.top(), srcRect.bottom()));
+    }
+
+    if(!valid)
+    {
+        // The y range is that of the window, samples which scrolled out of it no longer widen it
+        stripRight = newest;
+        srcRect = QRectF(newest-stripWindow, srcRect.y(), stripWindow, srcRect.height());
+        if(limitedY)
+            srcRect = QRectF(srcRect.x(), dataMinY, stripWindow, dataMaxY-dataMinY);
+        else
+            fitY();
+        textSize();
+        insertGeometry();
+        stripLayer = QImage();
+        if(incremental)
+        {
+            stripArea = area;
+            stripLayer = QImage(area.width(), area.height(), QImage::Format_ARGB32_Premultiplied);
+            rasterizeStrip(0);
+        }
+        xyPoints();
+        repaint();
+        return;
+    }
+
+    // Scroll by whole pixels, so the columns stay aligned to the samples
+    int columns = int(shift);
+    stripRight += columns*pixel;
+    srcRect.moveLeft(stripRight-stripWindow);
+    int w = area.width();
+    if(columns > 0)
+    {
+        for(int row=0; row<area.height(); row++)
+        {
+            uchar* line = stripLayer.scanLine(row);
+            memmove(line, line+columns*sizeof(QRgb), (w-columns)*sizeof(QRgb));
+        }
+    }
+    // The last old columns are drawn again for segments to samples which were not there yet
+    rasterizeStrip(qMax(w-columns-2, 0));
+    xyPoints();
+    repaint();
+}
+
+/*
+  Draws the line traces from firstColumn to the right edge of the strip
+  chart data layer. Column 0 renders the whole scene, otherwise only the
+  samples of these columns and their neighbours are read, reduced to
+  their extremes per column if there are many of them.
+ */
+void QGraph::rasterizeStrip(int firstColumn)
+{
+    StageTimer timer(this, &currentStats.renderMs, "strip");
+    QRect columns(firstColumn, 0, stripArea.width()-firstColumn, stripArea.height());
+    QRectF target = QRectF(dstRect).translated(-stripArea.x(), -stripArea.y());
+    QPainter painter(&stripLayer);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.fillRect(columns, Qt::transparent);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    painter.setClipRect(columns);
+    painter.setRenderHint(QPainter::NonCosmeticDefaultPen);
+    painter.setRenderHint(QPainter::Antialiasing, antializing);
+    stripSrcRect = srcRect;
+    if(firstColumn == 0)
+    {
+        scene->render(&painter, target, srcRect, Qt::IgnoreAspectRatio);
+        return;
+    }
+
+    double pixel = stripWindow/stripArea.width();
+    double left = srcRect.x() + firstColumn*pixel;
+    QGraphicsScene strip;
+    for(int set=0; set<lines.size(); set++)
+    {
+        const LineInfo& line = lines[set];
+        const QGraphDataSource* source = line.source.data();
+        qint64 from = qMax(source->lowerBound(left)-1, qint64(0));
+        qint64 to = qMin(source->lowerBound(stripRight)+1, source->size());
+        if(to-from < 2)
+            continue;
+        QPainterPath path(QPointF(source->x(from), source->y(from)));
+        if(to-from > 4*columns.width())
+        {
+            qint64 start = from+1;
+            for(int c=firstColumn; c<stripArea.width() && start<to-1; c++)
+            {
+                qint64 end = c == stripArea.width()-1 ? to-1 : qMin(source->lowerBound(srcRect.x()+(c+1)*pixel), to-1);
+                if(end <= start)
+                    continue;
+                double x = srcRect.x()+(c+0.5)*pixel;
+                double min, max, first, last;
+                source->envelopeY(start, end, min, max, first, last);
+                path.lineTo(x, first);
+                path.lineTo(x, min);
+                path.lineTo(x, max);
+                path.lineTo(x, last);
+                start = end;
+            }
+        }
+        else
+        {
+            for(qint64 i=from+1; i<to-1; i++)
+                path.lineTo(source->x(i), source->y(i));
+        }
+        path.lineTo(source->x(to-1), source->y(to-1));
+        strip.addPath(path, line.pen, line.brush);
+    }
+    strip.render(&painter, target, srcRect, Qt::IgnoreAspectRatio);
+}
+
+/*
+  Adds the current geometry to the persistence buffer: the scene is
+  rendered into an 8 bit coverage mask of the plot area, then the buffer
+  decays, accumulates the mask and is colour mapped row by row.
+ */
+void QGraph::accumulatePersistence()
+{
+    StageTimer timer(this, &currentStats.renderMs, "persistence");
+    QRectF target(dstRect);
+    QRect area = target.normalized().toAlignedRect();
+    if(area.isEmpty())
+        return;
+    int w = area.width();
+    int h = area.height();
+    if(area != persistenceArea || persistenceReset || persistenceImage.isNull())
+    {
+        persistenceArea = area;
+        persistenceReset = false;
+        persistenceBuffer.fill(0.0f, w*h);
+        persistenceHits = QImage(w, h, QImage::Format_Alpha8);
+        persistenceImage = QImage(w, h, QImage::Format_ARGB32_Premultiplied);
+        persistenceClock.start();
+    }
+    double elapsed = persistenceClock.restart();
+    float decay = persistenceDecay > 0.0 ? float(exp(-elapsed/persistenceDecay)) : 1.0f;
+
+    persistenceHits.fill(0);
+    QPainter painter(&persistenceHits);
+    painter.setRenderHint(QPainter::Antialiasing, antializing);
+    scene->render(&painter, target.translated(-area.x(), -area.y()), srcRect, Qt::IgnoreAspectRatio);
+    painter.end();
+    for(int set=0; set<lines.size(); set++)
+        if(lines[set].style == Scatter)
+            stampScatter(lines[set], persistenceHits, area.topLeft());
+
+    // A single hit lands in the lower part of the colour map
+    const float gain = 0.25f/255.0f;
+    for(int row=0; row<h; row++)
+    {
+        float* intensity = persistenceBuffer.data()+row*w;
+        QGraphKernels::decayAccumulate(intensity, persistenceHits.constScanLine(row), w, decay, gain);
+        QGraphKernels::colorMap(intensity, w, persistenceLut.constData(), reinterpret_cast<QRgb*>(persistenceImage.scanLine(row)));
+    }
+}
+
+void QGraph::insertGeometry()
+{
+    StageTimer timer(this, &currentStats.geometryMs, "geometry");
+    sceneStale = false;
+    scene->clear();
+    int columns = qAbs(dstRect.width());
+    QVector<Column> envelope;
+    for(int set=0; set<lines.size(); set++)
+    {
+        LineInfo& line = lines[set];
+        QGraphDataSource* source = line.source.data();
+        qint64 from = 0;
+        qint64 to = source->size();
+        if(to == 0)
+            continue;
+
+        // Only the visible samples and their direct neighbours are required
+        bool sorted = source->sortedX();
+        if(sorted)
+        {
+            from = qMax(source->lowerBound(srcRect.left())-1, qint64(0));
+            to = qMin(source->lowerBound(srcRect.right())+1, to);
+            if(from >= to)
+                continue;
+        }
+        source->viewChanged(from, to);
+
+        // Scatter traces are stamped into the image by repaint()
+        if(line.style == Scatter)
+            continue;
+
+        // Draw unsorted curves with many more points than pixels from a simplified level
+        if(!sorted && line.style == Line && columns > 0 && to-from > 4*columns)
+        {
+            if(axisGroup)
+                line.lod = axisGroup->curveLod(line.source);
+            else if(!line.lod)
+                line.lod = QSharedPointer<QGraphCurveLodBuilder>(new QGraphCurveLodBuilder());
+            QSharedPointer<QGraphCurveLod> lod = QGraphCurveLodBuilder::levels(line.lod, line.source, this);
+            const QVector<qint64>* level = lod->level(qAbs(srcRect.width()/dstRect.width()), qAbs(srcRect.height()/dstRect.height()));
+            if(level)
+            {
+                QPainterPath path(QPointF(source->x(level->at(0)), source->y(level->at(0))));
+                for(int i=1; i<level->size(); i++)
+                    path.lineTo(source->x(level->at(i)), source->y(level->at(i)));
+                // Samples that arrived after the levels were built
+                for(qint64 i=lod->sourceSize(); i<to; i++)
+                    path.lineTo(source->x(i), source->y(i));
+                scene->addPath(path, line.pen, line.brush);
+                continue;
+            }
+        }
+
+        // Reduce the samples to their extremes per pixel column if there are many more samples than pixels
+        bool decimated = sorted && columns > 0 && to-from > 4*columns;
+        if(decimated)
+            decimate(source, from, to, columns, envelope);
+
+        switch(line.style)
+        {
+        case Line:
+        {
+            QPainterPath path(QPointF(source->x(from), source->y(from)));
+            if(decimated)
+            {
+                for(int c=0; c<envelope.size(); c++)
+                {
+                    const Column& column = envelope[c];
+                    path.lineTo(column.x, column.first);
+                    path.lineTo(column.x, column.min);
+                    path.lineTo(column.x, column.max);
+                    path.lineTo(column.x, column.last);
+                }
+                path.lineTo(source->x(to-1), source->y(to-1));
+            }
+            else
+            {
+                // Read the samples in blocks instead of one virtual call per coordinate
+                const qint64 block = 4096;
+                QVector<double> xs(block), ys(block);
+                for(qint64 i=from+1; i<to; i+=block)
+                {
+                    int count = int(qMin(block, to-i));
+                    source->readX(i, count, xs.data());
+                    source->readY(i, count, ys.data());
+                    for(int j=0; j<count; j++)
+                        path.lineTo(xs[j], ys[j]);
+                }
+            }
+            scene->addPath(path, line.pen);
+        }
+            break;
+        case Bar:
+        {
+            if(decimated)
+            {
+                double width = srcRect.width()/columns;
+                for(int c=0; c<envelope.size(); c++)
+                {
+                    double bottom = qMin(envelope[c].min, 0.0);
+                    double top = qMax(envelope[c].max, 0.0);
+                    scene->addRect(envelope[c].x-width/2, bottom, width, top-bottom, line.pen, line.brush);
+                }
+                break;
+            }
+            for(qint64 i=from; i<to; i++)
+            {
+                double width;
+                if(source->size() < 2)
+                    width = 1.0;
+                else if(i==0)
+                    width = source->x(0)-source->x(1);
+                else
+                    width = source->x(i)-source->x(i-1);
+                width *= line.barWidth;
+                scene->addRect(source->x(i)-width/2, source->y(i), width, -source->y(i), line.pen, line.brush);
+            }
+        }
+            break;
+        case Stem:
+        {
+            if(decimated)
+            {
+                for(int c=0; c<envelope.size(); c++)
+                    scene->addLine(envelope[c].x, qMin(envelope[c].min, 0.0), envelope[c].x, qMax(envelope[c].max, 0.0), line.pen);
+                break;
+            }
+            for(qint64 i=from; i<to; i++)
+            {
+                scene->addLine(source->x(i), source->y(i), source->x(i), 0, line.pen);
+                scene->addEllipse(source->x(i)-dst2srcW(9)/2, source->y(i)-dst2srcH(9)/2, dst2srcW(9), dst2srcH(9), line.pen);
+            }
+        }
+            break;
+        case Envelope:
+            insertEnvelope(line, from, to, decimated, envelope);
+            break;
+        case Scatter:
+            break;
+        }
+
+    }
+}
+
+/*
+  Draws the band between the per column min and max as one filled path,
+  so the cost depends on the width of the graph, not on the number of
+  samples. Without decimation every sample is its own column.
+ */
+void QGraph::insertEnvelope(const LineInfo& line, qint64 from, qint64 to, bool decimated, QVector<Column>& envelope)
+{
+    const QGraphDataSource* source = line.source.data();
+    if(!decimated)
+    {
+        envelope.clear();
+        envelope.reserve(int(to-from));
+        for(qint64 i=from; i<to; i++)
+        {
+            Column column;
+            column.x = source->x(i);
+            column.min = source->y(i);
+            column.max = column.min;
+            column.first = column.min;
+            column.last = column.min;
+            column.from = i;
+            column.to = i+1;
+            envelope.push_back(column);
+        }
+    }
+    if(envelope.isEmpty())
+        return;
+
+    QPainterPath band(QPointF(envelope[0].x, envelope[0].max));
+    for(int c=1; c<envelope.size(); c++)
+        band.lineTo(envelope[c].x, envelope[c].max);
+    for(int c=envelope.size()-1; c>=0; c--)
+        band.lineTo(envelope[c].x, envelope[c].min);
+    band.closeSubpath();
+    scene->addPath(band, line.pen, line.brush);
+
+    if(line.envelopeLine == NoEnvelopeLine)
+        return;
+    QPainterPath path;
+    for(int c=0; c<envelope.size(); c++)
+    {
+        double y;
+        if(line.envelopeLine == MeanLine)
+        {
+            double sum, sumSquares;
+            source->sums(envelope[c].from, envelope[c].to, sum, sumSquares);
+            y = sum/(envelope[c].to-envelope[c].from);
+        }
+        else
+            y = envelope[c].last;
+        if(c == 0)
+            path.moveTo(envelope[c].x, y);
+        else
+            path.lineTo(envelope[c].x, y);
+    }
+    scene->addPath(path, line.pen);
+}
+
+/*
+  Splits the visible x range into the given number of columns and stores
+  the extremes of the samples [from, to) that fall into each column.
+  Empty columns are skipped. The source must be sorted in x.
+ */
+void QGraph::decimate(const QGraphDataSource* source, qint64 from, qint64 to, int columns, QVector<Column>& envelope)
+{
+    envelope.clear();
+    double left = srcRect.left();
+    double width = srcRect.width()/columns;
+    qint64 start = qMax(source->lowerBound(left), from);
+    for(int c=0; c<columns && start<to; c++)
+    {
+        qint64 end = qMin(source->lowerBound(left+(c+1)*width), to);
+        if(c == columns-1)
+            end = to;
+        if(end <= start)
+            continue;
+        Column column;
+        column.x = left+(c+0.5)*width;
+        column.from = start;
+        column.to = end;
+        source->envelopeY(start, end, column.min, column.max, column.first, column.last);
+        envelope.push_back(column);
+        start = end;
+    }
+}
+
+// FIXME: Not working for min == max!!!
+void QGraph::calcPoints(QVector<double>& points, double min, double max)
+{
+    points.clear();
+    if(max-min == 0)
+        return;
+    double dxIdeal = (max-min)/4.0;
+    double dx = exp(floor(log(dxIdeal)/log(10.0))*log(10.0));
+    double diff = log(dxIdeal)/log(10.0)-floor(log(dxIdeal)/log(10.0));
+    if(diff > 0.69897)
+        dx *= 5;
+    else if(diff > 0.30103)
+        dx *= 2;
+
+    double start = ceil(min/dx);
+    double end = floor(max/dx);
+    for(double i = start; i<=end; i++)
+        points.push_back(dx*i);
+}
+
+void QGraph::checkZoomLimit()
+{
+    if(zoomLimit)
+    {
+        if(limitedX && srcRect.x()<dataMinX)
+            srcRect.setX(dataMinX);
+        if(limitedX && srcRect.x()+srcRect.width()>dataMaxX)
+            srcRect.setWidth(dataMaxX-srcRect.x());
+        if(limitedY && srcRect.y()<dataMinY)
+            srcRect.setY(dataMinY);
+        if(limitedY && srcRect.y()+srcRect.height()>dataMaxY)
+            srcRect.setHeight(dataMaxY-srcRect.y());
+    }
+}
+
+void QGraph::mousePressEvent(QMouseEvent* event)
+{
+    if(event->button() == Qt::LeftButton)
+    {
+        zooming = true;
+        zoomRect = QRect(event->x(), event->y(), 0, 0);
+    }
+    else if(event->button() == Qt::RightButton)
+    {
+        if(rightClickMenu)
+        {
+            menu.popup(QCursor::pos());
+        }
+    }
+    else if(event->button() == Qt::MiddleButton)
+    {
+        beginViewChange();
+        panning = true;
+        panStart = QCursor::pos();
+        panCurrent = panStart;
+    }
+    else if(event->button() == Qt::BackButton)
+        zoomBack();
+    else if(event->button() == Qt::ForwardButton)
+        zoomForward();
+}
+
+void QGraph::mouseMoveEvent(QMouseEvent* event)
+{
+    if(zooming)
+    {
+        zoomRect.setWidth(event->x()-zoomRect.x());
+        zoomRect.setHeight(event->y()-zoomRect.y());
+        repaint();
+        update();
+    }
+    if(panning)
+    {
+        updatePanning();
+    }
+}
+
+void QGraph::mouseReleaseEvent(QMouseEvent* event)
+{
+    if(event->button() == Qt::LeftButton && zooming)
+    {
+        zoomRect.setWidth(event->x()-zoomRect.x());
+        zoomRect.setHeight(event->y()-zoomRect.y());
+        zooming = false;
+        int zoomWidth = zoomRect.width();
+        int zoomX = zoomRect.x();
+        int zoomHeight = zoomRect.height();
+        int zoomY = zoomRect.y();
+        if(zoomWidth==0 && zoomHeight==0)
+        {
+            // this is a normal click, so find nearest data and highlight it
+            findGraphAt(QPoint(zoomX, zoomY));
+        }
+        else if(zoomWidth==0 || zoomHeight==0)
+            return;
+        else
+        {
+            if(zoomWidth<0)
+            {
+                zoomWidth = -zoomWidth;
+                zoomX = zoomX-zoomWidth;
+            }
+            if(zoomHeight>0)
+            {
+                zoomHeight = -zoomHeight;
+                zoomY = zoomY-zoomHeight;
+            }
+            beginViewChange();
+            srcRect = QRectF(dst2srcX(zoomX), dst2srcY(zoomY), dst2srcW(zoomWidth), dst2srcH(zoomHeight));
+            checkZoomLimit();
+            persistenceReset = true;
+
+            insertLines();
+            update();
+            endViewChange();
+            if(axisGroup)
+                axisGroup->follow(this);
+        }
+    }
+    if(event->button() == Qt::MiddleButton && panning)
+    {
+        updatePanning();
+        panning = false;
+        endViewChange();
+    }
+}
+
+void QGraph::mouseDoubleClickEvent(QMouseEvent*)
+{
+    beginViewChange();
+    srcRect = QRectF(dataMinX, dataMinY, dataMaxX-dataMinX, dataMaxY-dataMinY);
+    if(axisGroup)
+        axisGroup->fullX(this);
+    persistenceReset = true;
+    insertLines();
+    update();
+    endViewChange();
+    if(axisGroup)
+        axisGroup->follow(this);
+}
+
+void QGraph::wheelEvent(QWheelEvent* event)
+{
+    int delta = event->delta();
+    double factor = (double)delta/240;
+    if(factor<0)
+        factor = -1/factor;
+    double zoomW = srcRect.width();
+    double zoomH = srcRect.height();
+    double zoomX = srcRect.x();
+    double zoomY = srcRect.y();
+    double zoomToX = dst2srcX(event->x());
+    double zoomToY = dst2srcY(event->y());
+    zoomX = zoomToX + (zoomX-zoomToX)*factor;
+    zoomY = zoomToY + (zoomY-zoomToY)*factor;
+    zoomW *= factor;
+    zoomH *= factor;
+    if(zoomW == 0.0 || zoomH == 0.0)
+        return;
+    beginViewChange();
+    srcRect = QRectF(zoomX, zoomY, zoomW, zoomH);
+
+    checkZoomLimit();
+    persistenceReset = true;
+
+    insertLines();
+    update();
+    // A turn of the wheel is one history entry
+    endViewChange(true);
+    if(axisGroup)
+        axisGroup->follow(this);
+}
+
+/*
+  The old image is stretched as a placeholder, the new one is rendered
+  by the scheduler once the widget is visible.
+ */
+void QGraph::resizeEvent(QResizeEvent* event)
+{
+    // Stretch the old frame until the redraw, scaling a null image or to an empty size gives a null image
+    if(graphImage.isNull() || event->size().isEmpty())
+    {
+        graphImage = QImage(event->size(), QImage::Format_ARGB32);
+        graphImage.fill(Qt::white);
+    }
+    else
+        graphImage = graphImage.scaled(event->size(), Qt::IgnoreAspectRatio, Qt::FastTransformation);
+    calcDstRect();
+    QGraphScheduler::instance()->request(this, QGraphScheduler::Redraw);
+}
+
+void QGraph::paintEvent(QPaintEvent*)
+{
+    QGraphScheduler::instance()->exposed(this);
+    paintWidget();
+    // The frame ends after the paint stage is recorded
+    endFrame();
+}
+
+void QGraph::paintWidget()
+{
+    StageTimer timer(this, &currentStats.paintMs, "paint");
+    QPainter painter(this);
+    painter.drawImage(0, 0, graphImage);
+    painter.drawRect(0, 0, width()-1, height()-1);
+
+    // Draw the statistics of the last finished frame
+    if(frameStatsOverlay)
+    {
+        QString hud = tr("frame %1: layout %2 ms, geometry %3 ms, render %4 ms, paint %5 ms, total %6 ms")
+                .arg(lastStats.frame)
+                .arg(lastStats.layoutMs, 0, 'f', 2)
+                .arg(lastStats.geometryMs, 0, 'f', 2)
+                .arg(lastStats.renderMs, 0, 'f', 2)
+                .arg(lastStats.paintMs, 0, 'f', 2)
+                .arg(lastStats.totalMs, 0, 'f', 2);
+        QRect hudRect = painter.fontMetrics().boundingRect(hud).adjusted(-3, -2, 3, 2);
+        hudRect.moveTopLeft(QPoint(dstRect.x()+4, dstRect.y()+dstRect.height()+4));
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(QColor(255, 255, 224, 220));
+        painter.drawRect(hudRect);
+        painter.setPen(Qt::black);
+        painter.drawText(hudRect, Qt::AlignCenter, hud);
+    }
+    painter.end();
+    //cout<<"Paint event"<<endl;
+}
+
+void QGraph::keyPressEvent(QKeyEvent* event)
+{
+    if(event->matches(QKeySequence::Back) || event->key() == Qt::Key_Back)
+    {
+        zoomBack();
+        return;
+    }
+    if(event->matches(QKeySequence::Forward) || event->key() == Qt::Key_Forward)
+    {
+        zoomForward();
+        return;
+    }
+
+    int dx = 0;
+    if(event->key() == Qt::Key_Left)
+        dx = -1;
+    else if(event->key() == Qt::Key_Right)
+        dx = 1;
+    else if(event->key() == Qt::Key_Escape)
+    {
+        tracking = false;
+        repaint();
+        update();
+        return;
+    }
+    else
+    {
+        QWidget::keyPressEvent(event);
+        return;
+    }
+    if(!tracking || trackingSet >= lines.size())
+        return;
+    if(trackingIndex + dx < 0 || trackingIndex + dx >= lines[trackingSet].source->size())
+        return;
+    trackingIndex += dx;
+    repaint();
+    update();
+}
+
+int QGraph::src2dstX(double srcX)
+{
+    return qRound((srcX-srcRect.x())/srcRect.width()*dstRect.width()+dstRect.x());
+}
+
+int QGraph::src2dstY(double srcY)
+{
+    return qRound((srcY-srcRect.y())/srcRect.height()*dstRect.height()+dstRect.y());
+}
+
+void QGraph::setGrid(bool grid)
+{
+    this->grid = grid;
+    viewGeneration++;
+    menuGrid->setChecked(grid);
+    if(autoRefresh)
+    {
+        repaint();
+        update();
+    }
+}
+
+double QGraph::dst2srcX(int dstX)
+{
+    return (dstX-dstRect.x())*srcRect.width()/dstRect.width()+srcRect.x();
+}
+
+double QGraph::dst2srcY(int dstY)
+{
+    return (dstY-dstRect.y())*srcRect.height()/dstRect.height()+srcRect.y();
+}
+
+double QGraph::dst2srcW(int dstW)
+{
+    return dstW*srcRect.width()/dstRect.width();
+}
+
+double QGraph::dst2srcH(int dstH)
+{
+    return dstH*srcRect.height()/dstRect.height();
+}
+
+void QGraph::textSize()
+{
+    StageTimer timer(this, &currentStats.layoutMs, "layout");
+
+    sizeYNumbers = 0;
+    sizeXNumbers = 0;
+    sizeYLabel = 0;
+    sizeXLabel = 0;
+    sizeUndertitle = 0;
+    sizeTitle = 0;
+
+    if(yNumbersEnabled)
+    {
+        for(int i=0; i<yPoints.size(); i++)
+            sizeYNumbers = qMax(sizeYNumbers, int(ceil(tickLabel(yPoints[i]).size().width())) + 10);
+    }
+
+    // axisFontHeight is updated by tickLabel() when the font changes
+    tickLabel(0.0);
+    if(xNumbersEnabled)
+        sizeXNumbers = axisFontHeight + 10;
+
+    if(!title.isEmpty() && titleEnabled)
+        sizeTitle = wrappedHeight(titleLayout, title, titleFont, graphImage.width()) + 10;
+
+    if(!undertitle.isEmpty() && undertitleEnabled)
+        sizeUndertitle = wrappedHeight(undertitleLayout, undertitle, undertitleFont, graphImage.width()) + 10;
+
+    if(!xLabel.isEmpty() && xLabelEnabled)
+        sizeXLabel = wrappedHeight(xLabelLayout, xLabel, xLabelFont, graphImage.width()) + 10;
+
+    // The y label is wrapped to the height of the plot area, which does not depend on sizeYLabel
+    if(!yLabel.isEmpty() && yLabelEnabled)
+    {
+        int height = graphImage.height() - sizeTitle - topBorder - sizeXNumbers - sizeXLabel - sizeUndertitle - bottomBorder;
+        sizeYLabel = wrappedHeight(yLabelLayout, yLabel, yLabelFont, height) + 10;
+    }
+
+    calcDstRect();
+}
+
+/*
+  Height of text word wrapped to width. The result is kept in layout
+  and only computed again when the text, font or width change.
+ */
+int QGraph::wrappedHeight(TextLayout& layout, const QString& text, const QFont& font, int width)
+{
+    if(layout.width != width || layout.text != text || layout.font != font)
+    {
+        QFontMetrics metrics(font);
+        layout.height = metrics.boundingRect(0, 0, width, 500, Qt::AlignCenter | Qt::TextWordWrap, text).height();
+        layout.text = text;
+        layout.font = font;
+        layout.width = width;
+    }
+    return layout.height;
+}
+
+/*
+  Formatted and laid out tick label. Ticks keep their values while the
+  view is panned, so most labels of a frame come from the cache. The
+  cache is cleared when the axis font changes or it grows too large.
+ */
+const QStaticText& QGraph::tickLabel(double value)
+{
+    if(labelCacheFont != axisLabelFont || axisFontHeight == 0)
+    {
+        tickLabels.clear();
+        labelCacheFont = axisLabelFont;
+        axisFontHeight = QFontMetrics(axisLabelFont).height();
+    }
+    QHash<double, QStaticText>::iterator it = tickLabels.find(value);
+    if(it != tickLabels.end())
+        return it.value();
+    if(tickLabels.size() >= 256)
+        tickLabels.clear();
+    QStaticText label(QString::number(value));
+    label.setTextFormat(Qt::PlainText);
+    label.prepare(QTransform(), axisLabelFont);
+    return tickLabels.insert(value, label).value();
+}
+
+void QGraph::calcDstRect()
+{
+    /*int xSpace = sizeYLabel + sizeYNumbers + 50;
+    int ySpace = sizeXLabel + sizeXNumbers + sizeTitle + sizeUndertitle + 35;
+    dstRect = QRect(sizeYLabel + sizeYNumbers + 15, graphImage.height() - (sizeXNumbers + sizeXLabel + sizeUndertitle + 20), graphImage.width()-xSpace, -(graphImage.height() - ySpace));*/
+
+    int left = sizeYLabel + sizeYNumbers + leftBorder;
+    int top = sizeTitle + topBorder;
+    int right = rightBorder;
+    int bottom = sizeXNumbers + sizeXLabel + sizeUndertitle + bottomBorder;
+    int w = graphImage.width();
+    int h = graphImage.height();
+
+    dstRect = QRect(left, h - bottom, w - left - right, -(h - top - bottom));
+}
+
+void QGraph::updatePanning()
+{
+    panCurrent = QCursor::pos();
+    double dx = dst2srcW(panCurrent.x()-panStart.x());
+    double dy = dst2srcH(panCurrent.y()-panStart.y());
+    if(zoomLimit)
+    {
+        if(limitedX && srcRect.x()-dx<dataMinX)
+            dx = srcRect.x() - dataMinX;
+        if(limitedX && srcRect.x()-dx+srcRect.width()>dataMaxX)
+            dx = srcRect.x() + srcRect.width() - dataMaxX;
+        if(limitedY && srcRect.y()-dy<dataMinY)
+            dy = srcRect.y() - dataMinY;
+        if(limitedY && srcRect.y()-dy+srcRect.height()>dataMaxY)
+            dy = srcRect.y() + srcRect.height() - dataMaxY;
+    }
+    srcRect.setX(srcRect.x()-dx);
+    srcRect.setY(srcRect.y()-dy);
+    srcRect.setWidth(srcRect.width()-dx);
+    srcRect.setHeight(srcRect.height()-dy);
+    persistenceReset = persistenceReset || dx != 0.0 || dy != 0.0;
+    insertLines();
+    update();
+    if(axisGroup && dx != 0.0)
+        axisGroup->follow(this);
+    panStart = panCurrent;
+}
+
+ void QGraph::findGraphAt(QPoint pos)
+ {
+    if(lines.size() == 0)
+        return;
+    double clickX = dst2srcX(pos.x());
+    double clickY = dst2srcY(pos.y());
+
+    double minDist = numeric_limits<double>::infinity();
+    int minSet = -1;
+    qint64 minIndex = -1;
+
+    for(int set=0; set<lines.size(); set++)
+    {
+        const QGraphDataSource* source = lines[set].source.data();
+        qint64 size = source->size();
+        if(size == 0)
+            continue;
+        if(source->sortedX())
+        {
+            qint64 index = source->lowerBound(clickX);
+            if(index >= size)
+                index = size - 1;
+            if(index > 0 && fabs(source->x(index-1)-clickX) < fabs(source->x(index)-clickX))
+                index--;
+            double dx = source->x(index)-clickX;
+            double dy = source->y(index)-clickY;
+            double newDist = sqrt(dx*dx+dy*dy);
+            if(newDist < minDist)
+            {
+                minDist = newDist;
+                minSet = set;
+                minIndex = index;
+            }
+        }
+        else
+        {
+            for(qint64 index=0; index<size; index++)
+            {
+                double dx = source->x(index)-clickX;
+                double dy = source->y(index)-clickY;
+                double newDist = sqrt(dx*dx+dy*dy);
+                if(newDist < minDist)
+                {
+                    minDist = newDist;
+                    minSet = set;
+                    minIndex = index;
+                }
+            }
+        }
+    }
+    if(minSet == -1 || minIndex == -1)
+        return;
+
+    if(minDist > sqrt(srcRect.width()*srcRect.width()+srcRect.height()*srcRect.height())/20)
+    {
+        tracking = false;
+        repaint();
+        update();
+        return;
+    }
+
+    tracking = true;
+    trackingSet = minSet;
+    trackingIndex = minIndex;
+    repaint();
+    update();
+ }
+
+/**
+  \fn void QGraph::setFrameStatsEnabled(bool enabled)
+  Enables the timing of the render pipeline stages (layout, geometry,
+  render and paint). When enabled the signal frameRendered() is emitted
+  after each painted frame and frameStats() returns the timings of the
+  last finished frame. When disabled every stage costs a single branch.
+ **/
+void QGraph::setFrameStatsEnabled(bool enabled)
+{
+    frameStatsEnabled = enabled;
+    updateInstrumentation();
+}
+
+bool QGraph::getFrameStatsEnabled()
+{
+    return frameStatsEnabled;
+}
+
+/**
+  \fn void QGraph::setFrameStatsOverlay(bool overlay)
+  Draws the timings of the last frame on top of the plot.
+ **/
+void QGraph::setFrameStatsOverlay(bool overlay)
+{
+    frameStatsOverlay = overlay;
+    updateInstrumentation();
+    update();
+}
+
+QGraph::FrameStats QGraph::frameStats()
+{
+    return lastStats;
+}
+
+/**
+  \fn bool QGraph::startTrace(QString fileName)
+  Starts recording every pipeline stage as an event. The events are
+  streamed to fileName in the Chrome trace JSON format (chrome://tracing)
+  in batches, the file is completed when stopTrace() is called or the
+  graph is destroyed. Returns false if the file cannot be written.
+ **/
+bool QGraph::startTrace(QString fileName)
+{
+    if(fileName.isEmpty())
+        return false;
+    if(tracing)
+        stopTrace();
+    traceFile.setFileName(fileName);
+    if(!traceFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    {
+        cerr<<"QGraph: Could not write trace file "<<fileName.toStdString()<<endl;
+        return false;
+    }
+    QTextStream(&traceFile)<<"{\"traceEvents\":[\n";
+    traceEvents.clear();
+    traceWritten = 0;
+    tracing = true;
+    updateInstrumentation();
+    return true;
+}
+
+void QGraph::stopTrace()
+{
+    if(!tracing)
+        return;
+    tracing = false;
+    updateInstrumentation();
+    flushTrace();
+    QTextStream(&traceFile)<<"\n],\"displayTimeUnit\":\"ms\"}\n";
+    traceFile.close();
+}
+
+// Only TraceBatch events are kept in memory, the rest is already in the file
+void QGraph::addTraceEvent(const char* name, qint64 start, qint64 duration)
+{
+    TraceEvent event = {name, start, duration};
+    traceEvents.push_back(event);
+    if(traceEvents.size() >= TraceBatch)
+        flushTrace();
+}
+
+void QGraph::flushTrace()
+{
+    QTextStream out(&traceFile);
+    qint64 pid = QCoreApplication::applicationPid();
+    quintptr tid = reinterpret_cast<quintptr>(this) & 0x7fffffff;
+    for(int i=0; i<traceEvents.size(); i++)
+    {
+        const TraceEvent& event = traceEvents[i];
+        if(traceWritten++ > 0)
+            out<<",\n";
+        out<<"{\"name\":\""<<event.name<<"\",\"cat\":\"QGraph\",\"ph\":\"X\""
+           <<",\"ts\":"<<QString::number(event.start/1000.0, 'f', 3)
+           <<",\"dur\":"<<QString::number(event.duration/1000.0, 'f', 3)
+           <<",\"pid\":"<<pid<<",\"tid\":"<<(qulonglong)tid<<"}";
+    }
+    out.flush();
+    traceEvents.clear();
+}
+
+void QGraph::updateInstrumentation()
+{
+    instrumented = frameStatsEnabled || frameStatsOverlay || tracing;
+    if(!instrumented)
+        frameOpen = false;
+}
+
+void QGraph::beginFrame()
+{
+    if(frameOpen)
+        return;
+    currentStats = FrameStats();
+    currentStats.frame = ++frameCounter;
+    frameStart = statsClock.nsecsElapsed();
+    frameOpen = true;
+}
+
+void QGraph::endFrame()
+{
+    if(!instrumented || !frameOpen)
+        return;
+    qint64 now = statsClock.nsecsElapsed();
+    currentStats.totalMs = (now-frameStart)/1e6;
+    if(tracing)
+        addTraceEvent("frame", frameStart, now-frameStart);
+    lastStats = currentStats;
+    frameOpen = false;
+    emit frameRendered(lastStats);
+}
+
+QGraph::StageTimer::StageTimer(QGraph* graph, double* stage, const char* name) :
+    graph(graph),
+    stage(stage),
+    name(name),
+    start(-1)
+{
+    if(!graph->instrumented)
+        return;
+    graph->beginFrame();
+    start = graph->statsClock.nsecsElapsed();
+}
+
+QGraph::StageTimer::~StageTimer()
+{
+    if(start < 0)
+        return;
+    qint64 duration = graph->statsClock.nsecsElapsed()-start;
+    *stage += duration/1e6;
+    if(graph->tracing)
+        graph->addTraceEvent(name, start, duration);
+}
+
+void QGraph::onMenuGrid(bool grid)
+{
+    this->grid = grid;
+    viewGeneration++;
+    repaint();
+    update();
+}
+
+void QGraph::onMenuZoomBack()
+{
+    zoomBack();
+}
+
+void QGraph::onMenuZoomForward()
+{
+    zoomForward();
+}
+
+void QGraph::onMenuAutoscaleY(bool autoscaleY)
+{
+    this->autoscaleY = autoscaleY;
+    insertLines();
+    update();
+}
+
+void QGraph::onMenuAntializing(bool antializing)
+{
+    this->antializing = antializing;
+    viewGeneration++;
+    repaint();
+    update();
+}
+
+void QGraph::onMenuSavePicture()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Save file"), tr("."), "PNG (*.png);;JPG (*.jpg);;SVG (*.svg)");
+    if(fileName.isEmpty())
+        return;
+    if(fileName.toLower().endsWith(".svg"))
+    {
+        /*QSvgGenerator generator;
+        generator.setFileName("bla.svg");
+        generator.setSize(QSize(dstRect.width(), -dstRect.height()));
+        generator.setViewBox(QRect(0, 0, dstRect.width(), -dstRect.height()));
+        generator.setTitle(tr("SVG Generator Example Drawing"));
+        generator.setDescription(tr("An SVG drawing created by the SVG Generator Example provided with Qt."));
+
+        QPainter painter;
+        painter.begin(&generator);
+        scene->render(&painter, QRect(0, 0, dstRect.width(), -dstRect.height()), srcRect, Qt::IgnoreAspectRatio);
+        painter.end();*/
+    }
+    else
+    {
+        graphImage.save(fileName);
+    }
+}
+
+void QGraph::onMenuTitle(bool enableTitle)
+{
+    if(title.isEmpty())
+        menuTitle->setChecked(false);
+    else
+    {
+        this->titleEnabled = enableTitle;
+        insertLines();
+        update();
+    }
+}
+
+void QGraph::onMenuUndertitle(bool enableUndertitle)
+{
+    if(undertitle.isEmpty())
+        menuUndertitle->setChecked(false);
+    else
+    {
+        this->undertitleEnabled = enableUndertitle;
+        insertLines();
+        update();
+    }
+}
+
+void QGraph::onMenuXLabel(bool enableXLabel)
+{
+    if(xLabel.isEmpty())
+        menuXLabel->setChecked(false);
+    else
+    {
+        this->xLabelEnabled = enableXLabel;
+        insertLines();
+        update();
+    }
+}
+
+void QGraph::onMenuYLabel(bool enableYLabel)
+{
+    if(yLabel.isEmpty())
+        menuYLabel->setChecked(false);
+    {
+        this->yLabelEnabled = enableYLabel;
+        insertLines();
+        update();
+    }
+}
+
+void QGraph::onMenuXNumbers(bool enableXNumbers)
+{
+    this->xNumbersEnabled = enableXNumbers;
+    insertLines();
+    update();
+}
+
+void QGraph::onMenuYNumbers(bool enableYNumbers)
+{
+    this->yNumbersEnabled = enableYNumbers;
+    insertLines();
+    update();
+}
+
+void QGraph::onMenuNoBorder()
+{
+    setNoBorder();
+    insertLines();
+    update();
+}
+
+void QGraph::onMenuDefaultBorder()
+{
+    setDefaultBorder();
+    insertLines();
+    update();
+}
+
+/*
+  Shows the data of running imports at most every 100 ms.
+ */
+void QGraph::onImportData()
+{
+    if(!autoRefresh)
+        return;
+    if(importRefreshClock.isValid() && importRefreshClock.elapsed() < 100)
+        return;
+    QGraphScheduler::instance()->request(this, QGraphScheduler::Import);
+    importRefreshClock.start();
+}
+
+void QGraph::onImportFinished()
+{
+    if(autoRefresh)
+        QGraphScheduler::instance()->request(this, QGraphScheduler::Import);
+}
+
+/*
+  Like refresh(), but the view only follows the growing data as long as
+  the user did not zoom or pan since the import began. Otherwise the
+  data range is updated and the user's view is kept.
+ */
+void QGraph::refreshImport()
+{
+    if(stripChart)
+    {
+        refresh();
+        return;
+    }
+    viewGeneration++;
+    for(int set=0; set<lines.size(); set++)
+        lines[set].source->sync();
+    QRectF view = srcRect;
+    dataMinMax();
+    if(view != importView)
+        srcRect = view;
+    else
+        importView = srcRect;
+    textSize();
+    insertLines();
+    update();
+}
+
+void QGraph::onTriggerCapture()
+{
+    QGraphTrigger* trigger = qobject_cast<QGraphTrigger*>(sender());
+    if(!trigger)
+        return;
+    QSharedPointer<QGraphDataSource> capture = trigger->capture();
+    bool first = false;
+    for(int set=0; set<lines.size(); set++)
+    {
+        if(lines[set].trigger != trigger)
+            continue;
+        first = first || lines[set].source->size() == 0;
+        lines[set].source = capture;
+    }
+    viewGeneration++;
+    if(autoRefresh)
+        QGraphScheduler::instance()->request(this, first ? QGraphScheduler::Refresh : QGraphScheduler::Redraw);
+}
+
+void QGraph::onSpectrumReady()
+{
+    QGraphSpectrum* spectrum = qobject_cast<QGraphSpectrum*>(sender());
+    if(!spectrum)
+        return;
+    QSharedPointer<QGraphDataSource> result = spectrum->spectrum();
+    bool first = false;
+    for(int set=0; set<lines.size(); set++)
+    {
+        if(lines[set].spectrum != spectrum)
+            continue;
+        first = first || lines[set].source->size() == 0;
+        lines[set].source = result;
+    }
+    viewGeneration++;
+    if(autoRefresh)
+        QGraphScheduler::instance()->request(this, first ? QGraphScheduler::Refresh : QGraphScheduler::Redraw);
+}
+
+qint64 QGraphDataSource::lowerBound(double x) const
+{
+    qint64 first = 0;
+    qint64 count = size();
+    while(count > 0)
+    {
+        qint64 step = count/2;
+        if(this->x(first+step) < x)
+        {
+            first += step+1;
+            count -= step+1;
+        }
+        else
+            count = step;
+    }
+    return first;
+}
+
+void QGraphDataSource::minMaxX(qint64 from, qint64 to, double& min, double& max) const
+{
+    min = numeric_limits<double>::infinity();
+    max = -numeric_limits<double>::infinity();
+    if(from >= to)
+        return;
+    if(sortedX())
+    {
+        min = x(from);
+        max = x(to-1);
+        return;
+    }
+    for(qint64 i=from; i<to; i++)
+    {
+        min = qMin(min, x(i));
+        max = qMax(max, x(i));
+    }
+}
+
+void QGraphDataSource::minMaxY(qint64 from, qint64 to, double& min, double& max) const
+{
+    min = numeric_limits<double>::infinity();
+    max = -numeric_limits<double>::infinity();
+    for(qint64 i=from; i<to; i++)
+    {
+        min = qMin(min, y(i));
+        max = qMax(max, y(i));
+    }
+}
+
+void QGraphDataSource::envelopeY(qint64 from, qint64 to, double& min, double& max, double& first, double& last) const
+{
+    minMaxY(from, to, min, max);
+    first = from < to ? y(from) : min;
+    last = from < to ? y(to-1) : max;
+}
+
+static inline void kahanAdd(double& sum, double& error, double value)
+{
+    double y = value - error;
+    double t = sum + y;
+    error = (t - sum) - y;
+    sum = t;
+}
+
+/*
+  Reads the samples in blocks and adds them with Kahan summation.
+ */
+void QGraphDataSource::sums(qint64 from, qint64 to, double& sum, double& sumSquares) const
+{
+    double sumError = 0.0;
+    double squaresError = 0.0;
+    sum = 0.0;
+    sumSquares = 0.0;
+    const int blockSize = 4096;
+    double values[blockSize];
+    to = qMin(to, size());
+    for(qint64 start=qMax(from, qint64(0)); start<to; start+=blockSize)
+    {
+        int count = int(qMin(qint64(blockSize), to-start));
+        readY(start, count, values);
+        for(int i=0; i<count; i++)
+        {
+            kahanAdd(sum, sumError, values[i]);
+            kahanAdd(sumSquares, squaresError, values[i]*values[i]);
+        }
+    }
+}
+
+void QGraphDataSource::readX(qint64 from, qint64 count, double* out) const
+{
+    for(qint64 i=0; i<count; i++)
+        out[i] = x(from+i);
+}
+
+void QGraphDataSource::readY(qint64 from, qint64 count, double* out) const
+{
+    for(qint64 i=0; i<count; i++)
+        out[i] = y(from+i);
+}
+
+void QGraphRangeIndex::appendBlock(double min, double max, double sum, double sumSquares, qint64 count)
+{
+    QMutexLocker locker(&mutex);
+    Sums sums = {sum, sumSquares};
+    update(samples >> bits, min, max, sums);
+    samples += count;
+}
+
+/*
+  Merges the summary into its block and updates the tree above it. A
+  new root level is added whenever the top level has two entries. Only
+  the last block can change, so only its prefix sum is recomputed.
+ */
+void QGraphRangeIndex::update(qint64 block, double min, double max, const Sums& sums)
+{
+    if(prefix.isEmpty())
+    {
+        Prefix zero = {0.0, 0.0, 0.0, 0.0};
+        prefix.push_back(zero);
+    }
+    if(block == blockSums.size())
+        blockSums.push_back(sums);
+    else
+    {
+        blockSums[int(block)].sum += sums.sum;
+        blockSums[int(block)].squares += sums.squares;
+    }
+    Prefix next = prefix[int(block)];
+    kahanAdd(next.sum, next.sumError, blockSums[int(block)].sum);
+    kahanAdd(next.squares, next.squaresError, blockSums[int(block)].squares);
+    if(block+1 == prefix.size())
+        prefix.push_back(next);
+    else
+        prefix[int(block)+1] = next;
+
+    if(levels.isEmpty())
+        levels.push_back(QVector<Range>());
+    if(block == levels[0].size())
+    {
+        Range range = {min, max};
+        levels[0].push_back(range);
+    }
+    else
+    {
+        levels[0][int(block)].min = qMin(levels[0][int(block)].min, min);
+        levels[0][int(block)].max = qMax(levels[0][int(block)].max, max);
+    }
+
+    for(int level=1; levels[level-1].size() > 1; level++)
+    {
+        if(level == levels.size())
+            levels.push_back(QVector<Range>());
+        const QVector<Range>& below = levels[level-1];
+        int parent = int(block >> level);
+        Range range = below[2*parent];
+        if(2*parent+1 < below.size())
+        {
+            range.min = qMin(range.min, below[2*parent+1].min);
+            range.max = qMax(range.max, below[2*parent+1].max);
+        }
+        if(parent == levels[level].size())
+            levels[level].push_back(range);
+        else
+            levels[level][parent] = range;
+    }
+}
+
+void QGraphRangeIndex::blocksMinMax(qint64 from, qint64 to, double& min, double& max) const
+{
+    QMutexLocker locker(&mutex);
+    if(levels.isEmpty())
+        return;
+    from = qMax(from, qint64(0));
+    to = qMin(to, qint64(levels[0].size()));
+    for(int level=0; from < to && level < levels.size(); level++)
+    {
+        const QVector<Range>& ranges = levels[level];
+        if(from & 1)
+        {
+            min = qMin(min, ranges[int(from)].min);
+            max = qMax(max, ranges[int(from)].max);
+            from++;
+        }
+        if(to & 1)
+        {
+            to--;
+            min = qMin(min, ranges[int(to)].min);
+            max = qMax(max, ranges[int(to)].max);
+        }
+        from >>= 1;
+        to >>= 1;
+    }
+}
+
+void QGraphRangeIndex::blocksSums(qint64 from, qint64 to, double& sum, double& sumSquares) const
+{
+    QMutexLocker locker(&mutex);
+    from = qMax(from, qint64(0));
+    to = qMin(to, qint64(blockSums.size()));
+    if(from >= to)
+        return;
+    const Prefix& a = prefix[int(from)];
+    const Prefix& b = prefix[int(to)];
+    sum += (b.sum - a.sum) - (b.sumError - a.sumError);
+    sumSquares += (b.squares - a.squares) - (b.squaresError - a.squaresError);
+}
+
+QGraphChunkPool::QGraphChunkPool(int chunkBytes) :
+    chunkBytes(chunkBytes)
+{
+}
+
+QGraphChunkPool* QGraphChunkPool::instance(int chunkBytes)
+{
+    static QMutex poolsMutex;
+    static QHash<int, QGraphChunkPool*> pools;
+    QMutexLocker locker(&poolsMutex);
+    QGraphChunkPool*& pool = pools[chunkBytes];
+    if(!pool)
+        pool = new QGraphChunkPool(chunkBytes);
+    return pool;
+}
+
+void* QGraphChunkPool::allocate()
+{
+    QMutexLocker locker(&mutex);
+    if(freeChunks.isEmpty())
+    {
+        // Carve a new slab into chunks, the slabs are never returned to the heap
+        const int slabChunks = 32;
+        char* slab = new char[qint64(chunkBytes)*slabChunks];
+        for(int i=slabChunks-1; i>=0; i--)
+            freeChunks.push_back(slab + qint64(i)*chunkBytes);
+    }
+    void* chunk = freeChunks.last();
+    freeChunks.removeLast();
+    return chunk;
+}
+
+void QGraphChunkPool::release(void* chunk)
+{
+    if(!chunk)
+        return;
+    QMutexLocker locker(&mutex);
+    freeChunks.push_back(chunk);
+}
+
+/*
+  Bit stream helpers for QGraphCompressedSource. Bits are written most
+  significant first.
+ */
+class QGraphBitWriter
+{
+public:
+    QGraphBitWriter() : accumulator(0), bits(0) {}
+
+    void write(quint64 value, int count)
+    {
+        for(int i=count-1; i>=0; i--)
+        {
+            accumulator = (accumulator << 1) | ((value >> i) & 1);
+            if(++bits == 8)
+            {
+                bytes.append(char(accumulator));
+                accumulator = 0;
+                bits = 0;
+            }
+        }
+    }
+
+    QByteArray finish()
+    {
+        if(bits)
+            bytes.append(char(accumulator << (8-bits)));
+        accumulator = 0;
+        bits = 0;
+        return bytes;
+    }
+
+private:
+    QByteArray bytes;
+    uint accumulator;
+    int bits;
+};
+
+class QGraphBitReader
+{
+public:
+    QGraphBitReader(const QByteArray& bytes) : data(reinterpret_cast<const uchar*>(bytes.constData())), position(0) {}
+
+    quint64 read(int count)
+    {
+        quint64 value = 0;
+        for(int i=0; i<count; i++, position++)
+            value = (value << 1) | ((data[position >> 3] >> (7 - (position & 7))) & 1);
+        return value;
+    }
+
+private:
+    const uchar* data;
+    qint64 position;
+};
+
+static inline quint64 doubleBits(double value)
+{
+    quint64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline double bitsDouble(quint64 bits)
+{
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+QGraphCompressedSource::QGraphCompressedSource() :
+    uniform(false),
+    x0(0.0),
+    dx(1.0),
+    sorted(true),
+    exactBlocks(4),
+    index(10),
+    cacheClock(0)
+{
+    for(int i=0; i<CacheBlocks; i++)
+    {
+        cache[i].block = -1;
+        cache[i].used = 0;
+    }
+}
+
+QGraphCompressedSource::QGraphCompressedSource(double x0, double dx) :
+    uniform(true),
+    x0(x0),
+    dx(dx),
+    sorted(dx > 0),
+    exactBlocks(4),
+    index(10),
+    cacheClock(0)
+{
+    for(int i=0; i<CacheBlocks; i++)
+    {
+        cache[i].block = -1;
+        cache[i].used = 0;
+    }
+}
+
+void QGraphCompressedSource::append(const double* x, const double* y, qint64 count)
+{
+    for(qint64 i=0; i<count; i++)
+    {
+        if(!uniform)
+        {
+            double last = openX.isEmpty() ? (blocks.isEmpty() ? x[i] : blocks.last().lastX) : openX.last();
+            if(x[i] < last)
+                sorted = false;
+            openX.push_back(x[i]);
+        }
+        openY.push_back(y[i]);
+        if(openY.size() == BlockSize)
+            sealBlock();
+    }
+}
+
+void QGraphCompressedSource::append(double x, double y)
+{
+    append(&x, &y, 1);
+}
+
+void QGraphCompressedSource::sealBlock()
+{
+    Block block;
+    block.data = encode(uniform ? 0 : openX.constData(), openY.constData(), openY.size());
+    qint64 first = qint64(blocks.size())*BlockSize;
+    block.firstX = uniform ? x0+first*dx : openX.first();
+    block.lastX = uniform ? x0+(first+openY.size()-1)*dx : openX.last();
+    block.firstY = openY.first();
+    block.lastY = openY.last();
+    QGraphKernels::minMax(openY.constData(), openY.size(), 1.0, 0.0, block.min, block.max);
+    double sum = 0.0;
+    double sumSquares = 0.0;
+    QGraphKernels::sumsStrided<double>(reinterpret_cast<const uchar*>(openY.constData()), sizeof(double), openY.size(), sum, sumSquares);
+    index.appendBlock(block.min, block.max, sum, sumSquares, openY.size());
+    blocks.push_back(block);
+    openX.clear();
+    openY.clear();
+}
+
+qint64 QGraphCompressedSource::size() const
+{
+    return qint64(blocks.size())*BlockSize + openY.size();
+}
+
+double QGraphCompressedSource::x(qint64 index) const
+{
+    if(uniform)
+        return x0+index*dx;
+    qint64 block = index/BlockSize;
+    if(block == blocks.size())
+        return openX[int(index-block*BlockSize)];
+    return decode(block).x[int(index-block*BlockSize)];
+}
+
+double QGraphCompressedSource::y(qint64 index) const
+{
+    qint64 block = index/BlockSize;
+    qint64 offset = index-block*BlockSize;
+    if(block == blocks.size())
+        return openY[int(offset)];
+    // The ends of a sealed block are kept next to its summary
+    if(offset == 0)
+        return blocks[int(block)].firstY;
+    if(offset == BlockSize-1)
+        return blocks[int(block)].lastY;
+    return decode(block).y[int(offset)];
+}
+
+qint64 QGraphCompressedSource::lowerBound(double x) const
+{
+    if(!sortedX())
+        return QGraphDataSource::lowerBound(x);
+    if(uniform)
+        return QGraphVectorSource::uniformLowerBound(x, x0, dx, size());
+
+    // Find the first block that ends at or after x, then search inside it
+    int first = 0;
+    int count = blocks.size();
+    while(count > 0)
+    {
+        int step = count/2;
+        if(blocks[first+step].lastX < x)
+        {
+            first += step+1;
+            count -= step+1;
+        }
+        else
+            count = step;
+    }
+    qint64 base = qint64(first)*BlockSize;
+    if(first == blocks.size())
+        return base + (std::lower_bound(openX.constBegin(), openX.constEnd(), x) - openX.constBegin());
+    const QVector<double>& xs = decode(first).x;
+    return base + (std::lower_bound(xs.constBegin(), xs.constEnd(), x) - xs.constBegin());
+}
+
+void QGraphCompressedSource::minMaxY(qint64 from, qint64 to, double& min, double& max) const
+{
+    min = numeric_limits<double>::infinity();
+    max = -numeric_limits<double>::infinity();
+    to = qMin(to, size());
+    wholeBlocks(from, to);
+    index.minMax(*this, from, to, min, max);
+}
+
+void QGraphCompressedSource::envelopeY(qint64 from, qint64 to, double& min, double& max, double& first, double& last) const
+{
+    to = qMin(to, size());
+    wholeBlocks(from, to);
+    QGraphDataSource::envelopeY(from, to, min, max, first, last);
+}
+
+/*
+  Ranges over more than exactBlocks blocks are widened to the sealed
+  blocks at both ends, which is far below one pixel column. They are
+  then answered from the block summaries and the first and last y kept
+  with them, so a zoomed out view decodes nothing.
+ */
+void QGraphCompressedSource::wholeBlocks(qint64& from, qint64& to) const
+{
+    if(from >= to)
+        return;
+    qint64 first = from/BlockSize;
+    qint64 last = (to-1)/BlockSize;
+    if(last-first <= exactBlocks)
+        return;
+    from = first*BlockSize;
+    if(last < blocks.size())
+        to = (last+1)*BlockSize;
+}
+
+void QGraphCompressedSource::sums(qint64 from, qint64 to, double& sum, double& sumSquares) const
+{
+    sum = 0.0;
+    sumSquares = 0.0;
+    index.sums(*this, from, qMin(to, size()), sum, sumSquares);
+}
+
+void QGraphCompressedSource::sumRaw(qint64 from, qint64 to, double& sum, double& sumSquares) const
+{
+    while(from < to)
+    {
+        qint64 block = from/BlockSize;
+        qint64 start = from-block*BlockSize;
+        qint64 end = qMin(to-block*BlockSize, qint64(BlockSize));
+        const double* y = block == blocks.size() ? openY.constData() : decode(block).y.constData();
+        QGraphKernels::sumsStrided<double>(reinterpret_cast<const uchar*>(y+start), sizeof(double), end-start, sum, sumSquares);
+        from += end-start;
+    }
+}
+
+/*
+  Only the partial blocks at the ends of a range and the open block are
+  scanned, the sealed blocks in between come from the range index.
+ */
+void QGraphCompressedSource::scanRaw(qint64 from, qint64 to, double& min, double& max) const
+{
+    while(from < to)
+    {
+        qint64 block = from/BlockSize;
+        qint64 start = from-block*BlockSize;
+        qint64 end = qMin(to-block*BlockSize, qint64(BlockSize));
+        double a, b;
+        if(block == blocks.size())
+            QGraphKernels::minMax(openY.constData()+start, end-start, 1.0, 0.0, a, b);
+        else if(start == 0 && end == BlockSize)
+        {
+            a = blocks[int(block)].min;
+            b = blocks[int(block)].max;
+        }
+        else
+            QGraphKernels::minMax(decode(block).y.constData()+start, end-start, 1.0, 0.0, a, b);
+        min = qMin(min, a);
+        max = qMax(max, b);
+        from += end-start;
+    }
+}
+
+void QGraphCompressedSource::readX(qint64 from, qint64 count, double* out) const
+{
+    if(uniform)
+    {
+        for(qint64 i=0; i<count; i++)
+            out[i] = x0+(from+i)*dx;
+        return;
+    }
+    while(count > 0)
+    {
+        qint64 block = from/BlockSize;
+        qint64 start = from-block*BlockSize;
+        qint64 n = qMin(count, BlockSize-start);
+        const double* data = block == blocks.size() ? openX.constData() : decode(block).x.constData();
+        memcpy(out, data+start, n*sizeof(double));
+        from += n;
+        count -= n;
+        out += n;
+    }
+}
+
+void QGraphCompressedSource::readY(qint64 from, qint64 count, double* out) const
+{
+    while(count > 0)
+    {
+        qint64 block = from/BlockSize;
+        qint64 start = from-block*BlockSize;
+        qint64 n = qMin(count, BlockSize-start);
+        const double* data = block == blocks.size() ? openY.constData() : decode(block).y.constData();
+        memcpy(out, data+start, n*sizeof(double));
+        from += n;
+        count -= n;
+        out += n;
+    }
+}
+
+bool QGraphCompressedSource::uniformX(double& x0, double& dx) const
+{
+    x0 = this->x0;
+    dx = this->dx;
+    return uniform;
+}
+
+qint64 QGraphCompressedSource::memoryUsage() const
+{
+    qint64 bytes = qint64(openX.capacity()+openY.capacity())*sizeof(double);
+    for(int i=0; i<blocks.size(); i++)
+        bytes += sizeof(Block) + blocks[i].data.size();
+    return bytes;
+}
+
+/*
+  Returns the decoded samples of a sealed block. Blocks are decoded into
+  the least recently used cache entry.
+ */
+const QGraphCompressedSource::DecodedBlock& QGraphCompressedSource::decode(qint64 block) const
+{
+    int slot = 0;
+    for(int i=0; i<CacheBlocks; i++)
+    {
+        if(cache[i].block == block)
+        {
+            cache[i].used = ++cacheClock;
+            return cache[i];
+        }
+        if(cache[i].block == -1 || cache[i].used < cache[slot].used)
+            slot = i;
+    }
+    DecodedBlock& entry = cache[slot];
+    entry.block = block;
+    entry.used = ++cacheClock;
+    entry.y.resize(BlockSize);
+    entry.x.resize(uniform ? 0 : BlockSize);
+    decode(blocks[int(block)].data, BlockSize, uniform ? 0 : entry.x.data(), entry.y.data());
+    return entry;
+}
+
+/*
+  x (if given) is stored as the delta-of-delta of the bit patterns of
+  the doubles, which is 1 bit per sample for uniform spacing. y is XORed
+  with its predecessor and only the meaningful bits are stored.
+ */
+QByteArray QGraphCompressedSource::encode(const double* x, const double* y, int count)
+{
+    QGraphBitWriter writer;
+    if(count <= 0)
+        return writer.finish();
+
+    if(x)
+    {
+        quint64 previous = doubleBits(x[0]);
+        qint64 previousDelta = 0;
+        writer.write(previous, 64);
+        for(int i=1; i<count; i++)
+        {
+            quint64 current = doubleBits(x[i]);
+            qint64 delta = qint64(current-previous);
+            qint64 dod = delta-previousDelta;
+            if(dod == 0)
+                writer.write(0, 1);
+            else if(dod >= -63 && dod <= 64)
+            {
+                writer.write(2, 2);
+                writer.write(quint64(dod+63), 7);
+            }
+            else if(dod >= -255 && dod <= 256)
+            {
+                writer.write(6, 3);
+                writer.write(quint64(dod+255), 9);
+            }
+            else if(dod >= -2047 && dod <= 2048)
+            {
+                writer.write(14, 4);
+                writer.write(quint64(dod+2047), 12);
+            }
+            else
+            {
+                writer.write(15, 4);
+                writer.write(quint64(dod), 64);
+            }
+            previous = current;
+            previousDelta = delta;
+        }
+    }
+
+    quint64 previous = doubleBits(y[0]);
+    int previousLeading = -1;
+    int previousTrailing = 0;
+    writer.write(previous, 64);
+    for(int i=1; i<count; i++)
+    {
+        quint64 current = doubleBits(y[i]);
+        quint64 value = current^previous;
+        previous = current;
+        if(value == 0)
+        {
+            writer.write(0, 1);
+            continue;
+        }
+        writer.write(1, 1);
+        int leading = qMin(int(qCountLeadingZeroBits(value)), 31);
+        int trailing = int(qCountTrailingZeroBits(value));
+        if(previousLeading >= 0 && leading >= previousLeading && trailing >= previousTrailing)
+        {
+            writer.write(0, 1);
+            writer.write(value >> previousTrailing, 64-previousLeading-previousTrailing);
+        }
+        else
+        {
+            int length = 64-leading-trailing;
+            writer.write(1, 1);
+            writer.write(quint64(leading), 5);
+            writer.write(quint64(length & 63), 6);
+            writer.write(value >> trailing, length);
+            previousLeading = leading;
+            previousTrailing = trailing;
+        }
+    }
+    return writer.finish();
+}
+
+void QGraphCompressedSource::decode(const QByteArray& data, int count, double* x, double* y)
+{
+    if(count <= 0)
+        return;
+    QGraphBitReader reader(data);
+
+    if(x)
+    {
+        quint64 previous = reader.read(64);
+        qint64 previousDelta = 0;
+        x[0] = bitsDouble(previous);
+        for(int i=1; i<count; i++)
+        {
+            qint64 dod;
+            if(reader.read(1) == 0)
+                dod = 0;
+            else if(reader.read(1) == 0)
+                dod = qint64(reader.read(7))-63;
+            else if(reader.read(1) == 0)
+                dod = qint64(reader.read(9))-255;
+            else if(reader.read(1) == 0)
+                dod = qint64(reader.read(12))-2047;
+            else
+                dod = qint64(reader.read(64));
+            qint64 delta = previousDelta+dod;
+            previous = previous+quint64(delta);
+            previousDelta = delta;
+            x[i] = bitsDouble(previous);
+        }
+    }
+
+    quint64 previous = reader.read(64);
+    int leading = 0;
+    int trailing = 0;
+    y[0] = bitsDouble(previous);
+    for(int i=1; i<count; i++)
+    {
+        if(reader.read(1) == 1)
+        {
+            if(reader.read(1) == 1)
+            {
+                leading = int(reader.read(5));
+                int length = int(reader.read(6));
+                if(length == 0)
+                    length = 64;
+                trailing = 64-leading-length;
+            }
+            previous ^= reader.read(64-leading-trailing) << trailing;
+        }
+        y[i] = bitsDouble(previous);
+    }
+}
+
+QGraphMappedFile::QGraphMappedFile(const QString& fileName) :
+    file(fileName),
+    data(0),
+    length(0)
+{
+    if(!file.open(QIODevice::ReadOnly))
+        return;
+    length = file.size();
+    if(length > 0)
+        data = file.map(0, length);
+    if(!data)
+    {
+        length = 0;
+        file.close();
+    }
+}
+
+QGraphMappedFile::~QGraphMappedFile()
+{
+    if(data)
+        file.unmap(data);
+}
+
+/*
+  Tells the operating system that the given byte range will be read
+  soon, so it can be read ahead while the current view is rendered.
+ */
+void QGraphMappedFile::prefetch(qint64 offset, qint64 length) const
+{
+#ifdef Q_OS_UNIX
+    if(!data)
+        return;
+    offset = qBound(qint64(0), offset, this->length);
+    length = qMin(length, this->length-offset);
+    if(length <= 0)
+        return;
+    static const qint64 pageSize = sysconf(_SC_PAGESIZE);
+    qint64 start = offset - offset%pageSize;
+    madvise(data+start, length+(offset-start), MADV_WILLNEED);
+#else
+    Q_UNUSED(offset);
+    Q_UNUSED(length);
+#endif
+}
+
+template<typename T>
+static double mappedValue(const uchar* data)
+{
+    T value;
+    memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+static double mappedSample(QGraphMappedSource::SampleType type, const uchar* data)
+{
+    switch(type)
+    {
+    case QGraphMappedSource::Int8: return mappedValue<qint8>(data);
+    case QGraphMappedSource::UInt8: return mappedValue<quint8>(data);
+    case QGraphMappedSource::Int16: return mappedValue<qint16>(data);
+    case QGraphMappedSource::UInt16: return mappedValue<quint16>(data);
+    case QGraphMappedSource::Int32: return mappedValue<qint32>(data);
+    case QGraphMappedSource::UInt32: return mappedValue<quint32>(data);
+    case QGraphMappedSource::Float32: return mappedValue<float>(data);
+    case QGraphMappedSource::Float64: return mappedValue<double>(data);
+    }
+    return 0.0;
+}
+
+static void mappedMinMax(QGraphMappedSource::SampleType type, const uchar* data, qint64 stride, qint64 count, double scale, double offset, double& min, double& max)
+{
+    switch(type)
+    {
+    case QGraphMappedSource::Int8: QGraphKernels::minMaxStrided<qint8>(data, stride, count, scale, offset, min, max); break;
+    case QGraphMappedSource::UInt8: QGraphKernels::minMaxStrided<quint8>(data, stride, count, scale, offset, min, max); break;
+    case QGraphMappedSource::Int16: QGraphKernels::minMaxStrided<qint16>(data, stride, count, scale, offset, min, max); break;
+    case QGraphMappedSource::UInt16: QGraphKernels::minMaxStrided<quint16>(data, stride, count, scale, offset, min, max); break;
+    case QGraphMappedSource::Int32: QGraphKernels::minMaxStrided<qint32>(data, stride, count, scale, offset, min, max); break;
+    case QGraphMappedSource::UInt32: QGraphKernels::minMaxStrided<quint32>(data, stride, count, scale, offset, min, max); break;
+    case QGraphMappedSource::Float32: QGraphKernels::minMaxStrided<float>(data, stride, count, scale, offset, min, max); break;
+    case QGraphMappedSource::Float64: QGraphKernels::minMaxStrided<double>(data, stride, count, scale, offset, min, max); break;
+    }
+}
+
+static void mappedSums(QGraphMappedSource::SampleType type, const uchar* data, qint64 stride, qint64 count, double& sum, double& sumSquares)
+{
+    switch(type)
+    {
+    case QGraphMappedSource::Int8: QGraphKernels::sumsStrided<qint8>(data, stride, count, sum, sumSquares); break;
+    case QGraphMappedSource::UInt8: QGraphKernels::sumsStrided<quint8>(data, stride, count, sum, sumSquares); break;
+    case QGraphMappedSource::Int16: QGraphKernels::sumsStrided<qint16>(data, stride, count, sum, sumSquares); break;
+    case QGraphMappedSource::UInt16: QGraphKernels::sumsStrided<quint16>(data, stride, count, sum, sumSquares); break;
+    case QGraphMappedSource::Int32: QGraphKernels::sumsStrided<qint32>(data, stride, count, sum, sumSquares); break;
+    case QGraphMappedSource::UInt32: QGraphKernels::sumsStrided<quint32>(data, stride, count, sum, sumSquares); break;
+    case QGraphMappedSource::Float32: QGraphKernels::sumsStrided<float>(data, stride, count, sum, sumSquares); break;
+    case QGraphMappedSource::Float64: QGraphKernels::sumsStrided<double>(data, stride, count, sum, sumSquares); break;
+    }
+}
+
+QGraphMappedSource::QGraphMappedSource(QSharedPointer<QGraphMappedFile> file, SampleType type, int channels, int channel, double sampleRate, Layout layout, qint64 headerBytes) :
+    file(file),
+    channel(channel),
+    type(type),
+    sampleRate(sampleRate),
+    scale(1.0),
+    offset(0.0),
+    base(0),
+    stride(0),
+    samples(0),
+    exactLimit(qint64(1)<<22),
+    viewFrom(-1),
+    viewTo(-1)
+{
+    if(!file || !file->isValid() || channels <= 0 || channel < 0 || channel >= channels || headerBytes < 0)
+        return;
+    summary = QGraphMappedSummary::of(file, type, channels, layout, headerBytes);
+    if(summary->size() <= 0)
+    {
+        summary.clear();
+        return;
+    }
+    samples = summary->size();
+    base = summary->channelData(channel);
+    stride = summary->stride();
+}
+
+int QGraphMappedSource::sampleSize(SampleType type)
+{
+    switch(type)
+    {
+    case Int8:
+    case UInt8:
+        return 1;
+    case Int16:
+    case UInt16:
+        return 2;
+    case Int32:
+    case UInt32:
+    case Float32:
+        return 4;
+    case Float64:
+        return 8;
+    }
+    return 1;
+}
+
+double QGraphMappedSource::y(qint64 index) const
+{
+    return mappedSample(type, sampleAt(index))*scale+offset;
+}
+
+qint64 QGraphMappedSource::lowerBound(double x) const
+{
+    return QGraphVectorSource::uniformLowerBound(x, 0.0, 1.0/sampleRate, samples);
+}
+
+void QGraphMappedSource::minMaxX(qint64 from, qint64 to, double& min, double& max) const
+{
+    min = numeric_limits<double>::infinity();
+    max = -numeric_limits<double>::infinity();
+    if(from >= to)
+        return;
+    min = x(from);
+    max = x(to-1);
+}
+
+/*
+  Ranges up to exactLimit samples are scanned completely. Longer ranges
+  (a zoomed out view of a huge recording) are answered from the file
+  summary, only the partial blocks at both ends are read, so the result
+  is exact. Until the summary is ready they are probed with evenly
+  spaced runs of consecutive samples, so only a bounded number of pages
+  is read.
+ */
+void QGraphMappedSource::minMaxY(qint64 from, qint64 to, double& min, double& max) const
+{
+    from = qMax(from, qint64(0));
+    to = qMin(to, samples);
+    double low = numeric_limits<double>::infinity();
+    double high = -numeric_limits<double>::infinity();
+    if(to-from <= exactLimit)
+        scanRaw(from, to, low, high);
+    else if(summary->isReady())
+        summary->channel(channel).minMax(*this, from, to, low, high);
+    else
+    {
+        QGraphMappedSummary::start(summary, 0);
+        qint64 runs = qMax(exactLimit/ProbeRun, qint64(1));
+        qint64 step = (to-from)/runs;
+        for(qint64 i=0; i<runs; i++)
+            scanRaw(from+i*step, qMin(from+i*step+ProbeRun, to), low, high);
+        // Always include the last sample so the range ends are exact
+        scanRaw(to-1, to, low, high);
+    }
+    QGraphKernels::toPhysical(low, high, scale, offset, min, max);
+}
+
+// Extends min and max by the raw samples [from, to)
+void QGraphMappedSource::scanRaw(qint64 from, qint64 to, double& min, double& max) const
+{
+    if(from < to)
+        mappedMinMax(type, sampleAt(from), stride, to-from, 1.0, 0.0, min, max);
+}
+
+/*
+  Same as minMaxY(): long ranges are answered from the prefix sums of
+  the file summary. Until it is ready the sums of the probed runs are
+  extrapolated to the whole range.
+ */
+void QGraphMappedSource::sums(qint64 from, qint64 to, double& sum, double& sumSquares) const
+{
+    from = qMax(from, qint64(0));
+    to = qMin(to, samples);
+    sum = 0.0;
+    sumSquares = 0.0;
+    if(to-from <= exactLimit)
+        sumRaw(from, to, sum, sumSquares);
+    else if(summary->isReady())
+        summary->channel(channel).sums(*this, from, to, sum, sumSquares);
+    else
+    {
+        QGraphMappedSummary::start(summary, 0);
+        qint64 runs = qMax(exactLimit/ProbeRun, qint64(1));
+        qint64 step = (to-from)/runs;
+        qint64 probed = 0;
+        for(qint64 i=0; i<runs; i++)
+        {
+            qint64 end = qMin(from+i*step+ProbeRun, to);
+            sumRaw(from+i*step, end, sum, sumSquares);
+            probed += end-(from+i*step);
+        }
+        sum *= double(to-from)/probed;
+        sumSquares *= double(to-from)/probed;
+    }
+    QGraphKernels::sumsToPhysical(qMax(to-from, qint64(0)), scale, offset, sum, sumSquares);
+}
+
+void QGraphMappedSource::sumRaw(qint64 from, qint64 to, double& sum, double& sumSquares) const
+{
+    if(from < to)
+        mappedSums(type, sampleAt(from), stride, to-from, sum, sumSquares);
+}
+
+bool QGraphMappedSource::uniformX(double& x0, double& dx) const
+{
+    x0 = 0.0;
+    dx = 1.0/sampleRate;
+    return true;
+}
+
+/*
+  When the view is panned, the samples in pan direction are requested
+  from the operating system before they are needed.
+ */
+void QGraphMappedSource::viewChanged(qint64 from, qint64 to)
+{
+    qint64 width = to-from;
+    if(width > 0 && width <= exactLimit && viewTo > viewFrom)
+    {
+        if(from > viewFrom)
+            prefetchSamples(to, to+width);
+        else if(from < viewFrom)
+            prefetchSamples(from-width, from);
+    }
+    viewFrom = from;
+    viewTo = to;
+}
+
+void QGraphMappedSource::prefetchSamples(qint64 from, qint64 to) const
+{
+    from = qMax(from, qint64(0));
+    to = qMin(to, samples);
+    if(from >= to)
+        return;
+    qint64 offset = sampleAt(from) - file->constData();
+    file->prefetch(offset, (to-from-1)*stride + sampleSize(type));
+}
+
+class QGraphMappedSummaryTask : public QRunnable
+{
+public:
+    QGraphMappedSummaryTask(const QSharedPointer<QGraphMappedFile>& file, const QSharedPointer<QGraphMappedSummary>& summary) :
+        file(file),
+        summary(summary)
+    {
+    }
+
+    void run()
+    {
+        summary->build();
+    }
+
+private:
+    // Keeps the file mapped while it is summarized
+    QSharedPointer<QGraphMappedFile> file;
+    QSharedPointer<QGraphMappedSummary> summary;
+};
+
+QGraphMappedSummary::QGraphMappedSummary(const QSharedPointer<QGraphMappedFile>& file, QGraphMappedSource::SampleType type, int channels, QGraphDataSource::Layout layout, qint64 headerBytes) :
+    file(file),
+    type(type),
+    channels(channels),
+    layout(layout),
+    headerBytes(headerBytes),
+    base(0),
+    channelOffset(0),
+    frameStride(0),
+    samples(0),
+    running(false),
+    ready(false)
+{
+    int bytes = QGraphMappedSource::sampleSize(type);
+    qint64 samplesPerChannel = (file->size()-headerBytes)/(qint64(channels)*bytes);
+    if(samplesPerChannel <= 0)
+        return;
+    samples = samplesPerChannel;
+    base = file->constData() + headerBytes;
+    if(layout == QGraphDataSource::Interleaved)
+    {
+        channelOffset = bytes;
+        frameStride = qint64(channels)*bytes;
+    }
+    else
+    {
+        channelOffset = samplesPerChannel*bytes;
+        frameStride = bytes;
+    }
+    for(int channel=0; channel<channels; channel++)
+        indexes.push_back(QSharedPointer<QGraphRangeIndex>(new QGraphRangeIndex(BlockBits)));
+}
+
+QSharedPointer<QGraphMappedSummary> QGraphMappedSummary::of(const QSharedPointer<QGraphMappedFile>& file, QGraphMappedSource::SampleType type, int channels, QGraphDataSource::Layout layout, qint64 headerBytes)
+{
+    QMutexLocker locker(&file->summaryMutex);
+    for(int i=0; i<file->summaries.size(); i++)
+    {
+        const QGraphMappedSummary* summary = file->summaries[i].data();
+        if(summary->type == type && summary->channels == channels && summary->layout == layout && summary->headerBytes == headerBytes)
+            return file->summaries[i];
+    }
+    QSharedPointer<QGraphMappedSummary> summary(new QGraphMappedSummary(file, type, channels, layout, headerBytes));
+    file->summaries.push_back(summary);
+    return summary;
+}
+
+bool QGraphMappedSummary::isReady() const
+{
+    QMutexLocker locker(&mutex);
+    return ready;
+}
+
+void QGraphMappedSummary::start(const QSharedPointer<QGraphMappedSummary>& summary, QGraph* graph)
+{
+    QMutexLocker locker(&summary->mutex);
+    if(summary->ready)
+        return;
+    if(graph && !summary->waiting.contains(graph))
+        summary->waiting.push_back(graph);
+    QSharedPointer<QGraphMappedFile> file = summary->file.toStrongRef();
+    if(summary->running || !file)
+        return;
+    summary->running = true;
+    QGraphScheduler::instance()->pool()->start(new QGraphMappedSummaryTask(file, summary));
+}
+
+/*
+  Summarizes all channels block by block. An interleaved block of every
+  channel lies in the same pages, so the file is read once.
+ */
+void QGraphMappedSummary::build()
+{
+    qint64 block = qint64(1) << BlockBits;
+    for(qint64 from=0; from<samples; from+=block)
+    {
+        qint64 count = qMin(block, samples-from);
+        for(int channel=0; channel<channels; channel++)
+        {
+            const uchar* data = channelData(channel) + from*frameStride;
+            double low = numeric_limits<double>::infinity();
+            double high = -numeric_limits<double>::infinity();
+            double sum = 0.0;
+            double sumSquares = 0.0;
+            mappedMinMax(type, data, frameStride, count, 1.0, 0.0, low, high);
+            mappedSums(type, data, frameStride, count, sum, sumSquares);
+            indexes[channel]->appendBlock(low, high, sum, sumSquares, count);
+        }
+    }
+
+    QMutexLocker locker(&mutex);
+    ready = true;
+    running = false;
+    // The scheduler ignores graphs that are gone by now
+    for(int i=0; i<waiting.size(); i++)
+        QMetaObject::invokeMethod(QGraphScheduler::instance(), "redraw", Qt::QueuedConnection, Q_ARG(QGraph*, waiting[i]));
+    waiting.clear();
+}
+
+QGraphSharedRing::QGraphSharedRing(const QString& name) :
+    data(0),
+    length(0),
+    header(0),
+    sampleType(QGraphMappedSource::UInt8),
+    channelCount(0),
+    frameCapacity(0),
+    rate(1.0),
+    dataOffset(0)
+{
+#ifdef Q_OS_UNIX
+    int fd = shm_open(QFile::encodeName(name).constData(), O_RDONLY, 0);
+    if(fd < 0)
+        return;
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size < qint64(sizeof(qgraph_shm_header)))
+    {
+        close(fd);
+        return;
+    }
+    length = info.st_size;
+    void* mapping = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        length = 0;
+        return;
+    }
+    data = static_cast<uchar*>(mapping);
+
+    // The producer may still be writing the header, it stores the magic last
+    const qgraph_shm_header* candidate = reinterpret_cast<const qgraph_shm_header*>(data);
+    bool valid = __atomic_load_n(&candidate->magic, __ATOMIC_ACQUIRE) == QGRAPH_SHM_MAGIC && candidate->version == QGRAPH_SHM_VERSION;
+    int bytes = valid && candidate->dtype <= QGRAPH_SHM_FLOAT64 ? int(qgraph_shm_sample_size(candidate->dtype)) : 0;
+    valid = bytes > 0 && candidate->channels > 0 && candidate->channels <= 65536 && candidate->capacity > 0 && candidate->sample_rate > 0.0
+        && candidate->data_offset >= sizeof(qgraph_shm_header) && candidate->data_offset <= quint64(length)
+        && candidate->capacity <= (quint64(length)-candidate->data_offset)/(quint64(candidate->channels)*bytes);
+    if(!valid)
+    {
+        munmap(data, length);
+        data = 0;
+        length = 0;
+        return;
+    }
+    // Copy the constant fields, later changes by the producer are ignored
+    sampleType = QGraphMappedSource::SampleType(candidate->dtype);
+    channelCount = candidate->channels;
+    frameCapacity = candidate->capacity;
+    rate = candidate->sample_rate;
+    dataOffset = candidate->data_offset;
+    header = candidate;
+#else
+    Q_UNUSED(name);
+#endif
+}
+
+QGraphSharedRing::~QGraphSharedRing()
+{
+#ifdef Q_OS_UNIX
+    if(data)
+        munmap(data, length);
+#endif
+}
+
+quint64 QGraphSharedRing::writeIndex() const
+{
+#ifdef Q_OS_UNIX
+    if(header)
+        return qgraph_shm_load_index(header);
+#endif
+    return 0;
+}
+
+/*
+  Only capacity - capacity/QGRAPH_SHM_MARGIN frames are shown, the rest
+  of the ring is the space the producer may fill while a frame is built
+  from the previous snapshot.
+ */
+QGraphSharedSource::QGraphSharedSource(QSharedPointer<QGraphSharedRing> ring, int channel) :
+    ring(ring),
+    type(QGraphMappedSource::UInt8),
+    sampleRate(1.0),
+    scale(1.0),
+    offset(0.0),
+    base(0),
+    stride(0),
+    capacity(1),
+    window(0),
+    written(0),
+    first(0),
+    count(0)
+{
+    if(!ring || !ring->isValid() || channel < 0 || channel >= ring->channels())
+        return;
+    type = ring->type();
+    sampleRate = ring->sampleRate();
+    int bytes = QGraphMappedSource::sampleSize(type);
+    base = ring->frames() + qint64(channel)*bytes;
+    stride = qint64(ring->channels())*bytes;
+    capacity = ring->capacity();
+    window = qMax(capacity - capacity/QGRAPH_SHM_MARGIN, qint64(1));
+    sync();
+}
+
+bool QGraphSharedSource::sync()
+{
+    if(!base)
+        return false;
+    quint64 index = ring->writeIndex();
+    if(index == written)
+        return false;
+    written = index;
+    count = qint64(qMin(index, quint64(window)));
+    first = qint64(index) - count;
+    return true;
+}
+
+double QGraphSharedSource::y(qint64 index) const
+{
+    return mappedSample(type, sampleAt(index))*scale+offset;
+}
+
+qint64 QGraphSharedSource::lowerBound(double x) const
+{
+    double estimate = ceil(x*sampleRate) - first;
+    qint64 index = qint64(qBound(0.0, estimate, double(count)));
+    while(index > 0 && this->x(index-1) >= x)
+        index--;
+    while(index < count && this->x(index) < x)
+        index++;
+    return index;
+}
+
+void QGraphSharedSource::minMaxX(qint64 from, qint64 to, double& min, double& max) const
+{
+    min = numeric_limits<double>::infinity();
+    max = -numeric_limits<double>::infinity();
+    if(from >= to)
+        return;
+    min = x(from);
+    max = x(to-1);
+}
+
+// Scans the range in at most two runs, split where the ring wraps
+void QGraphSharedSource::minMaxY(qint64 from, qint64 to, double& min, double& max) const
+{
+    min = numeric_limits<double>::infinity();
+    max = -numeric_limits<double>::infinity();
+    from = qMax(from, qint64(0));
+    to = qMin(to, count);
+    while(from < to)
+    {
+        qint64 position = (first+from)%capacity;
+        qint64 run = qMin(to-from, capacity-position);
+        mappedMinMax(type, base + position*stride, stride, run, scale, offset, min, max);
+        from += run;
+    }
+}
+
+bool QGraphSharedSource::uniformX(double& x0, double& dx) const
+{
+    x0 = first/sampleRate;
+    dx = 1.0/sampleRate;
+    return true;
+}
+
+static const char recordingMagic[8] = {'Q', 'G', 'R', 'A', 'P', 'H', 'R', '1'};
+static const char recordingIndexMagic[8] = {'Q', 'G', 'R', 'I', 'N', 'D', 'E', 'X'};
+static const quint32 recordingChunkMagic = 0x4b434751; // "QGCK"
+
+static inline qint64 recordingPadded(qint64 size)
+{
+    return (size+7) & ~qint64(7);
+}
+
+QGraphRecording::QGraphRecording() :
+    chunk(0),
+    recovered(false),
+    cacheClock(0)
+{
+}
+
+/*
+  Opens a recording file. Returns a null pointer if the file is not a
+  valid recording. A recording which was not closed is recovered up to
+  its last complete chunk.
+ */
+QSharedPointer<QGraphRecording> QGraphRecording::open(const QString& fileName)
+{
+    QSharedPointer<QGraphRecording> recording(new QGraphRecording());
+    if(!recording->load(fileName))
+        return QSharedPointer<QGraphRecording>();
+    return recording;
+}
+
+bool QGraphRecording::load(const QString& fileName)
+{
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    // The file is used in place and stored little endian
+    Q_UNUSED(fileName);
+    return false;
+#else
+    file = QSharedPointer<QGraphMappedFile>(new QGraphMappedFile(fileName));
+    if(!file->isValid() || file->size() < qint64(sizeof(FileHeader)))
+        return false;
+    FileHeader header;
+    memcpy(&header, file->constData(), sizeof(header));
+    if(memcmp(header.magic, recordingMagic, sizeof(recordingMagic)) != 0 || header.version != Version || header.chunkSize == 0)
+        return false;
+    qint64 dataStart = sizeof(FileHeader) + qint64(header.traceCount)*sizeof(TraceHeader);
+    if(dataStart > file->size())
+        return false;
+    chunk = header.chunkSize;
+    traces.resize(header.traceCount);
+    for(int trace=0; trace<traces.size(); trace++)
+    {
+        memcpy(&traces[trace].header, file->constData() + sizeof(FileHeader) + trace*sizeof(TraceHeader), sizeof(TraceHeader));
+        traces[trace].sampleCount = 0;
+        traces[trace].chunkCount = 0;
+        traces[trace].sorted = true;
+        traces[trace].directory = 0;
+    }
+    if(loadIndex())
+        return true;
+    recovered = true;
+    return recover();
+#endif
+}
+
+/*
+  Uses the index at the end of the file in place, only the pages of the
+  summaries which are actually queried are read.
+ */
+bool QGraphRecording::loadIndex()
+{
+    qint64 size = file->size();
+    if(size < qint64(sizeof(FileHeader) + sizeof(Footer)))
+        return false;
+    Footer footer;
+    memcpy(&footer, file->constData() + size - sizeof(Footer), sizeof(footer));
+    if(memcmp(footer.magic, recordingIndexMagic, sizeof(recordingIndexMagic)) != 0 || footer.traceCount != quint32(traces.size()))
+        return false;
+    if(footer.indexOffset % 8 != 0 || qint64(footer.indexOffset) + qint64(traces.size())*qint64(sizeof(TraceIndex)) > size - qint64(sizeof(Footer)))
+        return false;
+
+    const TraceIndex* index = reinterpret_cast<const TraceIndex*>(file->constData() + footer.indexOffset);
+    qint64 dataStart = sizeof(FileHeader) + qint64(traces.size())*sizeof(TraceHeader);
+    for(int trace=0; trace<traces.size(); trace++)
+    {
+        Trace& t = traces[trace];
+        qint64 chunks = index[trace].chunkCount;
+        if(index[trace].directoryOffset % 8 != 0 || index[trace].levelCount > MaxLevels
+           || chunks < 0 || qint64(index[trace].directoryOffset) + chunks*qint64(sizeof(ChunkEntry)) > size)
+            return false;
+        t.chunkCount = chunks;
+        t.sampleCount = index[trace].sampleCount;
+        t.sorted = !(index[trace].flags & Unsorted);
+        t.directory = reinterpret_cast<const ChunkEntry*>(file->constData() + index[trace].directoryOffset);
+        // Sample i is looked up in chunk i/chunkSize, so only the last chunk may be short
+        qint64 samples = 0;
+        for(qint64 i=0; i<chunks; i++)
+        {
+            if(!validChunk(trace, t.directory[i], dataStart) || (i+1 < chunks && t.directory[i].count != chunk))
+                return false;
+            samples += t.directory[i].count;
+        }
+        if(samples != t.sampleCount)
+            return false;
+        qint64 entries = chunks;
+        for(quint32 level=0; level<index[trace].levelCount; level++)
+        {
+            entries = (entries+LevelFanout-1)/LevelFanout;
+            if(index[trace].levelOffset[level] % 8 != 0 || qint64(index[trace].levelOffset[level]) + entries*qint64(sizeof(LevelEntry)) > size)
+                return false;
+            t.levels.push_back(reinterpret_cast<const LevelEntry*>(file->constData() + index[trace].levelOffset[level]));
+        }
+    }
+    return true;
+}
+
+/*
+  Checks that a directory entry points at a chunk record of the trace
+  and that its payload lies inside the file. Uncompressed payloads are
+  used in place and must hold all values of the chunk.
+ */
+bool QGraphRecording::validChunk(int trace, const ChunkEntry& entry, qint64 dataStart) const
+{
+    qint64 size = file->size();
+    if(entry.offset % 8 != 0 || qint64(entry.offset) < dataStart || qint64(entry.offset) > size - qint64(sizeof(ChunkHeader)))
+        return false;
+    if(entry.count == 0 || entry.count > chunk)
+        return false;
+    qint64 values = qint64(entry.count)*sizeof(double)*(traces[trace].header.uniform ? 1 : 2);
+    ChunkHeader header;
+    memcpy(&header, file->constData() + entry.offset, sizeof(header));
+    if(header.magic != recordingChunkMagic || header.trace != quint32(trace) || header.count != entry.count || header.flags != entry.flags)
+        return false;
+    if(header.payloadBytes > quint64(size - entry.offset - sizeof(ChunkHeader)) || header.payloadBytes > quint64(numeric_limits<int>::max()) || values > numeric_limits<int>::max())
+        return false;
+    return (entry.flags & Compressed) || qint64(header.payloadBytes) >= values;
+}
+
+/*
+  Rebuilds the index of an interrupted recording from the chunk records.
+ */
+bool QGraphRecording::recover()
+{
+    qint64 size = file->size();
+    qint64 position = sizeof(FileHeader) + qint64(traces.size())*sizeof(TraceHeader);
+    while(position + qint64(sizeof(ChunkHeader)) <= size)
+    {
+        ChunkHeader header;
+        memcpy(&header, file->constData() + position, sizeof(header));
+        qint64 next = position + sizeof(ChunkHeader) + recordingPadded(header.payloadBytes);
+        if(header.magic != recordingChunkMagic || header.trace >= quint32(traces.size()) || header.count == 0 || header.count > chunk || next > size)
+            break;
+        Trace& t = traces[header.trace];
+        // Only the last chunk of a trace may be incomplete
+        if(!t.ownDirectory.isEmpty() && t.ownDirectory.last().count != chunk)
+            break;
+        ChunkEntry entry;
+        entry.offset = position;
+        entry.count = header.count;
+        entry.flags = header.flags;
+        entry.firstX = header.firstX;
+        entry.lastX = header.lastX;
+        entry.min = header.min;
+        entry.max = header.max;
+        entry.sum = header.sum;
+        entry.sumSquares = header.sumSquares;
+        if(entry.firstX > entry.lastX || (!t.ownDirectory.isEmpty() && entry.firstX < t.ownDirectory.last().lastX))
+            t.sorted = false;
+        t.ownDirectory.push_back(entry);
+        t.sampleCount += header.count;
+        position = next;
+    }
+
+    for(int trace=0; trace<traces.size(); trace++)
+    {
+        Trace& t = traces[trace];
+        t.chunkCount = t.ownDirectory.size();
+        t.directory = t.ownDirectory.constData();
+        buildLevels(t.directory, t.chunkCount, t.ownLevels);
+        for(int level=0; level<t.ownLevels.size(); level++)
+        {
+            t.levels.push_back(t.ownLevels[level].constData());
+        }
+    }
+    return true;
+}
+
+/*
+  Computes the summary levels above the chunk entries, each level
+  combines LevelFanout entries of the level below.
+ */
+void QGraphRecording::buildLevels(const ChunkEntry* directory, qint64 chunkCount, QVector< QVector<LevelEntry> >& levels)
+{
+    levels.clear();
+    qint64 entries = chunkCount;
+    while(entries > 1 && levels.size() < MaxLevels)
+    {
+        qint64 size = (entries+LevelFanout-1)/LevelFanout;
+        QVector<LevelEntry> level(size);
+        for(qint64 i=0; i<size; i++)
+        {
+            level[i].min = numeric_limits<double>::infinity();
+            level[i].max = -numeric_limits<double>::infinity();
+            level[i].sum = 0.0;
+            level[i].sumSquares = 0.0;
+            qint64 end = qMin(entries, (i+1)*LevelFanout);
+            for(qint64 j=i*LevelFanout; j<end; j++)
+            {
+                double min = levels.isEmpty() ? directory[j].min : levels.last()[j].min;
+                double max = levels.isEmpty() ? directory[j].max : levels.last()[j].max;
+                level[i].min = qMin(level[i].min, min);
+                level[i].max = qMax(level[i].max, max);
+                level[i].sum += levels.isEmpty() ? directory[j].sum : levels.last()[j].sum;
+                level[i].sumSquares += levels.isEmpty() ? directory[j].sumSquares : levels.last()[j].sumSquares;
+            }
+        }
+        levels.push_back(level);
+        entries = size;
+    }
+}
+
+/*
+  Min/max of the chunks [from, to). Whole groups of chunks are taken
+  from the summary levels, so this needs O(log n) entries.
+ */
+void QGraphRecording::chunkRangeMinMax(int trace, qint64 from, qint64 to, double& min, double& max) const
+{
+    const Trace& t = traces[trace];
+    from = qMax(from, qint64(0));
+    to = qMin(to, t.chunkCount);
+    int level = 0;
+    while(from < to)
+    {
+        if(level == t.levels.size() || to-from < LevelFanout)
+        {
+            for(qint64 i=from; i<to; i++)
+            {
+                min = qMin(min, level == 0 ? t.directory[i].min : t.levels[level-1][i].min);
+                max = qMax(max, level == 0 ? t.directory[i].max : t.levels[level-1][i].max);
+            }
+            return;
+        }
+        for(; from % LevelFanout != 0; from++)
+        {
+            min = qMin(min, level == 0 ? t.directory[from].min : t.levels[level-1][from].min);
+            max = qMax(max, level == 0 ? t.directory[from].max : t.levels[level-1][from].max);
+        }
+        for(; to % LevelFanout != 0 && to > from; to--)
+        {
+            min = qMin(min, level == 0 ? t.directory[to-1].min : t.levels[level-1][to-1].min);
+            max = qMax(max, level == 0 ? t.directory[to-1].max : t.levels[level-1][to-1].max);
+        }
+        from /= LevelFanout;
+        to /= LevelFanout;
+        level++;
+    }
+}
+
+/*
+  Sums of y and y*y over the chunks [from, to), taken from the summary
+  levels like chunkRangeMinMax().
+ */
+void QGraphRecording::chunkRangeSums(int trace, qint64 from, qint64 to, double& sum, double& sumSquares) const
+{
+    const Trace& t = traces[trace];
+    from = qMax(from, qint64(0));
+    to = qMin(to, t.chunkCount);
+    int level = 0;
+    while(from < to)
+    {
+        if(level == t.levels.size() || to-from < LevelFanout)
+        {
+            for(qint64 i=from; i<to; i++)
+            {
+                sum += level == 0 ? t.directory[i].sum : t.levels[level-1][i].sum;
+                sumSquares += level == 0 ? t.directory[i].sumSquares : t.levels[level-1][i].sumSquares;
+            }
+            return;
+        }
+        for(; from % LevelFanout != 0; from++)
+        {
+            sum += level == 0 ? t.directory[from].sum : t.levels[level-1][from].sum;
+            sumSquares += level == 0 ? t.directory[from].sumSquares : t.levels[level-1][from].sumSquares;
+        }
+        for(; to % LevelFanout != 0 && to > from; to--)
+        {
+            sum += level == 0 ? t.directory[to-1].sum : t.levels[level-1][to-1].sum;
+            sumSquares += level == 0 ? t.directory[to-1].sumSquares : t.levels[level-1][to-1].sumSquares;
+        }
+        from /= LevelFanout;
+        to /= LevelFanout;
+        level++;
+    }
+}
+
+/*
+  Returns the decoded x or y values of a chunk. The payload holds the x
+  values first unless the trace is uniform. Uncompressed chunks are used
+  in place, compressed chunks are decoded into a small cache. The
+  returned array shares the cached data, so it stays valid after the
+  mutex is released, even if another thread evicts the chunk.
+ */
+QByteArray QGraphRecording::chunkValues(int trace, qint64 chunk, bool y) const
+{
+    const Trace& t = traces[trace];
+    const ChunkEntry& entry = t.directory[chunk];
+    int bytes = int(entry.count*sizeof(double));
+    const char* payload = reinterpret_cast<const char*>(file->constData() + entry.offset + sizeof(ChunkHeader));
+    if(!(entry.flags & Compressed))
+        return QByteArray::fromRawData(y && !t.header.uniform ? payload+bytes : payload, bytes);
+
+    QMutexLocker locker(&cacheMutex);
+    int victim = 0;
+    for(int i=0; i<cache.size(); i++)
+    {
+        if(cache[i].trace == trace && cache[i].chunk == chunk)
+        {
+            cache[i].used = ++cacheClock;
+            return y ? cache[i].y : cache[i].x;
+        }
+        if(cache[i].used < cache[victim].used)
+            victim = i;
+    }
+    const int cacheChunks = 16;
+    if(cache.size() < cacheChunks)
+    {
+        cache.push_back(CachedChunk());
+        victim = cache.size()-1;
+    }
+    ChunkHeader header;
+    memcpy(&header, file->constData() + entry.offset, sizeof(header));
+    QByteArray data = qUncompress(reinterpret_cast<const uchar*>(payload), int(header.payloadBytes));
+    int expected = t.header.uniform ? bytes : 2*bytes;
+    if(data.size() != expected)
+        data = QByteArray(expected, 0);
+    CachedChunk& cached = cache[victim];
+    cached.trace = trace;
+    cached.chunk = chunk;
+    cached.used = ++cacheClock;
+    cached.x = t.header.uniform ? QByteArray() : data.left(bytes);
+    cached.y = t.header.uniform ? data : data.mid(bytes);
+    return y ? cached.y : cached.x;
+}
+
+QByteArray QGraphRecording::chunkX(int trace, qint64 chunk) const
+{
+    if(traces[trace].header.uniform)
+        return QByteArray();
+    return chunkValues(trace, chunk, false);
+}
+
+QByteArray QGraphRecording::chunkY(int trace, qint64 chunk) const
+{
+    return chunkValues(trace, chunk, true);
+}
+
+QGraphRecordingWriter::QGraphRecordingWriter() :
+    chunkSize(4096),
+    compress(false),
+    failed(false)
+{
+}
+
+QGraphRecordingWriter::~QGraphRecordingWriter()
+{
+    close();
+}
+
+int QGraphRecordingWriter::addTrace(double x0, double dx)
+{
+    Trace trace;
+    memset(&trace.header, 0, sizeof(trace.header));
+    trace.header.uniform = dx > 0;
+    trace.header.x0 = x0;
+    trace.header.dx = dx > 0 ? dx : 0.0;
+    trace.header.barWidth = 0.9;
+    trace.header.penColor = 0xff000000;
+    trace.sampleCount = 0;
+    trace.sorted = true;
+    traces.push_back(trace);
+    return traces.size()-1;
+}
+
+void QGraphRecordingWriter::setTraceStyle(int trace, int style, double barWidth, QRgb penColor, double penWidth, QRgb brushColor)
+{
+    if(trace < 0 || trace >= traces.size() || file.isOpen())
+        return;
+    QGraphRecording::TraceHeader& header = traces[trace].header;
+    header.style = style;
+    header.barWidth = barWidth;
+    header.penColor = penColor;
+    header.penWidth = penWidth;
+    header.brushColor = brushColor;
+}
+
+bool QGraphRecordingWriter::open(const QString& fileName, int chunkSize, bool compress)
+{
+    if(file.isOpen() || chunkSize <= 0)
+        return false;
+    file.setFileName(fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    this->chunkSize = chunkSize;
+    this->compress = compress;
+    failed = false;
+
+    QGraphRecording::FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, recordingMagic, sizeof(recordingMagic));
+    header.version = QGraphRecording::Version;
+    header.traceCount = traces.size();
+    header.chunkSize = chunkSize;
+    header.flags = compress ? QGraphRecording::Compressed : 0;
+    failed = !writePadded(reinterpret_cast<const char*>(&header), sizeof(header));
+    for(int trace=0; trace<traces.size() && !failed; trace++)
+        failed = !writePadded(reinterpret_cast<const char*>(&traces[trace].header), sizeof(QGraphRecording::TraceHeader));
+    return !failed;
+}
+
+/*
+  Adds samples to a trace. x is ignored for uniform traces and may be 0.
+  Every completed chunk is written to the file immediately.
+ */
+bool QGraphRecordingWriter::append(int trace, const double* x, const double* y, qint64 count)
+{
+    if(!file.isOpen() || failed || trace < 0 || trace >= traces.size())
+        return false;
+    Trace& t = traces[trace];
+    bool uniform = t.header.uniform;
+    while(count > 0)
+    {
+        int take = int(qMin(count, qint64(chunkSize - t.y.size())));
+        if(!uniform)
+        {
+            for(int i=0; i<take; i++)
+            {
+                double last = t.x.isEmpty() ? (t.directory.isEmpty() ? x[i] : t.directory.last().lastX) : t.x.last();
+                if(x[i] < last)
+                    t.sorted = false;
+                t.x.push_back(x[i]);
+            }
+            x += take;
+        }
+        for(int i=0; i<take; i++)
+            t.y.push_back(y[i]);
+        y += take;
+        count -= take;
+        if(t.y.size() == chunkSize && !writeChunk(trace))
+            return false;
+    }
+    return true;
+}
+
+bool QGraphRecordingWriter::writeChunk(int trace)
+{
+    Trace& t = traces[trace];
+    if(t.y.isEmpty())
+        return true;
+    bool uniform = t.header.uniform;
+    qint64 first = t.sampleCount;
+
+    QGraphRecording::ChunkHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = recordingChunkMagic;
+    header.trace = trace;
+    header.count = t.y.size();
+    header.firstX = uniform ? t.header.x0 + first*t.header.dx : t.x.first();
+    header.lastX = uniform ? t.header.x0 + (first+t.y.size()-1)*t.header.dx : t.x.last();
+    QGraphKernels::minMax(t.y.constData(), t.y.size(), 1.0, 0.0, header.min, header.max);
+    QGraphKernels::sumsStrided<double>(reinterpret_cast<const uchar*>(t.y.constData()), sizeof(double), t.y.size(), header.sum, header.sumSquares);
+
+    QByteArray payload;
+    if(!uniform)
+        payload.append(reinterpret_cast<const char*>(t.x.constData()), t.x.size()*sizeof(double));
+    payload.append(reinterpret_cast<const char*>(t.y.constData()), t.y.size()*sizeof(double));
+    if(compress)
+    {
+        QByteArray compressed = qCompress(payload);
+        // Incompressible chunks are stored raw, so they can be used in place
+        if(compressed.size() < payload.size())
+        {
+            payload = compressed;
+            header.flags = QGraphRecording::Compressed;
+        }
+    }
+    header.payloadBytes = payload.size();
+
+    QGraphRecording::ChunkEntry entry;
+    entry.offset = file.pos();
+    entry.count = header.count;
+    entry.flags = header.flags;
+    entry.firstX = header.firstX;
+    entry.lastX = header.lastX;
+    entry.min = header.min;
+    entry.max = header.max;
+    entry.sum = header.sum;
+    entry.sumSquares = header.sumSquares;
+
+    if(!writePadded(reinterpret_cast<const char*>(&header), sizeof(header)) || !writePadded(payload.constData(), payload.size()))
+    {
+        failed = true;
+        return false;
+    }
+    t.directory.push_back(entry);
+    t.sampleCount += t.y.size();
+    t.x.clear();
+    t.y.clear();
+    return true;
+}
+
+bool QGraphRecordingWriter::writePadded(const char* data, qint64 size)
+{
+    static const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    if(file.write(data, size) != size)
+        return false;
+    qint64 padding = recordingPadded(size)-size;
+    return padding == 0 || file.write(zeros, padding) == padding;
+}
+
+/*
+  Writes the remaining samples, the chunk directories, the summary
+  levels and the index. Returns false if anything could not be written.
+ */
+bool QGraphRecordingWriter::close()
+{
+    if(!file.isOpen())
+        return false;
+    for(int trace=0; trace<traces.size() && !failed; trace++)
+        writeChunk(trace);
+
+    QVector<QGraphRecording::TraceIndex> index(traces.size());
+    for(int trace=0; trace<traces.size() && !failed; trace++)
+    {
+        Trace& t = traces[trace];
+        QGraphRecording::TraceIndex& entry = index[trace];
+        memset(&entry, 0, sizeof(entry));
+        entry.chunkCount = t.directory.size();
+        entry.sampleCount = t.sampleCount;
+        entry.flags = t.sorted ? 0 : QGraphRecording::Unsorted;
+        entry.directoryOffset = file.pos();
+        failed = !writePadded(reinterpret_cast<const char*>(t.directory.constData()), t.directory.size()*sizeof(QGraphRecording::ChunkEntry));
+
+        QVector< QVector<QGraphRecording::LevelEntry> > levels;
+        QGraphRecording::buildLevels(t.directory.constData(), t.directory.size(), levels);
+        entry.levelCount = levels.size();
+        for(int level=0; level<levels.size() && !failed; level++)
+        {
+            entry.levelOffset[level] = file.pos();
+            failed = !writePadded(reinterpret_cast<const char*>(levels[level].constData()), levels[level].size()*sizeof(QGraphRecording::LevelEntry));
+        }
+    }
+
+    QGraphRecording::Footer footer;
+    memset(&footer, 0, sizeof(footer));
+    footer.indexOffset = file.pos();
+    footer.traceCount = traces.size();
+    memcpy(footer.magic, recordingIndexMagic, sizeof(recordingIndexMagic));
+    if(!failed)
+        failed = !writePadded(reinterpret_cast<const char*>(index.constData()), index.size()*sizeof(QGraphRecording::TraceIndex))
+                 || !writePadded(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    file.close();
+    for(int trace=0; trace<traces.size(); trace++)
+    {
+        traces[trace].x.clear();
+        traces[trace].y.clear();
+        traces[trace].directory.clear();
+        traces[trace].sampleCount = 0;
+        traces[trace].sorted = true;
+    }
+    return !failed;
+}
+
+// The chunk values are held in a QByteArray, use them as doubles
+static inline const double* chunkDoubles(const QByteArray& values)
+{
+    return reinterpret_cast<const double*>(values.constData());
+}
+
+QGraphFileSource::QGraphFileSource(QSharedPointer<QGraphRecording> recording, int trace) :
+    recording(recording),
+    trace(trace),
+    samples(0),
+    chunkSize(1),
+    uniform(false),
+    x0(0.0),
+    dx(1.0),
+    exactChunks(64)
+{
+    if(!recording || trace < 0 || trace >= recording->traceCount())
+        return;
+    const QGraphRecording::TraceHeader& header = recording->traceHeader(trace);
+    samples = recording->sampleCount(trace);
+    chunkSize = recording->chunkSize();
+    uniform = header.uniform;
+    x0 = header.x0;
+    dx = header.dx;
+}
+
+double QGraphFileSource::x(qint64 index) const
+{
+    if(uniform)
+        return x0+index*dx;
+    qint64 chunk = index/chunkSize;
+    QByteArray values = recording->chunkX(trace, chunk);
+    return chunkDoubles(values)[index-chunk*chunkSize];
+}
+
+double QGraphFileSource::y(qint64 index) const
+{
+    qint64 chunk = index/chunkSize;
+    QByteArray values = recording->chunkY(trace, chunk);
+    return chunkDoubles(values)[index-chunk*chunkSize];
+}
+
+bool QGraphFileSource::sortedX() const
+{
+    if(uniform)
+        return dx > 0;
+    return recording && recording->isSorted(trace);
+}
+
+qint64 QGraphFileSource::lowerBound(double x) const
+{
+    if(uniform)
+        return QGraphVectorSource::uniformLowerBound(x, x0, dx, samples);
+    // Find the first chunk ending at or after x, then search inside it
+    qint64 low = 0;
+    qint64 high = recording->chunkCount(trace);
+    while(low < high)
+    {
+        qint64 middle = low+(high-low)/2;
+        if(recording->chunkEntry(trace, middle).lastX < x)
+            low = middle+1;
+        else
+            high = middle;
+    }
+    if(low == recording->chunkCount(trace))
+        return samples;
+    QByteArray values = recording->chunkX(trace, low);
+    const double* chunkX = chunkDoubles(values);
+    int count = recording->chunkEntry(trace, low).count;
+    return low*chunkSize + (std::lower_bound(chunkX, chunkX+count, x) - chunkX);
+}
+
+/*
+  The partial chunks at the range ends are scanned, whole chunks are
+  taken from the summaries. Ranges over more than exactChunks chunks are
+  answered from the summaries only, the partial chunks at the ends are
+  then included completely, which is far below one pixel column.
+ */
+void QGraphFileSource::minMaxY(qint64 from, qint64 to, double& min, double& max) const
+{
+    min = numeric_limits<double>::infinity();
+    max = -numeric_limits<double>::infinity();
+    from = qMax(from, qint64(0));
+    to = qMin(to, samples);
+    if(from >= to)
+        return;
+    qint64 first = from/chunkSize;
+    qint64 last = (to-1)/chunkSize;
+    if(first == last)
+    {
+        double chunkMin, chunkMax;
+        QGraphKernels::minMax(chunkDoubles(recording->chunkY(trace, first)) + (from-first*chunkSize), int(to-from), 1.0, 0.0, chunkMin, chunkMax);
+        min = chunkMin;
+        max = chunkMax;
+        return;
+    }
+
+    qint64 wholeFrom = first;
+    qint64 wholeTo = last+1;
+    if(last-first <= exactChunks)
+    {
+        double chunkMin, chunkMax;
+        if(from != first*chunkSize)
+        {
+            QGraphKernels::minMax(chunkDoubles(recording->chunkY(trace, first)) + (from-first*chunkSize), int((first+1)*chunkSize-from), 1.0, 0.0, chunkMin, chunkMax);
+            min = qMin(min, chunkMin);
+            max = qMax(max, chunkMax);
+            wholeFrom = first+1;
+        }
+        if(to != last*chunkSize + recording->chunkEntry(trace, last).count)
+        {
+            QGraphKernels::minMax(chunkDoubles(recording->chunkY(trace, last)), int(to-last*chunkSize), 1.0, 0.0, chunkMin, chunkMax);
+            min = qMin(min, chunkMin);
+            max = qMax(max, chunkMax);
+            wholeTo = last;
+        }
+    }
+    recording->chunkRangeMinMax(trace, wholeFrom, wholeTo, min, max);
+}
+
+/*
+  The partial chunks at the range ends are summed exactly, whole chunks
+  are taken from the summaries.
+ */
+void QGraphFileSource::sums(qint64 from, qint64 to, double& sum, double& sumSquares) const
+{
+    sum = 0.0;
+    sumSquares = 0.0;
+    from = qMax(from, qint64(0));
+    to = qMin(to, samples);
+    if(from >= to)
+        return;
+    qint64 first = from/chunkSize;
+    qint64 last = (to-1)/chunkSize;
+    qint64 wholeFrom = first;
+    qint64 wholeTo = last+1;
+    if(from != first*chunkSize || first == last)
+    {
+        qint64 end = qMin(to, (first+1)*chunkSize);
+        QGraphKernels::sumsStrided<double>(reinterpret_cast<const uchar*>(chunkDoubles(recording->chunkY(trace, first)) + (from-first*chunkSize)), sizeof(double), end-from, sum, sumSquares);
+        wholeFrom = first+1;
+    }
+    if(first != last && to != last*chunkSize + recording->chunkEntry(trace, last).count)
+    {
+        QGraphKernels::sumsStrided<double>(reinterpret_cast<const uchar*>(chunkDoubles(recording->chunkY(trace, last))), sizeof(double), to-last*chunkSize, sum, sumSquares);
+        wholeTo = last;
+    }
+    recording->chunkRangeSums(trace, wholeFrom, wholeTo, sum, sumSquares);
+}
+
+void QGraphFileSource::readX(qint64 from, qint64 count, double* out) const
+{
+    if(uniform)
+    {
+        for(qint64 i=0; i<count; i++)
+            out[i] = x0+(from+i)*dx;
+        return;
+    }
+    while(count > 0)
+    {
+        qint64 chunk = from/chunkSize;
+        qint64 offset = from-chunk*chunkSize;
+        qint64 take = qMin(count, qint64(recording->chunkEntry(trace, chunk).count)-offset);
+        memcpy(out, chunkDoubles(recording->chunkX(trace, chunk))+offset, take*sizeof(double));
+        out += take;
+        from += take;
+        count -= take;
+    }
+}
+
+void QGraphFileSource::readY(qint64 from, qint64 count, double* out) const
+{
+    while(count > 0)
+    {
+        qint64 chunk = from/chunkSize;
+        qint64 offset = from-chunk*chunkSize;
+        qint64 take = qMin(count, qint64(recording->chunkEntry(trace, chunk).count)-offset);
+        memcpy(out, chunkDoubles(recording->chunkY(trace, chunk))+offset, take*sizeof(double));
+        out += take;
+        from += take;
+        count -= take;
+    }
+}
+
+bool QGraphFileSource::uniformX(double& x0, double& dx) const
+{
+    x0 = this->x0;
+    dx = this->dx;
+    return uniform;
+}
+
+QGraphCurveLod::QGraphCurveLod(const QGraphDataSource* source) :
+    size(source->size()),
+    width(1.0),
+    height(1.0)
+{
+    if(size < 3)
+        return;
+
+    // Normalize to the data range, floats are precise enough for sub pixel errors
+    double minX, maxX, minY, maxY;
+    source->minMaxX(0, size, minX, maxX);
+    source->minMaxY(0, size, minY, maxY);
+    width = maxX > minX ? maxX-minX : 1.0;
+    height = maxY > minY ? maxY-minY : 1.0;
+    QVector<float> u(int(size), 0.0f);
+    QVector<float> v(int(size), 0.0f);
+    const qint64 block = 4096;
+    QVector<double> xs(block), ys(block);
+    for(qint64 i=0; i<size; i+=block)
+    {
+        int count = int(qMin(block, size-i));
+        source->readX(i, count, xs.data());
+        source->readY(i, count, ys.data());
+        for(int j=0; j<count; j++)
+        {
+            u[int(i+j)] = float((xs[j]-minX)/width);
+            v[int(i+j)] = float((ys[j]-minY)/height);
+        }
+    }
+
+    // Iterative RDP: a point is kept down to its distance from the chord,
+    // but not further than its parent, so the levels are nested
+    QVector<float> importance(int(size), 0.0f);
+    importance[0] = numeric_limits<float>::infinity();
+    importance[int(size-1)] = numeric_limits<float>::infinity();
+    struct Span {
+        int first;
+        int last;
+        float cap;
+    };
+    QVector<Span> stack;
+    Span all = {0, int(size-1), numeric_limits<float>::infinity()};
+    stack.push_back(all);
+    while(!stack.isEmpty())
+    {
+        Span span = stack.last();
+        stack.pop_back();
+        if(span.last-span.first < 2)
+            continue;
+        float ax = u[span.first];
+        float ay = v[span.first];
+        float dx = u[span.last]-ax;
+        float dy = v[span.last]-ay;
+        float length = dx*dx + dy*dy;
+        float inverse = length > 0.0f ? 1.0f/length : 0.0f;
+        int farthest = span.first+1;
+        float distance = -1.0f;
+        for(int i=span.first+1; i<span.last; i++)
+        {
+            // Distance to the segment, not the line, so loops are not cut
+            float px = u[i]-ax;
+            float py = v[i]-ay;
+            float t = qBound(0.0f, (px*dx + py*dy)*inverse, 1.0f);
+            float ex = px-t*dx;
+            float ey = py-t*dy;
+            float d = ex*ex + ey*ey;
+            if(d > distance)
+            {
+                distance = d;
+                farthest = i;
+            }
+        }
+        float cap = qMin(span.cap, sqrt(distance));
+        importance[farthest] = cap;
+        Span left = {span.first, farthest, cap};
+        Span right = {farthest, span.last, cap};
+        stack.push_back(left);
+        stack.push_back(right);
+    }
+
+    // Levels up to the one that keeps half of the points
+    for(double tolerance=0.25; tolerance>1e-7; tolerance*=0.5)
+    {
+        QVector<qint64> indices;
+        for(int i=0; i<int(size); i++)
+            if(importance[i] > tolerance)
+                indices.push_back(i);
+        if(indices.size() > size/2)
+            break;
+        tolerances.push_back(tolerance);
+        levels.push_back(indices);
+    }
+}
+
+const QVector<qint64>* QGraphCurveLod::level(double pixelWidth, double pixelHeight, double maxError) const
+{
+    // A normalized distance d is at most d/min(pixel) pixels on screen
+    double pixel = qMin(pixelWidth/width, pixelHeight/height);
+    for(int l=0; l<levels.size(); l++)
+        if(tolerances[l] < maxError*pixel)
+            return &levels[l];
+    return 0;
+}
+
+class QGraphCurveLodTask : public QRunnable
+{
+public:
+    QGraphCurveLodTask(const QSharedPointer<QGraphCurveLodBuilder>& builder, const QSharedPointer<QGraphDataSource>& source, QGraph* graph) :
+        builder(builder),
+        source(source),
+        graph(graph)
+    {
+    }
+
+    void run()
+    {
+        QSharedPointer<QGraphCurveLod> lod(new QGraphCurveLod(source.data()));
+        QMutexLocker locker(&builder->mutex);
+        builder->running = false;
+        // Drop the levels if the curve was given another source meanwhile
+        if(builder->readySource.toStrongRef() != source)
+            return;
+        builder->ready = lod;
+        // The scheduler ignores the graph if it is gone by now
+        QMetaObject::invokeMethod(QGraphScheduler::instance(), "redraw", Qt::QueuedConnection, Q_ARG(QGraph*, graph));
+    }
+
+private:
+    QSharedPointer<QGraphCurveLodBuilder> builder;
+    QSharedPointer<QGraphDataSource> source;
+    QGraph* graph;
+};
+
+QGraphCurveLodBuilder::QGraphCurveLodBuilder() :
+    running(false)
+{
+}
+
+QSharedPointer<QGraphCurveLod> QGraphCurveLodBuilder::levels(const QSharedPointer<QGraphCurveLodBuilder>& builder, const QSharedPointer<QGraphDataSource>& source, QGraph* graph)
+{
+    QMutexLocker locker(&builder->mutex);
+    qint64 size = source->size();
+    bool current = builder->ready && builder->readySource.toStrongRef() == source;
+    if(current && builder->ready->sourceSize() == size)
+        return builder->ready;
+
+    // Levels of another source or of more samples than there are now cannot be drawn
+    if(!current || builder->ready->sourceSize() > size || !source->threadSafe())
+    {
+        builder->ready = QSharedPointer<QGraphCurveLod>(new QGraphCurveLod(source.data()));
+        builder->readySource = source;
+        return builder->ready;
+    }
+
+    if(!builder->running)
+    {
+        builder->running = true;
+        QGraphScheduler::instance()->pool()->start(new QGraphCurveLodTask(builder, source, graph));
+    }
+    return builder->ready;
+}
+
+QGraphWaterfall::QGraphWaterfall(int columns, int rows, double x0, double dx, double y0, double dy) :
+    columnCount(qMax(columns, 0)),
+    rowCount(qMax(rows, 0)),
+    x0(x0),
+    dx(dx),
+    y0(y0),
+    dy(dy),
+    min(0.0),
+    max(1.0),
+    head(0)
+{
+    setColors(QVector<QColor>());
+    if(columnCount > 0 && rowCount > 0)
+        buffer = QImage(columnCount, 2*rowCount, QImage::Format_ARGB32);
+    clear();
+}
+
+/**
+  \fn void QGraphWaterfall::setRange(double min, double max)
+  Sets the values mapped to the first and the last colour, values
+  outside are clamped. Applies to rows added afterwards.
+ **/
+void QGraphWaterfall::setRange(double min, double max)
+{
+    this->min = min;
+    this->max = max;
+}
+
+/**
+  \fn void QGraphWaterfall::setColors(const QVector<QColor>& colors)
+  Sets the colour stops from min to max. An empty vector selects black,
+  blue, red, yellow, white. Applies to rows added afterwards.
+ **/
+void QGraphWaterfall::setColors(const QVector<QColor>& colors)
+{
+    QVector<QColor> stops = colors;
+    if(stops.isEmpty())
+        stops << Qt::black << Qt::blue << Qt::red << Qt::yellow << Qt::white;
+    QGraphKernels::colorTable(stops, lut);
+}
+
+void QGraphWaterfall::setMatrix(const double* values)
+{
+    head = 0;
+    for(int row=0; row<rowCount; row++)
+        mapRow(values+qint64(row)*columnCount, rowCount-1-row);
+}
+
+void QGraphWaterfall::pushRow(const double* values)
+{
+    if(rowCount == 0)
+        return;
+    head = (head+rowCount-1)%rowCount;
+    mapRow(values, head);
+}
+
+void QGraphWaterfall::clear()
+{
+    head = 0;
+    if(!buffer.isNull())
+        buffer.fill(lut[0]);
+}
+
+/*
+  Colour maps one row into both copies of the buffer.
+ */
+void QGraphWaterfall::mapRow(const double* values, int row)
+{
+    if(buffer.isNull())
+        return;
+    QGraphKernels::colorMapRange(values, columnCount, min, max, lut.constData(), reinterpret_cast<QRgb*>(buffer.scanLine(row)));
+    memcpy(buffer.scanLine(row+rowCount), buffer.constScanLine(row), columnCount*sizeof(QRgb));
+}
+
+QGraphDerivedSource::QGraphDerivedSource(QSharedPointer<QGraphDataSource> source, Filter filter, const QVector<double>& b, const QVector<double>& a, int factor) :
+    source(source),
+    filter(filter),
+    b(b),
+    a(a),
+    factor(qMax(factor, 1)),
+    exactChunks(4),
+    cacheClock(0)
+{
+}
+
+QSharedPointer<QGraphDerivedSource> QGraphDerivedSource::movingAverage(QSharedPointer<QGraphDataSource> source, int length)
+{
+    return QSharedPointer<QGraphDerivedSource>(new QGraphDerivedSource(source, MovingAverage, QVector<double>(), QVector<double>(), length));
+}
+
+QSharedPointer<QGraphDerivedSource> QGraphDerivedSource::fir(QSharedPointer<QGraphDataSource> source, const QVector<double>& coefficients)
+{
+    QVector<double> b = coefficients;
+    if(b.isEmpty())
+        b.push_back(1.0);
+    return QSharedPointer<QGraphDerivedSource>(new QGraphDerivedSource(source, Fir, b, QVector<double>(), 1));
+}
+
+QSharedPointer<QGraphDerivedSource> QGraphDerivedSource::iir(QSharedPointer<QGraphDataSource> source, const QVector<double>& b, const QVector<double>& a)
+{
+    // Normalize to a[0] = 1 and pad both to the same order
+    int order = qMax(qMax(b.size(), a.size()), 1);
+    QVector<double> bn(order, 0.0);
+    QVector<double> an(order, 0.0);
+    double a0 = a.isEmpty() || a[0] == 0.0 ? 1.0 : a[0];
+    for(int i=0; i<b.size(); i++)
+        bn[i] = b[i]/a0;
+    for(int i=0; i<a.size(); i++)
+        an[i] = a[i]/a0;
+    an[0] = 1.0;
+    return QSharedPointer<QGraphDerivedSource>(new QGraphDerivedSource(source, Iir, bn, an, 1));
+}
+
+QSharedPointer<QGraphDerivedSource> QGraphDerivedSource::difference(QSharedPointer<QGraphDataSource> source)
+{
+    return QSharedPointer<QGraphDerivedSource>(new QGraphDerivedSource(source, Difference, QVector<double>(), QVector<double>(), 1));
+}
+
+QSharedPointer<QGraphDerivedSource> QGraphDerivedSource::resample(QSharedPointer<QGraphDataSource> source, int factor)
+{
+    return QSharedPointer<QGraphDerivedSource>(new QGraphDerivedSource(source, Resample, QVector<double>(), QVector<double>(), factor));
+}
+
+qint64 QGraphDerivedSource::size() const
+{
+    qint64 size = source->size();
+    if(filter == Difference)
+        return qMax(size-1, qint64(0));
+    if(filter == Resample)
+        return size/factor;
+    return size;
+}
+
+double QGraphDerivedSource::x(qint64 index) const
+{
+    if(filter == Difference)
+        return source->x(index+1);
+    if(filter == Resample)
+        return 0.5*(source->x(index*factor) + source->x(index*factor+factor-1));
+    return source->x(index);
+}
+
+double QGraphDerivedSource::y(qint64 index) const
+{
+    QMutexLocker locker(&mutex);
+    // The ends of a summarized chunk need not be computed again
+    QHash<qint64, Summary>::const_iterator summary = summaries.constFind(index/ChunkSize);
+    if(summary != summaries.constEnd() && index%ChunkSize == 0)
+        return summary->first;
+    if(summary != summaries.constEnd() && index%ChunkSize == ChunkSize-1)
+        return summary->last;
+    return chunkY(index/ChunkSize)[int(index%ChunkSize)];
+}
+
+bool QGraphDerivedSource::uniformX(double& x0, double& dx) const
+{
+    if(!source->uniformX(x0, dx))
+        return false;
+    if(filter == Difference)
+        x0 += dx;
+    if(filter == Resample)
+    {
+        x0 += 0.5*(factor-1)*dx;
+        dx *= factor;
+    }
+    return true;
+}
+
+void QGraphDerivedSource::minMaxY(qint64 from, qint64 to, double& min, double& max) const
+{
+    double first, last;
+    QMutexLocker locker(&mutex);
+    rangeY(from, to, min, max, first, last);
+}
+
+void QGraphDerivedSource::envelopeY(qint64 from, qint64 to, double& min, double& max, double& first, double& last) const
+{
+    QMutexLocker locker(&mutex);
+    rangeY(from, to, min, max, first, last);
+}
+
+/*
+  Partial chunks at the range ends are computed and scanned, whole
+  chunks are taken from the summaries. Ranges over more than exactChunks
+  chunks are answered from the summaries only, the partial chunks at the
+  ends are then included completely, which is far below one pixel
+  column. Only chunks that were never computed are filtered then, so a
+  zoomed out view does not run the filter again every frame. The mutex
+  has to be locked.
+ */
+void QGraphDerivedSource::rangeY(qint64 from, qint64 to, double& min, double& max, double& first, double& last) const
+{
+    min = numeric_limits<double>::infinity();
+    max = -numeric_limits<double>::infinity();
+    first = numeric_limits<double>::quiet_NaN();
+    last = first;
+    bool whole = to > from && (to-1)/ChunkSize - from/ChunkSize > exactChunks;
+    for(bool start=true; from < to; start=false)
+    {
+        qint64 chunk = from/ChunkSize;
+        qint64 begin = chunk*ChunkSize;
+        qint64 end = qMin(begin+ChunkSize, to);
+        QHash<qint64, Summary>::const_iterator summary = summaries.constFind(chunk);
+        if(summary != summaries.constEnd() && (whole || (from == begin && end == begin+ChunkSize)))
+        {
+            min = qMin(min, summary->min);
+            max = qMax(max, summary->max);
+            if(start)
+                first = summary->first;
+            last = summary->last;
+        }
+        else
+        {
+            const QVector<double>& y = chunkY(chunk);
+            double low, high;
+            QGraphKernels::minMax(y.constData()+(from-begin), end-from, 1.0, 0.0, low, high);
+            min = qMin(min, low);
+            max = qMax(max, high);
+            if(start)
+                first = y[int(from-begin)];
+            last = y[int(end-begin-1)];
+        }
+        from = end;
+    }
+}
+
+void QGraphDerivedSource::sums(qint64 from, qint64 to, double& sum, double& sumSquares) const
+{
+    sum = 0.0;
+    sumSquares = 0.0;
+    QMutexLocker locker(&mutex);
+    while(from < to)
+    {
+        qint64 chunk = from/ChunkSize;
+        qint64 start = chunk*ChunkSize;
+        qint64 end = qMin(start+ChunkSize, to);
+        QHash<qint64, Summary>::const_iterator summary = summaries.constFind(chunk);
+        if(from == start && end == start+ChunkSize && summary != summaries.constEnd())
+        {
+            sum += summary->sum;
+            sumSquares += summary->sumSquares;
+        }
+        else
+        {
+            const QVector<double>& y = chunkY(chunk);
+            QGraphKernels::sumsStrided<double>(reinterpret_cast<const uchar*>(y.constData()+(from-start)), sizeof(double), end-from, sum, sumSquares);
+        }
+        from = end;
+    }
+}
+
+void QGraphDerivedSource::readY(qint64 from, qint64 count, double* out) const
+{
+    QMutexLocker locker(&mutex);
+    qint64 to = from+count;
+    while(from < to)
+    {
+        qint64 chunk = from/ChunkSize;
+        qint64 start = chunk*ChunkSize;
+        qint64 end = qMin(start+ChunkSize, to);
+        const QVector<double>& y = chunkY(chunk);
+        memcpy(out, y.constData()+(from-start), (end-from)*sizeof(double));
+        out += end-from;
+        from = end;
+    }
 }
 
-void QGraph::setBottomBorder(int bottomBorder)
+/*
+  Returns the samples of a chunk from the cache, computing them if they
+  are not cached or the chunk has grown since. The mutex has to be
+  locked.
+ */
+const QVector<double>& QGraphDerivedSource::chunkY(qint64 chunk) const
 {
-    this->bottomBorder = bottomBorder;
+    qint64 count = qBound(qint64(0), size()-chunk*ChunkSize, qint64(ChunkSize));
+    int victim = 0;
+    for(int i=0; i<cache.size(); i++)
+    {
+        if(cache[i].chunk == chunk)
+        {
+            cache[i].used = ++cacheClock;
+            if(cache[i].y.size() < count)
+                compute(chunk, count, cache[i].y);
+            return cache[i].y;
+        }
+        if(cache[i].used < cache[victim].used)
+            victim = i;
+    }
+    if(cache.size() < CacheChunks)
+    {
+        cache.push_back(CachedChunk());
+        victim = cache.size()-1;
+    }
+    CachedChunk& cached = cache[victim];
+    cached.chunk = chunk;
+    cached.used = ++cacheClock;
+    compute(chunk, count, cached.y);
+    return cached.y;
 }
 
-void QGraph::setDefaultBorder()
+/*
+  Filters the first count samples of a chunk and records the summary
+  once the chunk is complete.
+ */
+void QGraphDerivedSource::compute(qint64 chunk, qint64 count, QVector<double>& out) const
 {
-    leftBorder = 10;
-    topBorder = 10;
-    rightBorder = 10;
-    bottomBorder = 10;
+    qint64 first = chunk*ChunkSize;
+    out.resize(int(count));
+    double* y = out.data();
+    QVector<double> in;
+    switch(filter)
+    {
+    case MovingAverage:
+    {
+        qint64 begin = qMax(first-factor+1, qint64(0));
+        in.resize(int(first+count-begin));
+        source->readY(begin, in.size(), in.data());
+        double sum = 0.0;
+        for(qint64 i=begin; i<first; i++)
+            sum += in[int(i-begin)];
+        for(qint64 i=first; i<first+count; i++)
+        {
+            sum += in[int(i-begin)];
+            if(i-factor >= begin)
+                sum -= in[int(i-factor-begin)];
+            y[i-first] = sum/qMin(qint64(factor), i+1);
+        }
+    }
+        break;
+    case Fir:
+    {
+        int taps = b.size();
+        qint64 begin = qMax(first-taps+1, qint64(0));
+        in.resize(int(first+count-begin));
+        source->readY(begin, in.size(), in.data());
+        for(qint64 i=first; i<first+count; i++)
+        {
+            const double* x = in.constData()+(i-begin);
+            int n = int(qMin(qint64(taps), i-begin+1));
+            double sum = 0.0;
+            for(int k=0; k<n; k++)
+                sum += b[k]*x[-k];
+            y[i-first] = sum;
+        }
+    }
+        break;
+    case Iir:
+    {
+        // The state at a chunk start depends on all samples before, it is
+        // kept for every chunk boundary that was passed once
+        if(states.isEmpty())
+            states.push_back(QVector<double>(b.size(), 0.0));
+        QVector<double> scratch;
+        while(states.size() <= chunk)
+        {
+            qint64 start = (states.size()-1)*qint64(ChunkSize);
+            in.resize(ChunkSize);
+            scratch.resize(ChunkSize);
+            source->readY(start, ChunkSize, in.data());
+            QVector<double> state = states.last();
+            runIir(in.constData(), ChunkSize, state, scratch.data());
+            states.push_back(state);
+        }
+        in.resize(int(count));
+        source->readY(first, count, in.data());
+        QVector<double> state = states[int(chunk)];
+        runIir(in.constData(), count, state, y);
+    }
+        break;
+    case Difference:
+    {
+        in.resize(int(count+1));
+        source->readY(first, count+1, in.data());
+        double x0, dx;
+        if(source->uniformX(x0, dx))
+        {
+            double scale = dx != 0.0 ? 1.0/dx : 0.0;
+            for(qint64 i=0; i<count; i++)
+                y[i] = (in[int(i+1)]-in[int(i)])*scale;
+        }
+        else
+        {
+            QVector<double> x(int(count+1));
+            source->readX(first, count+1, x.data());
+            for(qint64 i=0; i<count; i++)
+            {
+                double step = x[int(i+1)]-x[int(i)];
+                y[i] = step != 0.0 ? (in[int(i+1)]-in[int(i)])/step : 0.0;
+            }
+        }
+    }
+        break;
+    case Resample:
+    {
+        in.resize(int(count*factor));
+        source->readY(first*factor, count*factor, in.data());
+        for(qint64 i=0; i<count; i++)
+        {
+            double sum = 0.0;
+            for(int k=0; k<factor; k++)
+                sum += in[int(i*factor+k)];
+            y[i] = sum/factor;
+        }
+    }
+        break;
+    }
+    if(count == ChunkSize)
+    {
+        Summary summary;
+        QGraphKernels::minMax(y, count, 1.0, 0.0, summary.min, summary.max);
+        summary.sum = 0.0;
+        summary.sumSquares = 0.0;
+        QGraphKernels::sumsStrided<double>(reinterpret_cast<const uchar*>(y), sizeof(double), count, summary.sum, summary.sumSquares);
+        summary.first = y[0];
+        summary.last = y[count-1];
+        summaries.insert(chunk, summary);
+    }
 }
 
-void QGraph::setNoBorder()
+/*
+  Direct form II transposed, state holds b.size() values of which the
+  last one stays 0.
+ */
+void QGraphDerivedSource::runIir(const double* in, qint64 count, QVector<double>& state, double* out) const
+{
+    int order = b.size()-1;
+    double* z = state.data();
+    for(qint64 i=0; i<count; i++)
+    {
+        double x = in[i];
+        double y = b[0]*x + z[0];
+        for(int k=0; k<order; k++)
+            z[k] = b[k+1]*x + z[k+1] - a[k+1]*y;
+        out[i] = y;
+    }
+}
+
+class QGraphImportTask : public QRunnable
+{
+public:
+    QGraphImportTask(QGraphImporter* importer, int block) :
+        importer(importer),
+        block(block)
+    {
+    }
+
+    void run()
+    {
+        importer->runBlock(block);
+    }
+
+private:
+    QGraphImporter* importer;
+    int block;
+};
+
+QGraphImporter::QGraphImporter(QObject* parent) :
+    QObject(parent),
+    format(Csv),
+    blockBytes(qint64(4) << 20),
+    dataStart(0),
+    dataEnd(0),
+    alignment(1),
+    blockCount(0),
+    delimiter(','),
+    columns(0),
+    xColumn(-1),
+    type(QGraphMappedSource::Float64),
+    channels(0),
+    nextBlock(0),
+    remaining(0),
+    running(0),
+    bytesDone(0),
+    cancelled(0)
 {
-    leftBorder = 0;
-    topBorder = 0;
-    rightBorder = 0;
-    bottomBorder = 0;
 }
 
+QGraphImporter::~QGraphImporter()
+{
+    cancel();
+    waitForFinished();
+}
 
-void QGraph::repaint()
+void QGraphImporter::cancel()
 {
-    // Fill image white
-    graphImage.fill(Qt::white);
+    cancelled.storeRelease(1);
+}
 
-    // Generate destination rect and mirror y coordinate
-    QPainter painter(&graphImage);
+bool QGraphImporter::isRunning() const
+{
+    QMutexLocker locker(&mutex);
+    return running > 0;
+}
 
-    // Turn off antializing
-    painter.setRenderHint(QPainter::NonCosmeticDefaultPen);
+void QGraphImporter::waitForFinished()
+{
+    QMutexLocker locker(&mutex);
+    while(running > 0)
+        idle.wait(&mutex);
+}
 
-    // Draw surrounding rect
-    painter.setBrush(Qt::transparent);
-    painter.setPen(Qt::black);
-    painter.drawRect(dstRect);
+bool QGraphImporter::open(const QString& fileName)
+{
+    if(file)
+        return false;
+    file = QSharedPointer<QGraphMappedFile>(new QGraphMappedFile(fileName));
+    if(!file->isValid())
+    {
+        file.clear();
+        return false;
+    }
+    return true;
+}
 
-    // Draw the coordinate lines
-    for(int i=0; i<xPoints.size(); i++)
+/*
+  Reads the first lines to find the delimiter, an optional header line
+  and the number of columns, then starts parsing.
+ */
+bool QGraphImporter::startCsv(const QString& fileName, int xColumn)
+{
+    if(!open(fileName))
+        return false;
+    format = Csv;
+    const char* data = reinterpret_cast<const char*>(file->constData());
+    const char* end = data + file->size();
+
+    const char* line = data;
+    // Skip an UTF-8 byte order mark
+    if(end-line >= 3 && memcmp(line, "\xEF\xBB\xBF", 3) == 0)
+        line += 3;
+    for(int attempt=0; attempt<2 && line<end; attempt++)
     {
-        painter.drawLine(src2dstX(xPoints[i]), dstRect.y(), src2dstX(xPoints[i]), dstRect.y()-7);
-        painter.drawLine(src2dstX(xPoints[i]), dstRect.y()+dstRect.height(), src2dstX(xPoints[i]), dstRect.y()+dstRect.height()+7);
+        const char* lineEnd = static_cast<const char*>(memchr(line, '\n', end-line));
+        if(!lineEnd)
+            lineEnd = end;
+        int commas = std::count(line, lineEnd, ',');
+        int semicolons = std::count(line, lineEnd, ';');
+        int tabs = std::count(line, lineEnd, '\t');
+        delimiter = ' ';
+        if(commas > 0 && commas >= semicolons && commas >= tabs)
+            delimiter = ',';
+        else if(semicolons > 0 && semicolons >= tabs)
+            delimiter = ';';
+        else if(tabs > 0)
+            delimiter = '\t';
+
+        // A line has at most one field more than half its length
+        QVector<double> values(int(lineEnd-line)/2+2);
+        columns = values.size();
+        columns = splitCsvLine(line, lineEnd, values.data());
+        bool numeric = columns > 0;
+        for(int column=0; column<columns; column++)
+            numeric = numeric && !std::isnan(values[column]);
+        if(numeric)
+            break;
+        // Not a data line, so it is a header
+        line = lineEnd < end ? lineEnd+1 : end;
+        columns = 0;
     }
-    for(int i=0; i<yPoints.size(); i++)
+    if(columns <= 0)
     {
-        painter.drawLine(dstRect.x(), src2dstY(yPoints[i]), dstRect.x()+7, src2dstY(yPoints[i]));
-        painter.drawLine(dstRect.x()+dstRect.width()-7, src2dstY(yPoints[i]), dstRect.x()+dstRect.width(), src2dstY(yPoints[i]));
+        file.clear();
+        return false;
     }
 
-    // Draw the values for the coordinate lines
-    if(xNumbersEnabled)
+    this->xColumn = xColumn < columns ? xColumn : -1;
+    for(int column=0; column<columns; column++)
     {
-        for(int i=0; i<xPoints.size(); i++)
+        if(column == this->xColumn)
+            continue;
+        if(this->xColumn < 0)
+            columnSources.push_back(QSharedPointer<QGraphChunkedSource<double> >(new QGraphChunkedSource<double>(0.0, 1.0)));
+        else
+            columnSources.push_back(QSharedPointer<QGraphChunkedSource<double> >(new QGraphChunkedSource<double>()));
+    }
+    dataStart = line-data;
+    start(file->size()-dataStart, 1);
+    return true;
+}
+
+bool QGraphImporter::startBinary(const QString& fileName, QGraphMappedSource::SampleType type, int channels, double sampleRate, qint64 headerBytes)
+{
+    if(channels <= 0 || sampleRate <= 0 || headerBytes < 0 || !open(fileName))
+        return false;
+    format = Binary;
+    this->type = type;
+    this->channels = channels;
+    qint64 frameBytes = qint64(channels)*QGraphMappedSource::sampleSize(type);
+    qint64 frames = (file->size()-headerBytes)/frameBytes;
+    if(frames <= 0)
+    {
+        file.clear();
+        return false;
+    }
+    for(int channel=0; channel<channels; channel++)
+        columnSources.push_back(QSharedPointer<QGraphChunkedSource<double> >(new QGraphChunkedSource<double>(0.0, 1.0/sampleRate)));
+    dataStart = headerBytes;
+    start(frames*frameBytes, frameBytes);
+    return true;
+}
+
+void QGraphImporter::start(qint64 dataBytes, qint64 alignment)
+{
+    this->alignment = alignment;
+    dataEnd = dataStart+dataBytes;
+    // Binary blocks hold whole frames
+    blockBytes = qMax(blockBytes/alignment, qint64(1))*alignment;
+    blockCount = int((dataBytes+blockBytes-1)/blockBytes);
+    nextBlock = 0;
+    remaining = blockCount;
+    running = blockCount;
+    bytesDone = 0;
+    cancelled.storeRelease(0);
+    if(blockCount == 0)
+    {
+        // Nothing to parse, finished() is still delivered after the caller connected to it
+        QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection, Q_ARG(bool, true));
+        return;
+    }
+    for(int block=0; block<blockCount; block++)
+        QGraphScheduler::instance()->pool()->start(new QGraphImportTask(this, block));
+}
+
+void QGraphImporter::runBlock(int index)
+{
+    Block block;
+    block.rows = 0;
+    qint64 from = dataStart + index*blockBytes;
+    qint64 to = qMin(from+blockBytes, dataEnd);
+    block.bytes = to-from;
+    if(!cancelled.loadAcquire())
+    {
+        if(format == Csv)
+            parseCsv(from, to, block);
+        else
+            parseBinary(from, to, block);
+    }
+    blockDone(index, block);
+}
+
+/*
+  Parses all lines which start in [from, to), the last one may end
+  behind to. The values are stored column after column.
+ */
+void QGraphImporter::parseCsv(qint64 from, qint64 to, Block& block) const
+{
+    const char* data = reinterpret_cast<const char*>(file->constData());
+    const char* line = data+from;
+    const char* end = data+to;
+    const char* fileEnd = data+dataEnd;
+    if(from > dataStart && line[-1] != '\n')
+    {
+        line = static_cast<const char*>(memchr(line, '\n', fileEnd-line));
+        if(!line || line >= end)
+            return;
+        line++;
+    }
+
+    QVector<double> rows;
+    rows.reserve(int(qMin(to-from, qint64(1) << 24)/4));
+    QVector<double> values(columns+1);
+    while(line < end)
+    {
+        if((block.rows & 0xffff) == 0 && cancelled.loadAcquire())
+            return;
+        const char* lineEnd = static_cast<const char*>(memchr(line, '\n', fileEnd-line));
+        if(!lineEnd)
+            lineEnd = fileEnd;
+        if(splitCsvLine(line, lineEnd, values.data()) > 0)
         {
-            painter.drawText(QRectF(src2dstX(xPoints[i])-40, dstRect.y()+5, 80, 20), Qt::AlignCenter, QString::number(xPoints[i]));
+            for(int column=0; column<columns; column++)
+                rows.push_back(values[column]);
+            block.rows++;
         }
+        line = lineEnd+1;
     }
-    if(yNumbersEnabled)
+
+    int sources = columns - (xColumn >= 0 ? 1 : 0);
+    block.values.resize(int(block.rows*sources));
+    if(xColumn >= 0)
+        block.x.resize(int(block.rows));
+    for(qint64 row=0; row<block.rows; row++)
     {
-        for(int i=0; i<yPoints.size(); i++)
+        const double* value = rows.constData() + row*columns;
+        int source = 0;
+        for(int column=0; column<columns; column++)
         {
-            painter.drawText(QRectF(dstRect.x()-sizeYNumbers - 5, src2dstY(yPoints[i])-8, sizeYNumbers, 20), Qt::AlignRight, QString::number(yPoints[i]));
+            if(column == xColumn)
+                block.x[int(row)] = value[column];
+            else
+                block.values[int(source++*block.rows+row)] = value[column];
         }
     }
+}
 
-    // Draw the grid
-    if(grid)
+/*
+  Splits one line into at most columns values, missing or invalid values
+  are NaN. Returns the number of fields, 0 for an empty line.
+ */
+int QGraphImporter::splitCsvLine(const char* line, const char* end, double* values) const
+{
+    if(end > line && end[-1] == '\r')
+        end--;
+    int fields = 0;
+    const char* field = line;
+    if(delimiter == ' ')
     {
-        painter.setPen(QPen(Qt::black, 0, Qt::DotLine));
-        for(int i=0; i<xPoints.size(); i++)
+        while(field < end && fields < columns)
         {
-            painter.drawLine(src2dstX(xPoints[i]), dstRect.y(), src2dstX(xPoints[i]), dstRect.y()+dstRect.height());
+            while(field < end && (*field == ' ' || *field == '\t'))
+                field++;
+            if(field == end)
+                break;
+            const char* fieldEnd = field;
+            while(fieldEnd < end && *fieldEnd != ' ' && *fieldEnd != '\t')
+                fieldEnd++;
+            if(!parseDouble(field, fieldEnd, values[fields]))
+                values[fields] = numeric_limits<double>::quiet_NaN();
+            fields++;
+            field = fieldEnd;
         }
-        for(int i=0; i<yPoints.size(); i++)
+    }
+    else if(field < end)
+    {
+        while(fields < columns)
         {
-            painter.drawLine(dstRect.x(), src2dstY(yPoints[i]), dstRect.x()+dstRect.width(), src2dstY(yPoints[i]));
+            const char* fieldEnd = static_cast<const char*>(memchr(field, delimiter, end-field));
+            if(!fieldEnd)
+                fieldEnd = end;
+            if(!parseDouble(field, fieldEnd, values[fields]))
+                values[fields] = numeric_limits<double>::quiet_NaN();
+            fields++;
+            if(fieldEnd == end)
+                break;
+            field = fieldEnd+1;
         }
-        painter.setPen(QPen(Qt::black, 0, Qt::SolidLine));
     }
+    for(int column=fields; column<columns; column++)
+        values[column] = numeric_limits<double>::quiet_NaN();
+    return fields;
+}
 
-    // Draw the title
-    if(!title.isEmpty() && titleEnabled)
+template<typename T>
+static void importSamples(const uchar* data, qint64 frames, int channels, double* out)
+{
+    for(int channel=0; channel<channels; channel++)
     {
-        QFont oldFont = painter.font();
-        painter.setFont(titleFont);
-        painter.setPen(titlePen);
-        painter.drawText(QRectF(0, 5, graphImage.width(), sizeTitle), Qt::AlignCenter | Qt::TextWordWrap, title);
-        painter.setFont(oldFont);
+        const uchar* sample = data + channel*sizeof(T);
+        for(qint64 frame=0; frame<frames; frame++, sample+=channels*sizeof(T))
+            out[channel*frames+frame] = mappedValue<T>(sample);
     }
+}
 
-    // Draw the undertitle
-    if(!undertitle.isEmpty() && undertitleEnabled)
+void QGraphImporter::parseBinary(qint64 from, qint64 to, Block& block) const
+{
+    qint64 frames = (to-from)/alignment;
+    const uchar* data = file->constData()+from;
+    block.rows = frames;
+    block.values.resize(int(frames*channels));
+    double* out = block.values.data();
+    switch(type)
     {
-        QFont oldFont = painter.font();
-        painter.setFont(undertitleFont);
-        painter.setPen(undertitlePen);
-        painter.drawText(QRectF(0, graphImage.height()-sizeUndertitle, graphImage.width(), sizeUndertitle), Qt::AlignCenter | Qt::TextWordWrap, undertitle);
-        painter.setFont(oldFont);
+    case QGraphMappedSource::Int8: importSamples<qint8>(data, frames, channels, out); break;
+    case QGraphMappedSource::UInt8: importSamples<quint8>(data, frames, channels, out); break;
+    case QGraphMappedSource::Int16: importSamples<qint16>(data, frames, channels, out); break;
+    case QGraphMappedSource::UInt16: importSamples<quint16>(data, frames, channels, out); break;
+    case QGraphMappedSource::Int32: importSamples<qint32>(data, frames, channels, out); break;
+    case QGraphMappedSource::UInt32: importSamples<quint32>(data, frames, channels, out); break;
+    case QGraphMappedSource::Float32: importSamples<float>(data, frames, channels, out); break;
+    case QGraphMappedSource::Float64: importSamples<double>(data, frames, channels, out); break;
     }
+}
 
-    // Draw the y label
-    if(!yLabel.isEmpty() && yLabelEnabled)
+/*
+  Called by the worker threads. Blocks are appended in file order, a
+  block which finishes early waits in pending for its predecessors.
+ */
+void QGraphImporter::blockDone(int index, const Block& block)
+{
+    QMutexLocker locker(&mutex);
+    bool appended = false;
+    if(!cancelled.loadAcquire())
     {
-        QFont oldFont = painter.font();
-        painter.setFont(yLabelFont);
-        painter.setPen(yLabelPen);
-        painter.rotate(-90);
-        painter.drawText(QRectF(-dstRect.y(), leftBorder, -dstRect.height(), sizeYLabel), Qt::AlignCenter | Qt::TextWordWrap, yLabel);
-        painter.rotate(90);
-        painter.setFont(oldFont);
+        pending.insert(index, block);
+        while(pending.contains(nextBlock))
+        {
+            Block next = pending.take(nextBlock);
+            for(int source=0; source<columnSources.size(); source++)
+                columnSources[source]->append(next.x.constData(), next.values.constData()+source*next.rows, next.rows);
+            bytesDone += next.bytes;
+            nextBlock++;
+            appended = true;
+        }
     }
-
-    // Draw the x label
-    if(!xLabel.isEmpty() && xLabelEnabled)
+    bool last = --remaining <= 0;
+    bool completed = nextBlock >= blockCount && !cancelled.loadAcquire();
+    qint64 done = bytesDone;
+    if(last)
     {
-        QFont oldFont = painter.font();
-        painter.setFont(xLabelFont);
-        painter.setPen(xLabelPen);
-        painter.drawText(QRectF(dstRect.x(), graphImage.height()-sizeXLabel - sizeUndertitle - bottomBorder, dstRect.width(), sizeXLabel), Qt::AlignCenter | Qt::TextWordWrap, xLabel);
-        painter.setFont(oldFont);
+        pending.clear();
+        file.clear();
     }
+    locker.unlock();
 
-    // Turn on antializing if required
-    painter.setRenderHint(QPainter::Antialiasing, antializing);
-
-    // Render the graph
-    scene->render(&painter, dstRect, srcRect, Qt::IgnoreAspectRatio);
+    if(appended)
+    {
+        emit progress(done, dataEnd-dataStart);
+        emit dataAvailable();
+    }
+    if(last)
+        emit finished(completed);
 
-    // Turn off antializing
-    painter.setRenderHint(QPainter::Antialiasing, false);
+    // The importer may be deleted as soon as running is 0
+    locker.relock();
+    running--;
+    idle.wakeAll();
+}
 
-    // Draw tracking point
-    if(tracking)
+/*
+  Parses a decimal number in [begin, end), surrounding spaces and quotes
+  are ignored. Numbers with up to 19 digits and a small exponent are
+  converted exactly by one multiplication or division, everything else
+  (long mantissas, inf, nan) falls back to QByteArray::toDouble().
+ */
+bool QGraphImporter::parseDouble(const char* begin, const char* end, double& value)
+{
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    while(begin < end && (*begin == ' ' || *begin == '"'))
+        begin++;
+    while(end > begin && (end[-1] == ' ' || end[-1] == '"'))
+        end--;
+    if(begin == end)
+        return false;
+
+    const char* p = begin;
+    bool negative = *p == '-';
+    if(*p == '-' || *p == '+')
+        p++;
+    quint64 mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    for(; p < end && *p >= '0' && *p <= '9'; p++, any = true)
     {
-        int tracX = src2dstX(lines[trackingSet].xData[trackingIndex]);
-        int tracY = src2dstY(lines[trackingSet].yData[trackingIndex]);
-        painter.setPen(Qt::black);
-        //painter.drawRect(tracX-7, tracY-7, 15, 15);
-        painter.drawLine(tracX+1, tracY, tracX+10, tracY);
-        painter.drawLine(tracX-1, tracY, tracX-10, tracY);
-        painter.drawLine(tracX, tracY+1, tracX, tracY+10);
-        painter.drawLine(tracX, tracY-1, tracX, tracY-10);
-
-        double posX = lines[trackingSet].xData[trackingIndex];
-        double posY = lines[trackingSet].yData[trackingIndex];
-        painter.drawText(QRect(dstRect.x()+20, dstRect.y()+dstRect.height()+20, 200, 20), tr("X: ")+QString::number(posX));
-        painter.drawText(QRect(dstRect.x()+20, dstRect.y()+dstRect.height()+40, 200, 20), tr("Y: ")+QString::number(posY));
+        if(digits < 19)
+        {
+            mantissa = mantissa*10 + (*p-'0');
+            if(mantissa)
+                digits++;
+        }
+        else
+            exponent++;
+    }
+    if(p < end && *p == '.')
+    {
+        for(p++; p < end && *p >= '0' && *p <= '9'; p++, any = true)
+        {
+            if(digits < 19)
+            {
+                mantissa = mantissa*10 + (*p-'0');
+                if(mantissa)
+                    digits++;
+                exponent--;
+            }
+        }
+    }
+    if(any && p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        bool negativeExponent = p < end && *p == '-';
+        if(p < end && (*p == '-' || *p == '+'))
+            p++;
+        int e = 0;
+        bool exponentDigits = false;
+        for(; p < end && *p >= '0' && *p <= '9'; p++, exponentDigits = true)
+            e = qMin(e*10 + (*p-'0'), 100000);
+        if(!exponentDigits)
+            any = false;
+        exponent += negativeExponent ? -e : e;
     }
 
-    // Draw zoom rect
-    if(zooming)
+    if(any && p == end && mantissa <= (quint64(1) << 53) && exponent >= -22 && exponent <= 22)
     {
-        painter.drawRect(zoomRect);
+        double result = double(mantissa);
+        result = exponent < 0 ? result/powers[-exponent] : result*powers[exponent];
+        value = negative ? -result : result;
+        return true;
     }
 
-    // Finish
-    painter.end();
+    bool ok = false;
+    value = QByteArray::fromRawData(begin, int(end-begin)).toDouble(&ok);
+    return ok;
+}
+
+QGraphTrigger::QGraphTrigger(double dx, QObject* parent) :
+    QObject(parent),
+    mode(Edge),
+    slope(Rising),
+    level(0.0),
+    hysteresis(0.0),
+    preSamples(100),
+    postSamples(900),
+    holdoff(0),
+    dx(dx),
+    state(Disarmed),
+    windowPre(0),
+    holdoffLeft(0),
+    captures(0),
+    lastCapture(new QGraphSampleSource<double>(0.0, dx, QVector<double>())),
+    notified(0)
+{
+}
+
+/**
+  \fn void QGraphTrigger::setMode(Mode mode, Slope slope)
+  Edge mode fires once per crossing of the level in the direction of
+  the slope, Level mode fires whenever the signal is at or above
+  (Rising) or below (Falling) the level. Restarts the search.
+ **/
+void QGraphTrigger::setMode(Mode mode, Slope slope)
+{
+    QMutexLocker locker(&mutex);
+    this->mode = mode;
+    this->slope = slope;
+    state = Disarmed;
+}
+
+/**
+  \fn void QGraphTrigger::setLevel(double level, double hysteresis)
+  An edge trigger is only armed after the signal was more than
+  hysteresis below (Rising) or above (Falling) the level, so noise on a
+  slow edge does not fire it repeatedly.
+ **/
+void QGraphTrigger::setLevel(double level, double hysteresis)
+{
+    QMutexLocker locker(&mutex);
+    this->level = level;
+    this->hysteresis = qAbs(hysteresis);
+    state = Disarmed;
+}
+
+/**
+  \fn void QGraphTrigger::setWindow(int preSamples, int postSamples)
+  Sets the number of samples captured before the trigger sample and
+  from the trigger sample on.
+ **/
+void QGraphTrigger::setWindow(int preSamples, int postSamples)
+{
+    QMutexLocker locker(&mutex);
+    this->preSamples = qMax(preSamples, 0);
+    this->postSamples = qMax(postSamples, 1);
+    if(history.size() > this->preSamples)
+        history.remove(0, history.size()-this->preSamples);
+    state = Disarmed;
+}
+
+/**
+  \fn void QGraphTrigger::setHoldoff(qint64 samples)
+  Ignores the given number of samples after the end of each capture
+  before the trigger is armed again.
+ **/
+void QGraphTrigger::setHoldoff(qint64 samples)
+{
+    QMutexLocker locker(&mutex);
+    holdoff = qMax(samples, qint64(0));
+}
+
+/**
+  \fn void QGraphTrigger::reset()
+  Drops the pre trigger history and a capture in progress, e.g. after a
+  gap in the input.
+ **/
+void QGraphTrigger::reset()
+{
+    QMutexLocker locker(&mutex);
+    history.clear();
+    window.clear();
+    state = Disarmed;
 }
 
-void QGraph::dataMinMax()
+/**
+  \fn void QGraphTrigger::feed(const double* data, qint64 count)
+  Processes the next count samples of the input. May be called from any
+  thread, but from one thread at a time.
+ **/
+void QGraphTrigger::feed(const double* data, qint64 count)
 {
-    // Make sure an area is defined when no data is given
-    if(!limitedX)
-    {
-        dataMinX=0.0;
-        dataMaxX=1.0;
-    }
-    if(!limitedY)
-    {
-        dataMinY=0.0;
-        dataMaxY=1.0;
-    }
-    bool gotElement = false;
-    for(int set=0; set<lines.size(); set++)
+    bool ready = false;
     {
-        if(!limitedX && lines[set].xData.size())
-        {
-            dataMinX = lines[set].xData[0];
-            dataMaxX = dataMinX;
-            for(int i=1; i<lines[set].xData.size(); i++)
-            {
-                if(lines[set].xData[i]<dataMinX)
-                    dataMinX = lines[set].xData[i];
-                if(lines[set].xData[i]>dataMaxX)
-                    dataMaxX = lines[set].xData[i];
-            }
-        }
-        if(!limitedY && lines[set].yData.size())
+        QMutexLocker locker(&mutex);
+        qint64 i = 0;
+        while(i < count)
         {
-            for(int i=0; i<lines[set].yData.size(); i++)
+            const double* block = data+i;
+            qint64 n = count-i;
+            qint64 j = n;
+            switch(state)
             {
-                if(limitedX && (lines[set].xData[i]<dataMinX || lines[set].xData[i]>dataMaxX))
-                    continue;
-                if(!gotElement)
+            case Disarmed:
+                if(mode == Level)
+                    j = 0;
+                else if(slope == Rising)
+                    j = QGraphKernels::findBelow(block, n, level-hysteresis);
+                else
+                    j = QGraphKernels::findAbove(block, n, level+hysteresis);
+                if(j < n)
+                    state = Armed;
+                break;
+            case Armed:
+                j = slope == Rising ? QGraphKernels::findAbove(block, n, level) : QGraphKernels::findBelow(block, n, level);
+                if(j < n)
                 {
-                    dataMinY = lines[set].yData[i];
-                    dataMaxY = lines[set].yData[i];
-                    gotElement = true;
+                    startCapture(data, i+j);
+                    state = Capturing;
                 }
-                else
+                break;
+            case Capturing:
+            {
+                j = qMin(n, qint64(windowPre+postSamples-window.size()));
+                int size = window.size();
+                window.resize(size+int(j));
+                memcpy(window.data()+size, block, j*sizeof(double));
+                if(window.size() == windowPre+postSamples)
                 {
-                    if(!gotElement || lines[set].yData[i]<dataMinY)
-                        dataMinY = lines[set].yData[i];
-                    if(!gotElement || lines[set].yData[i]>dataMaxY)
-                        dataMaxY = lines[set].yData[i];
+                    lastCapture = QSharedPointer<QGraphDataSource>(new QGraphSampleSource<double>(-windowPre*dx, dx, window));
+                    window = QVector<double>();
+                    captures++;
+                    ready = true;
+                    holdoffLeft = holdoff;
+                    state = Holding;
                 }
             }
+                break;
+            case Holding:
+                j = qMin(n, holdoffLeft);
+                holdoffLeft -= j;
+                if(holdoffLeft == 0)
+                    state = Disarmed;
+                break;
+            }
+            i += j;
         }
+        keepHistory(data, count);
     }
-    srcRect = QRectF(dataMinX, dataMinY, dataMaxX-dataMinX, dataMaxY-dataMinY);
+    if(ready && notified.testAndSetOrdered(0, 1))
+        emit captureReady();
 }
 
-void QGraph::xyPoints()
+/*
+  Starts the window with up to preSamples samples before data[at], taken
+  from the history and from the current block.
+ */
+void QGraphTrigger::startCapture(const double* data, qint64 at)
 {
-    // Calculate the points
-    calcPoints(xPoints, srcRect.x(), srcRect.x()+srcRect.width());
-    calcPoints(yPoints, srcRect.y(), srcRect.y()+srcRect.height());
+    int fromBlock = int(qMin(at, qint64(preSamples)));
+    int fromHistory = qMin(preSamples-fromBlock, history.size());
+    windowPre = fromHistory+fromBlock;
+    window.resize(windowPre);
+    window.reserve(windowPre+postSamples);
+    memcpy(window.data(), history.constData()+history.size()-fromHistory, fromHistory*sizeof(double));
+    memcpy(window.data()+fromHistory, data+at-fromBlock, fromBlock*sizeof(double));
 }
 
-void QGraph::insertLines()
+/*
+  Keeps the last preSamples samples of the input for the next trigger.
+ */
+void QGraphTrigger::keepHistory(const double* data, qint64 count)
 {
-    textSize();
-    scene->clear();
-    for(int set=0; set<lines.size(); set++)
+    if(count >= preSamples)
     {
-        switch(lines[set].style)
-        {
-        case Line:
-        {
-            QPainterPath path(QPointF(lines[set].xData[0], lines[set].yData[0]));
-            for(int i=1; i<lines[set].xData.size(); i++)
-                path.lineTo(lines[set].xData[i], lines[set].yData[i]);
-            scene->addPath(path, lines[set].pen);
-        }
-            break;
-        case Bar:
-        {
-            for(int i=0; i<lines[set].xData.size(); i++)
-            {
-                double width;
-                if(i==0)
-                    width = lines[set].xData[0]-lines[set].xData[1];
-                else
-                    width = lines[set].xData[i]-lines[set].xData[i-1];
-                width *= lines[set].barWidth;
-                scene->addRect(lines[set].xData[i]-width/2, lines[set].yData[i], width, -lines[set].yData[i], lines[set].pen, lines[set].brush);
-            }
-        }
-            break;
-        case Stem:
-        {
-            for(int i=0; i<lines[set].xData.size(); i++)
-            {
-                scene->addLine(lines[set].xData[i], lines[set].yData[i], lines[set].xData[i], 0, lines[set].pen);
-                scene->addEllipse(lines[set].xData[i]-dst2srcW(9)/2, lines[set].yData[i]-dst2srcH(9)/2, dst2srcW(9), dst2srcH(9), lines[set].pen);
-            }
-        }
-            break;
-        }
-
+        history.resize(preSamples);
+        memcpy(history.data(), data+count-preSamples, preSamples*sizeof(double));
+        return;
     }
-    xyPoints();
-    repaint();
+    int keep = qMin(history.size(), preSamples-int(count));
+    history.remove(0, history.size()-keep);
+    history.resize(keep+int(count));
+    memcpy(history.data()+keep, data, count*sizeof(double));
 }
 
-// FIXME: Not working for min == max!!!
-void QGraph::calcPoints(QVector<double>& points, double min, double max)
+/**
+  \fn QSharedPointer<QGraphDataSource> QGraphTrigger::capture()
+  Returns the latest complete capture, an empty source before the first
+  trigger, and allows the next captureReady() signal.
+ **/
+QSharedPointer<QGraphDataSource> QGraphTrigger::capture()
 {
-    points.clear();
-    if(max-min == 0)
-        return;
-    double dxIdeal = (max-min)/4.0;
-    double dx = exp(floor(log(dxIdeal)/log(10.0))*log(10.0));
-    double diff = log(dxIdeal)/log(10.0)-floor(log(dxIdeal)/log(10.0));
-    if(diff > 0.69897)
-        dx *= 5;
-    else if(diff > 0.30103)
-        dx *= 2;
-
-    double start = ceil(min/dx);
-    double end = floor(max/dx);
-    for(double i = start; i<=end; i++)
-        points.push_back(dx*i);
+    QMutexLocker locker(&mutex);
+    notified.storeRelease(0);
+    return lastCapture;
 }
 
-void QGraph::checkZoomLimit()
+qint64 QGraphTrigger::captureCount() const
 {
-    if(zoomLimit)
-    {
-        if(limitedX && srcRect.x()<dataMinX)
-            srcRect.setX(dataMinX);
-        if(limitedX && srcRect.x()+srcRect.width()>dataMaxX)
-            srcRect.setWidth(dataMaxX-srcRect.x());
-        if(limitedY && srcRect.y()<dataMinY)
-            srcRect.setY(dataMinY);
-        if(limitedY && srcRect.y()+srcRect.height()>dataMaxY)
-            srcRect.setHeight(dataMaxY-srcRect.y());
-    }
+    QMutexLocker locker(&mutex);
+    return captures;
 }
 
-void QGraph::mousePressEvent(QMouseEvent* event)
+/*
+  Radix 2 FFT of real input. The n real samples are transformed as n/2
+  complex ones and split afterwards. Real and imaginary parts are kept
+  in separate arrays and the twiddles of each stage are contiguous, so
+  the butterflies of a stage run as plain vectorizable loops.
+ */
+class QGraphFft
 {
-    if(event->button() == Qt::LeftButton)
+public:
+    explicit QGraphFft(int n) :
+        n(n),
+        m(n/2),
+        reversed(m),
+        re(m),
+        im(m),
+        splitRe(m+1),
+        splitIm(m+1)
     {
-        zooming = true;
-        zoomRect = QRect(event->x(), event->y(), 0, 0);
-    }
-    else if(event->button() == Qt::RightButton)
-    {
-        if(rightClickMenu)
+        int bits = 0;
+        while((1 << bits) < m)
+            bits++;
+        for(int i=0; i<m; i++)
         {
-            menu.popup(QCursor::pos());
+            int r = 0;
+            for(int b=0; b<bits; b++)
+                r |= ((i >> b) & 1) << (bits-1-b);
+            reversed[i] = r;
+        }
+        for(int half=1; half<m; half*=2)
+        {
+            for(int j=0; j<half; j++)
+            {
+                twiddleRe.push_back(cos(M_PI*j/half));
+                twiddleIm.push_back(-sin(M_PI*j/half));
+            }
+        }
+        for(int k=0; k<=m; k++)
+        {
+            splitRe[k] = cos(2.0*M_PI*k/n);
+            splitIm[k] = -sin(2.0*M_PI*k/n);
         }
     }
-    else if(event->button() == Qt::MiddleButton)
-    {
-        panning = true;
-        panStart = QCursor::pos();
-        panCurrent = panStart;
-    }
-}
-
-void QGraph::mouseMoveEvent(QMouseEvent* event)
-{
-    if(zooming)
-    {
-        zoomRect.setWidth(event->x()-zoomRect.x());
-        zoomRect.setHeight(event->y()-zoomRect.y());
-        repaint();
-        update();
-    }
-    if(panning)
-    {
-        updatePanning();
-    }
-}
 
-void QGraph::mouseReleaseEvent(QMouseEvent* event)
-{
-    if(event->button() == Qt::LeftButton && zooming)
+    // power[k] = |X[k]|^2 for k = 0..n/2
+    void power(const double* input, double* power)
     {
-        zoomRect.setWidth(event->x()-zoomRect.x());
-        zoomRect.setHeight(event->y()-zoomRect.y());
-        zooming = false;
-        int zoomWidth = zoomRect.width();
-        int zoomX = zoomRect.x();
-        int zoomHeight = zoomRect.height();
-        int zoomY = zoomRect.y();
-        if(zoomWidth==0 && zoomHeight==0)
+        double* r = re.data();
+        double* i = im.data();
+        for(int k=0; k<m; k++)
         {
-            // this is a normal click, so find nearest data and highlight it
-            findGraphAt(QPoint(zoomX, zoomY));
+            r[reversed[k]] = input[2*k];
+            i[reversed[k]] = input[2*k+1];
         }
-        else if(zoomWidth==0 || zoomHeight==0)
-            return;
-        else
+        int offset = 0;
+        for(int half=1; half<m; half*=2)
         {
-            if(zoomWidth<0)
-            {
-                zoomWidth = -zoomWidth;
-                zoomX = zoomX-zoomWidth;
-            }
-            if(zoomHeight>0)
+            const double* wr = twiddleRe.constData()+offset;
+            const double* wi = twiddleIm.constData()+offset;
+            for(int start=0; start<m; start+=2*half)
             {
-                zoomHeight = -zoomHeight;
-                zoomY = zoomY-zoomHeight;
+                double* ar = r+start;
+                double* ai = i+start;
+                double* br = ar+half;
+                double* bi = ai+half;
+                for(int j=0; j<half; j++)
+                {
+                    double tr = br[j]*wr[j] - bi[j]*wi[j];
+                    double ti = br[j]*wi[j] + bi[j]*wr[j];
+                    br[j] = ar[j]-tr;
+                    bi[j] = ai[j]-ti;
+                    ar[j] += tr;
+                    ai[j] += ti;
+                }
             }
-            srcRect = QRectF(dst2srcX(zoomX), dst2srcY(zoomY), dst2srcW(zoomWidth), dst2srcH(zoomHeight));
-            checkZoomLimit();
-
-            insertLines();
-            update();
+            offset += half;
+        }
+        for(int k=0; k<=m; k++)
+        {
+            int a = k < m ? k : 0;
+            int b = k > 0 ? m-k : 0;
+            double evenRe = 0.5*(r[a] + r[b]);
+            double evenIm = 0.5*(i[a] - i[b]);
+            double oddRe = 0.5*(i[a] + i[b]);
+            double oddIm = -0.5*(r[a] - r[b]);
+            double xr = evenRe + splitRe[k]*oddRe - splitIm[k]*oddIm;
+            double xi = evenIm + splitRe[k]*oddIm + splitIm[k]*oddRe;
+            power[k] = xr*xr + xi*xi;
         }
     }
-    if(event->button() == Qt::MiddleButton && panning)
+
+private:
+    int n;
+    int m;
+    QVector<int> reversed;
+    QVector<double> twiddleRe;
+    QVector<double> twiddleIm;
+    QVector<double> re;
+    QVector<double> im;
+    QVector<double> splitRe;
+    QVector<double> splitIm;
+};
+
+class QGraphSpectrumTask : public QRunnable
+{
+public:
+    explicit QGraphSpectrumTask(QGraphSpectrum* spectrum) :
+        spectrum(spectrum)
     {
-        updatePanning();
-        panning = false;
     }
+
+    void run()
+    {
+        spectrum->run();
+    }
+
+private:
+    QGraphSpectrum* spectrum;
+};
+
+QGraphSpectrum::QGraphSpectrum(QSharedPointer<QGraphDataSource> source, int size, Window window, int averages, QObject* parent) :
+    QObject(parent),
+    source(source),
+    fftSize(16),
+    window(window),
+    averages(qMax(averages, 1)),
+    scale(Decibel),
+    timerId(0),
+    lastSize(-1),
+    running(false),
+    pending(false),
+    generation(0),
+    result(new QGraphSampleSource<double>(0.0, 1.0, QVector<double>())),
+    notified(0),
+    snapshotFrom(0),
+    snapshotSize(0),
+    snapshotDx(1.0)
+{
+    while(fftSize < size && fftSize < (1 << 24))
+        fftSize *= 2;
+    setUpdateInterval(100);
 }
 
-void QGraph::mouseDoubleClickEvent(QMouseEvent*)
+QGraphSpectrum::~QGraphSpectrum()
 {
-    srcRect = QRectF(dataMinX, dataMinY, dataMaxX-dataMinX, dataMaxY-dataMinY);
-    insertLines();
-    update();
+    generation.fetchAndAddOrdered(1);
+    waitForFinished();
 }
 
-void QGraph::wheelEvent(QWheelEvent* event)
+/**
+  \fn void QGraphSpectrum::setSource(QSharedPointer<QGraphDataSource> source)
+  Replaces the analysed trace and drops all cached segments.
+ **/
+void QGraphSpectrum::setSource(QSharedPointer<QGraphDataSource> source)
 {
-    int delta = event->delta();
-    double factor = (double)delta/240;
-    if(factor<0)
-        factor = -1/factor;
-    double zoomW = srcRect.width();
-    double zoomH = srcRect.height();
-    double zoomX = srcRect.x();
-    double zoomY = srcRect.y();
-    double zoomToX = dst2srcX(event->x());
-    double zoomToY = dst2srcY(event->y());
-    zoomX = zoomToX + (zoomX-zoomToX)*factor;
-    zoomY = zoomToY + (zoomY-zoomToY)*factor;
-    zoomW *= factor;
-    zoomH *= factor;
-    if(zoomW == 0.0 || zoomH == 0.0)
-        return;
-    srcRect = QRectF(zoomX, zoomY, zoomW, zoomH);
+    QMutexLocker locker(&mutex);
+    this->source = source;
+    configure();
+}
 
-    checkZoomLimit();
+/**
+  \fn void QGraphSpectrum::setSize(int size)
+  Sets the number of samples per segment, rounded up to a power of 2 of
+  at least 16. The spectrum has size/2+1 bins.
+ **/
+void QGraphSpectrum::setSize(int size)
+{
+    QMutexLocker locker(&mutex);
+    fftSize = 16;
+    while(fftSize < size && fftSize < (1 << 24))
+        fftSize *= 2;
+    configure();
+}
 
-    insertLines();
-    update();
+void QGraphSpectrum::setWindow(Window window)
+{
+    QMutexLocker locker(&mutex);
+    this->window = window;
+    configure();
 }
 
-void QGraph::resizeEvent(QResizeEvent* event)
+/**
+  \fn void QGraphSpectrum::setAverages(int averages)
+  Averages the power of the latest averages segments, which overlap by
+  half. 1 transforms only the latest segment.
+ **/
+void QGraphSpectrum::setAverages(int averages)
 {
-    graphImage = QImage(event->size().width(), event->size().height(), QImage::Format_ARGB32);
-    calcDstRect();
-    insertLines();
+    QMutexLocker locker(&mutex);
+    this->averages = qMax(averages, 1);
+    configure();
 }
 
-void QGraph::paintEvent(QPaintEvent*)
+/**
+  \fn void QGraphSpectrum::setScale(Scale scale)
+  Selects linear amplitude or power in dB. A sine of amplitude A has a
+  peak of A, or 20*log10(A) dB.
+ **/
+void QGraphSpectrum::setScale(Scale scale)
 {
-    QPainter painter(this);
-    painter.drawImage(0, 0, graphImage);
-    painter.drawRect(0, 0, width()-1, height()-1);
-    painter.end();
-    //cout<<"Paint event"<<endl;
+    QMutexLocker locker(&mutex);
+    this->scale = scale;
+    configure();
 }
 
-void QGraph::keyPressEvent(QKeyEvent* event)
+/**
+  \fn void QGraphSpectrum::setUpdateInterval(int ms)
+  Polls the size of the source in this interval and recomputes when a
+  new segment is complete. 0 disables polling, then update() has to be
+  called when the source changed.
+ **/
+void QGraphSpectrum::setUpdateInterval(int ms)
 {
-    int dx = 0;
-    if(event->key() == Qt::Key_Left)
-        dx = -1;
-    else if(event->key() == Qt::Key_Right)
-        dx = 1;
-    else if(event->key() == Qt::Key_Escape)
-        tracking = false;
-    else
-    {
-        QWidget::keyPressEvent(event);
-        return;
-    }
-    if(trackingIndex + dx < 0 || trackingIndex + dx >= lines[trackingSet].xData.size())
-        return;
-    trackingIndex += dx;
-    repaint();
-    update();
+    if(timerId)
+        killTimer(timerId);
+    timerId = ms > 0 ? startTimer(ms) : 0;
 }
 
-int QGraph::src2dstX(double srcX)
+/*
+  Drops the cache and results of computations still running, the mutex
+  has to be locked.
+ */
+void QGraphSpectrum::configure()
 {
-    return qRound((srcX-srcRect.x())/srcRect.width()*dstRect.width()+dstRect.x());
+    generation.fetchAndAddOrdered(1);
+    cache.clear();
+    lastSize = -1;
 }
 
-int QGraph::src2dstY(double srcY)
+void QGraphSpectrum::timerEvent(QTimerEvent*)
 {
-    return qRound((srcY-srcRect.y())/srcRect.height()*dstRect.height()+dstRect.y());
+    update();
 }
 
-void QGraph::setGrid(bool grid)
+/**
+  \fn void QGraphSpectrum::update()
+  Schedules a computation if the source has new samples. Returns at
+  once, spectrumReady() is emitted when the result is available.
+ **/
+void QGraphSpectrum::update()
 {
-    this->grid = grid;
-    menuGrid->setChecked(grid);
-    if(autoRefresh)
-    {
-        repaint();
-        update();
+    QMutexLocker locker(&mutex);
+    if(!source || source->size() == lastSize)
+        return;
+    lastSize = source->size();
+    if(!source->threadSafe())
+        takeSnapshot();
+    if(running)
+    {
+        pending = true;
+        return;
     }
+    running = true;
+    QGraphScheduler::instance()->pool()->start(new QGraphSpectrumTask(this));
 }
 
-double QGraph::dst2srcX(int dstX)
+/*
+  Copies the samples of the current segments of a source that must not
+  be read from the pool. The mutex has to be locked.
+ */
+void QGraphSpectrum::takeSnapshot()
 {
-    return (dstX-dstRect.x())*srcRect.width()/dstRect.width()+srcRect.x();
+    QVector<qint64> starts;
+    segments(lastSize, starts);
+    snapshotFrom = starts.isEmpty() ? 0 : starts.first();
+    snapshotSize = lastSize;
+    snapshot.resize(int(snapshotSize-snapshotFrom));
+    source->readY(snapshotFrom, snapshot.size(), snapshot.data());
+    double x0;
+    if(!source->uniformX(x0, snapshotDx))
+        snapshotDx = 1.0;
 }
 
-double QGraph::dst2srcY(int dstY)
+/**
+  \fn QSharedPointer<QGraphDataSource> QGraphSpectrum::spectrum()
+  Returns the latest result, an empty source before the first one, and
+  allows the next spectrumReady() signal.
+ **/
+QSharedPointer<QGraphDataSource> QGraphSpectrum::spectrum()
 {
-    return (dstY-dstRect.y())*srcRect.height()/dstRect.height()+srcRect.y();
+    QMutexLocker locker(&mutex);
+    notified.storeRelease(0);
+    return result;
 }
 
-double QGraph::dst2srcW(int dstW)
+bool QGraphSpectrum::isRunning() const
 {
-    return dstW*srcRect.width()/dstRect.width();
+    QMutexLocker locker(&mutex);
+    return running;
 }
 
-double QGraph::dst2srcH(int dstH)
+void QGraphSpectrum::waitForFinished()
 {
-    return dstH*srcRect.height()/dstRect.height();
+    QMutexLocker locker(&mutex);
+    while(running)
+        idle.wait(&mutex);
 }
 
-void QGraph::textSize()
+/*
+  Start indices of the segments to average for a source of the given
+  size. They are aligned to the hop, so they stay valid while the source
+  grows. A source shorter than one segment gives one zero padded
+  segment at 0.
+ */
+void QGraphSpectrum::segments(qint64 size, QVector<qint64>& starts) const
 {
-    sizeYNumbers = 0;
-    sizeXNumbers = 0;
-    sizeYLabel = 0;
-    sizeXLabel = 0;
-    sizeUndertitle = 0;
-    sizeTitle = 0;
+    starts.clear();
+    if(size <= 0)
+        return;
+    if(size < fftSize)
+    {
+        starts.push_back(0);
+        return;
+    }
+    qint64 hop = averages > 1 ? fftSize/2 : fftSize;
+    qint64 last = (size-fftSize)/hop*hop;
+    for(qint64 start=qMax(last-(averages-1)*hop, qint64(0)); start<=last; start+=hop)
+        starts.push_back(start);
+}
 
-    QFontMetrics fmAxis(axisLabelFont);
-    if(yNumbersEnabled)
+void QGraphSpectrum::run()
+{
+    QMutexLocker locker(&mutex);
+    do
     {
-        for(int i=0; i<yPoints.size(); i++)
+        pending = false;
+        int run = generation.loadAcquire();
+        QSharedPointer<QGraphDataSource> source = this->source;
+        int n = fftSize;
+        Window window = this->window;
+        Scale scale = this->scale;
+        bool copied = source && !source->threadSafe();
+        QVector<double> snapshot = this->snapshot;
+        qint64 snapshotFrom = this->snapshotFrom;
+        double snapshotDx = this->snapshotDx;
+        qint64 size = copied ? snapshotSize : source ? source->size() : 0;
+        QVector<qint64> starts;
+        segments(size, starts);
+        QVector<qint64> missing;
+        for(int s=0; s<starts.size(); s++)
+            if(!cache.contains(starts[s]) || size < n)
+                missing.push_back(starts[s]);
+        locker.unlock();
+
+        QVector<double> coefficients(n);
+        double windowSum = 0.0;
+        for(int i=0; i<n; i++)
+        {
+            double phase = 2.0*M_PI*i/n;
+            switch(window)
+            {
+            case Rectangular: coefficients[i] = 1.0; break;
+            case Hann: coefficients[i] = 0.5 - 0.5*cos(phase); break;
+            case Hamming: coefficients[i] = 0.54 - 0.46*cos(phase); break;
+            case Blackman: coefficients[i] = 0.42 - 0.5*cos(phase) + 0.08*cos(2.0*phase); break;
+            }
+            windowSum += coefficients[i];
+        }
+        QGraphFft fft(n);
+        QVector<double> samples(n);
+        QVector< QVector<double> > computed(missing.size());
+        for(int s=0; s<missing.size() && generation.loadAcquire() == run; s++)
         {
-            if(fmAxis.width(QString::number(yPoints[i])) + 10 > sizeYNumbers)
-                sizeYNumbers = fmAxis.width(QString::number(yPoints[i])) + 10;
+            qint64 count = qMin(qint64(n), size-missing[s]);
+            samples.fill(0.0);
+            if(copied)
+                memcpy(samples.data(), snapshot.constData()+(missing[s]-snapshotFrom), count*sizeof(double));
+            else
+                source->readY(missing[s], count, samples.data());
+            for(int i=0; i<n; i++)
+                samples[i] *= coefficients[i];
+            computed[s].resize(n/2+1);
+            fft.power(samples.constData(), computed[s].data());
+            // One sided amplitude, a sine of amplitude A gives A
+            for(int k=0; k<=n/2; k++)
+                computed[s][k] *= (k == 0 || k == n/2 ? 1.0 : 4.0)/(windowSum*windowSum);
         }
-    }
 
-    if(xNumbersEnabled)
-        sizeXNumbers = fmAxis.height() + 10;
-
-    if(title.isEmpty() || !titleEnabled)
-        sizeTitle = 0;
-    else
-    {
-        QFontMetrics fmTitle(titleFont);
-        sizeTitle = fmTitle.boundingRect(0, 0, graphImage.width(), 500, Qt::AlignCenter | Qt::TextWordWrap, title).height() + 10;
+        locker.relock();
+        if(generation.loadAcquire() != run || starts.isEmpty())
+            continue;
+        for(int s=0; s<missing.size(); s++)
+            cache.insert(missing[s], computed[s]);
+        QVector<double> power(n/2+1, 0.0);
+        for(int s=0; s<starts.size(); s++)
+        {
+            const QVector<double>& segment = cache[starts[s]];
+            for(int k=0; k<=n/2; k++)
+                power[k] += segment[k];
+        }
+        for(int k=0; k<=n/2; k++)
+        {
+            power[k] /= starts.size();
+            power[k] = scale == Decibel ? 10.0*log10(qMax(power[k], 1e-30)) : sqrt(power[k]);
+        }
+        QHash<qint64, QVector<double> >::iterator it = cache.begin();
+        while(it != cache.end())
+        {
+            if(starts.contains(it.key()) && size >= n)
+                ++it;
+            else
+                it = cache.erase(it);
+        }
+        double x0, dx = snapshotDx;
+        if(!copied && !source->uniformX(x0, dx))
+            dx = 1.0;
+        result = QSharedPointer<QGraphDataSource>(new QGraphSampleSource<double>(0.0, 1.0/(n*dx), power));
+        if(notified.testAndSetOrdered(0, 1))
+        {
+            locker.unlock();
+            emit spectrumReady();
+            locker.relock();
+        }
     }
+    while(pending);
+    running = false;
+    idle.wakeAll();
+}
 
-    if(undertitle.isEmpty() || !undertitleEnabled)
-        sizeUndertitle = 0;
-    else
-    {
-        QFontMetrics fmundertitle(undertitleFont);
-        sizeUndertitle = fmundertitle.boundingRect(0, 0, graphImage.width(), 500, Qt::AlignCenter | Qt::TextWordWrap, undertitle).height() + 10;
-    }
+QGraphScheduler::QGraphScheduler() :
+    frameBudget(12),
+    frameInterval(16),
+    timerId(0)
+{
+    qRegisterMetaType<QGraph*>("QGraph*");
+}
 
-    if(xLabel.isEmpty() || !xLabelEnabled)
-        sizeXLabel = 0;
-    else
-    {
-        QFontMetrics fmTitle(xLabelFont);
-        sizeXLabel = fmTitle.boundingRect(0, 0, graphImage.width(), 500, Qt::AlignCenter | Qt::TextWordWrap, xLabel).height() + 10;
-    }
+/**
+  \fn QGraphScheduler* QGraphScheduler::instance()
+  Returns the scheduler shared by all QGraph widgets of the process.
+ **/
+QGraphScheduler* QGraphScheduler::instance()
+{
+    static QGraphScheduler scheduler;
+    return &scheduler;
+}
 
-    // TODO: sizeUndertitle missing!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+/**
+  \fn void QGraphScheduler::setFrameBudget(int ms)
+  Sets the time in milliseconds that queued renders may take per frame.
+  At least one widget is rendered per frame, so a single widget that is
+  slower than the budget is not starved.
+ **/
+void QGraphScheduler::setFrameBudget(int ms)
+{
+    frameBudget = qMax(ms, 1);
+}
 
-    // The current dstRect needs to be calculated in order to use it for the y axis
-    calcDstRect();
+/**
+  \fn void QGraphScheduler::setFrameInterval(int ms)
+  Sets the time in milliseconds between two frames when the queued work
+  did not fit into one frame.
+ **/
+void QGraphScheduler::setFrameInterval(int ms)
+{
+    frameInterval = qMax(ms, 0);
+}
 
-    if(yLabel.isEmpty() || !yLabelEnabled)
-        sizeYLabel = 0;
-    else
-    {
-        QFontMetrics fmTitle(yLabelFont);
-        sizeYLabel = fmTitle.boundingRect(0, 0, -dstRect.height(), 500, Qt::AlignCenter | Qt::TextWordWrap, yLabel).height() + 10;
-    }
+/**
+  \fn void QGraphScheduler::request(QGraph* graph, Work work)
+  Queues work for a graph. Requests for the same graph are merged into
+  the larger one until it is rendered.
+ **/
+void QGraphScheduler::request(QGraph* graph, Work work)
+{
+    if(work == NoWork || !graphs.contains(graph))
+        return;
+    Work& queued = pending[graph];
+    queued = qMax(queued, work);
+    wake(0);
+}
 
-    // calculate the final dstRect
-    calcDstRect();
+void QGraphScheduler::redraw(QGraph* graph)
+{
+    request(graph, Redraw);
 }
 
-void QGraph::calcDstRect()
+/*
+  Called by a graph that is painted. A suspended request becomes
+  eligible again.
+ */
+void QGraphScheduler::exposed(QGraph* graph)
 {
-    /*int xSpace = sizeYLabel + sizeYNumbers + 50;
-    int ySpace = sizeXLabel + sizeXNumbers + sizeTitle + sizeUndertitle + 35;
-    dstRect = QRect(sizeYLabel + sizeYNumbers + 15, graphImage.height() - (sizeXNumbers + sizeXLabel + sizeUndertitle + 20), graphImage.width()-xSpace, -(graphImage.height() - ySpace));*/
+    if(pending.contains(graph))
+        wake(0);
+}
 
-    int left = sizeYLabel + sizeYNumbers + leftBorder;
-    int top = sizeTitle + topBorder;
-    int right = rightBorder;
-    int bottom = sizeXNumbers + sizeXLabel + sizeUndertitle + bottomBorder;
-    int w = graphImage.width();
-    int h = graphImage.height();
+void QGraphScheduler::registerGraph(QGraph* graph)
+{
+    if(!graphs.contains(graph))
+        graphs.push_back(graph);
+}
 
-    dstRect = QRect(left, h - bottom, w - left - right, -(h - top - bottom));
+void QGraphScheduler::unregisterGraph(QGraph* graph)
+{
+    int index = graphs.indexOf(graph);
+    if(index >= 0)
+        graphs.remove(index);
+    pending.remove(graph);
 }
 
-void QGraph::updatePanning()
+void QGraphScheduler::wake(int delay)
 {
-    panCurrent = QCursor::pos();
-    double dx = dst2srcW(panCurrent.x()-panStart.x());
-    double dy = dst2srcH(panCurrent.y()-panStart.y());
-    if(zoomLimit)
-    {
-        if(limitedX && srcRect.x()-dx<dataMinX)
-            dx = srcRect.x() - dataMinX;
-        if(limitedX && srcRect.x()-dx+srcRect.width()>dataMaxX)
-            dx = srcRect.x() + srcRect.width() - dataMaxX;
-        if(limitedY && srcRect.y()-dy<dataMinY)
-            dy = srcRect.y() - dataMinY;
-        if(limitedY && srcRect.y()-dy+srcRect.height()>dataMaxY)
-            dy = srcRect.y() + srcRect.height() - dataMaxY;
-    }
-    srcRect.setX(srcRect.x()-dx);
-    srcRect.setY(srcRect.y()-dy);
-    srcRect.setWidth(srcRect.width()-dx);
-    srcRect.setHeight(srcRect.height()-dy);
-    insertLines();
-    update();
-    panStart = panCurrent;
+    if(timerId == 0)
+        timerId = startTimer(delay);
 }
 
- void QGraph::findGraphAt(QPoint pos)
- {
-    if(lines.size() == 0)
-        return;
-    double clickX = dst2srcX(pos.x());
-    double clickY = dst2srcY(pos.y());
+/*
+  2 for the widget with the focus or the mouse, 1 for other visible
+  widgets and -1 for widgets that are hidden or completely covered.
+ */
+int QGraphScheduler::priority(QGraph* graph) const
+{
+    if(!graph->isVisible() || graph->visibleRegion().isEmpty())
+        return -1;
+    if(graph->hasFocus() || graph->underMouse())
+        return 2;
+    return 1;
+}
 
-    double minDist = numeric_limits<double>::infinity();
-    int minSet = -1;
-    int minIndex = -1;
+/*
+  One frame: the eligible requests are run by priority, in registration
+  order within a priority, until the budget is used up.
+ */
+void QGraphScheduler::timerEvent(QTimerEvent* event)
+{
+    if(event->timerId() != timerId)
+    {
+        QObject::timerEvent(event);
+        return;
+    }
+    killTimer(timerId);
+    timerId = 0;
 
-    for(int set=0; set<lines.size(); set++)
+    QVector<QGraph*> order;
+    for(int level=2; level>0; level--)
     {
-        QVector<double>::Iterator newMin = std::lower_bound(lines[set].xData.begin(), lines[set].xData.end(), clickX);
-        if(newMin-1 != lines[set].xData.end() && abs(*newMin-clickX) > abs(*(newMin-1)-clickX))
-            newMin--;
-        int index = std::distance(lines[set].xData.begin(), newMin);
-        if(index >= lines[set].xData.size())
-            index = lines[set].xData.size() - 1;
-        double dx = lines[set].xData[index]-clickX;
-        double dy = lines[set].yData[index]-clickY;
-        double newDist = sqrt(dx*dx+dy*dy);
-        if(newDist < minDist)
+        for(int i=0; i<graphs.size(); i++)
         {
-            minDist = newDist;
-            minSet = set;
-            minIndex = index;
+            if(pending.contains(graphs[i]) && priority(graphs[i]) == level)
+                order.push_back(graphs[i]);
         }
     }
-    if(minSet == -1 || minIndex == -1)
-        return;
 
-    if(minDist > sqrt(srcRect.width()*srcRect.width()+srcRect.height()*srcRect.height())/20)
+    QElapsedTimer clock;
+    clock.start();
+    int done = 0;
+    while(done < order.size() && (done == 0 || clock.elapsed() < frameBudget))
     {
-        tracking = false;
-        repaint();
-        update();
-        return;
+        QGraph* graph = order[done++];
+        // A render may have unregistered or already rendered another graph
+        if(!pending.contains(graph))
+            continue;
+        graph->runScheduled(pending.take(graph));
     }
-
-    tracking = true;
-    trackingSet = minSet;
-    trackingIndex = minIndex;
-    repaint();
-    update();
- }
-
-void QGraph::onMenuGrid(bool grid)
-{
-    this->grid = grid;
-    repaint();
-    update();
+    if(done < order.size())
+        wake(frameInterval);
 }
 
-void QGraph::onMenuAntializing(bool antializing)
+QGraphAxisGroup::QGraphAxisGroup(QObject* parent) :
+    QObject(parent),
+    left(0.0),
+    width(0.0),
+    timerId(0),
+    ticksMin(0.0),
+    ticksMax(0.0)
 {
-    this->antializing = antializing;
-    repaint();
-    update();
 }
 
-void QGraph::onMenuSavePicture()
+/**
+  \fn void QGraphAxisGroup::addGraph(QGraph* graph)
+  Links the x axis of graph to the other graphs of the group. A graph
+  is in at most one group, it leaves its previous group.
+ **/
+void QGraphAxisGroup::addGraph(QGraph* graph)
 {
-    QString fileName = QFileDialog::getSaveFileName(this, tr("Save file"), tr("."), "PNG (*.png);;JPG (*.jpg);;SVG (*.svg)");
-    if(fileName.isEmpty())
+    if(!graph || graph->axisGroup == this)
         return;
-    if(fileName.toLower().endsWith(".svg"))
-    {
-        /*QSvgGenerator generator;
-        generator.setFileName("bla.svg");
-        generator.setSize(QSize(dstRect.width(), -dstRect.height()));
-        generator.setViewBox(QRect(0, 0, dstRect.width(), -dstRect.height()));
-        generator.setTitle(tr("SVG Generator Example Drawing"));
-        generator.setDescription(tr("An SVG drawing created by the SVG Generator Example provided with Qt."));
-
-        QPainter painter;
-        painter.begin(&generator);
-        scene->render(&painter, QRect(0, 0, dstRect.width(), -dstRect.height()), srcRect, Qt::IgnoreAspectRatio);
-        painter.end();*/
-    }
-    else
-    {
-        graphImage.save(fileName);
-    }
+    if(graph->axisGroup)
+        graph->axisGroup->removeGraph(graph);
+    members.push_back(graph);
+    graph->axisGroup = this;
 }
 
-void QGraph::onMenuTitle(bool enableTitle)
+/**
+  \fn void QGraphAxisGroup::removeGraph(QGraph* graph)
+  Unlinks graph, its current range is kept.
+ **/
+void QGraphAxisGroup::removeGraph(QGraph* graph)
 {
-    if(title.isEmpty())
-        menuTitle->setChecked(false);
-    else
-    {
-        this->titleEnabled = enableTitle;
-        insertLines();
-        update();
-    }
+    members.removeAll(QPointer<QGraph>(graph));
+    if(graph && graph->axisGroup == this)
+        graph->axisGroup = 0;
 }
 
-void QGraph::onMenuUndertitle(bool enableUndertitle)
+QList<QGraph*> QGraphAxisGroup::graphs() const
 {
-    if(undertitle.isEmpty())
-        menuUndertitle->setChecked(false);
-    else
+    QList<QGraph*> list;
+    for(int i=0; i<members.size(); i++)
     {
-        this->undertitleEnabled = enableUndertitle;
-        insertLines();
-        update();
+        if(members[i])
+            list.push_back(members[i]);
     }
+    return list;
 }
 
-void QGraph::onMenuXLabel(bool enableXLabel)
+/**
+  \fn QSharedPointer<QGraphCurveLodBuilder> QGraphAxisGroup::curveLod(QSharedPointer<QGraphDataSource> source)
+  Returns the simplified levels of an unsorted curve. Graphs of the
+  group that show the same source share the levels, so they are only
+  rebuilt once when the source has grown.
+ **/
+QSharedPointer<QGraphCurveLodBuilder> QGraphAxisGroup::curveLod(QSharedPointer<QGraphDataSource> source)
 {
-    if(xLabel.isEmpty())
-        menuXLabel->setChecked(false);
-    else
+    SharedLod& shared = lods[source.data()];
+    QSharedPointer<QGraphCurveLodBuilder> lod = shared.lod.toStrongRef();
+    if(!lod || shared.source.toStrongRef() != source)
     {
-        this->xLabelEnabled = enableXLabel;
-        insertLines();
-        update();
+        lod = QSharedPointer<QGraphCurveLodBuilder>(new QGraphCurveLodBuilder());
+        shared.source = source;
+        shared.lod = lod;
     }
-}
 
-void QGraph::onMenuYLabel(bool enableYLabel)
-{
-    if(yLabel.isEmpty())
-        menuYLabel->setChecked(false);
+    // Forget the levels nobody uses anymore
+    QHash<const QGraphDataSource*, SharedLod>::iterator it = lods.begin();
+    while(it != lods.end())
     {
-        this->yLabelEnabled = enableYLabel;
-        insertLines();
-        update();
+        if(it->lod.isNull())
+            it = lods.erase(it);
+        else
+            ++it;
     }
+    return lod;
 }
 
-void QGraph::onMenuXNumbers(bool enableXNumbers)
+/*
+  Remembers the x range of leader and applies it to the other graphs
+  when the event loop is idle again. Several changes in a row, e.g. a
+  fast wheel, are coalesced into one render of every graph.
+ */
+void QGraphAxisGroup::follow(QGraph* leader)
 {
-    this->xNumbersEnabled = enableXNumbers;
-    insertLines();
-    update();
+    this->leader = leader;
+    left = leader->srcRect.x();
+    width = leader->srcRect.width();
+    if(timerId == 0)
+        timerId = startTimer(0);
 }
 
-void QGraph::onMenuYNumbers(bool enableYNumbers)
+// Widens the x range of graph to the data of all graphs of the group
+void QGraphAxisGroup::fullX(QGraph* graph)
 {
-    this->yNumbersEnabled = enableYNumbers;
-    insertLines();
-    update();
+    double min = graph->dataMinX;
+    double max = graph->dataMaxX;
+    for(int i=0; i<members.size(); i++)
+    {
+        if(!members[i] || members[i]->lines.isEmpty())
+            continue;
+        min = qMin(min, members[i]->dataMinX);
+        max = qMax(max, members[i]->dataMaxX);
+    }
+    graph->srcRect.setLeft(min);
+    graph->srcRect.setWidth(max-min);
 }
 
-void QGraph::onMenuNoBorder()
+/*
+  All graphs in the common range get the same ticks, they only depend
+  on the range.
+ */
+const QVector<double>& QGraphAxisGroup::ticks(QGraph* graph, double min, double max)
 {
-    setNoBorder();
-    insertLines();
-    update();
+    if(min != ticksMin || max != ticksMax || tickCache.isEmpty())
+    {
+        graph->calcPoints(tickCache, min, max);
+        ticksMin = min;
+        ticksMax = max;
+    }
+    return tickCache;
 }
 
-void QGraph::onMenuDefaultBorder()
+/*
+  The render pass of a coalesced range change. Visible graphs are drawn
+  right away so the stack moves together, hidden ones are left to the
+  scheduler.
+ */
+void QGraphAxisGroup::timerEvent(QTimerEvent* event)
 {
-    setDefaultBorder();
-    insertLines();
-    update();
+    if(event->timerId() != timerId)
+    {
+        QObject::timerEvent(event);
+        return;
+    }
+    killTimer(timerId);
+    timerId = 0;
+
+    for(int i=0; i<members.size(); i++)
+    {
+        QGraph* graph = members[i];
+        if(!graph || graph == leader || graph->stripChart)
+            continue;
+        if(graph->srcRect.x() == left && graph->srcRect.width() == width)
+            continue;
+        graph->srcRect = QRectF(left, graph->srcRect.y(), width, graph->srcRect.height());
+        graph->persistenceReset = true;
+        if(graph->isVisible() && !graph->visibleRegion().isEmpty())
+        {
+            graph->insertLines();
+            graph->update();
+        }
+        else
+            QGraphScheduler::instance()->request(graph, QGraphScheduler::Redraw);
+    }
 }
@@ -35,6 +35,1975 @@
 #include <QPoint>
 #include <QMenu>
 #include <QFont>
+#include <QElapsedTimer>
+#include <QString>
+#include <QFile>
+#include <QSharedPointer>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QHash>
+#include <QWaitCondition>
+#include <QPointer>
+#include <QPainter>
+#include <QThreadPool>
+#include <QStaticText>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cmath>
+
+/*
+  A QGraphDataSource provides the samples of one trace. The graph only
+  asks for the samples that are required for the current view, so a
+  source does not need to keep its data in memory. Index ranges are
+  half open: [from, to).
+ */
+class QGraphDataSource
+{
+public:
+    // Order of the samples of several channels in one buffer
+    enum Layout {
+        Interleaved,
+        Planar
+    };
+
+    virtual ~QGraphDataSource() {}
+
+    virtual qint64 size() const = 0;
+    virtual double x(qint64 index) const = 0;
+    virtual double y(qint64 index) const = 0;
+
+    // Sources with monotonically increasing x can be culled and decimated
+    virtual bool sortedX() const { return true; }
+    // Sources that may be read from a worker thread while the GUI thread
+    // uses them, e.g. by QGraphSpectrum. Sources with unlocked caches or
+    // a window moved by sync() are copied on the GUI thread instead.
+    virtual bool threadSafe() const { return false; }
+    virtual qint64 lowerBound(double x) const;
+    virtual void minMaxX(qint64 from, qint64 to, double& min, double& max) const;
+    virtual void minMaxY(qint64 from, qint64 to, double& min, double& max) const;
+    // minMaxY() plus the first and the last y of [from, to), as drawn for a
+    // pixel column. Sources that answer long ranges from block summaries
+    // may return the first and last y of the whole blocks at the ends.
+    virtual void envelopeY(qint64 from, qint64 to, double& min, double& max, double& first, double& last) const;
+    // Sum of y and of y*y over [from, to)
+    virtual void sums(qint64 from, qint64 to, double& sum, double& sumSquares) const;
+    virtual void readX(qint64 from, qint64 count, double* out) const;
+    virtual void readY(qint64 from, qint64 count, double* out) const;
+
+    // Returns true if x(i) is x0+i*dx, so x does not need to be stored
+    virtual bool uniformX(double& x0, double& dx) const { Q_UNUSED(x0); Q_UNUSED(dx); return false; }
+
+    // Called before the samples [from, to) are rendered
+    virtual void viewChanged(qint64 from, qint64 to) { Q_UNUSED(from); Q_UNUSED(to); }
+
+    // Sources written by another process take a snapshot of their size
+    // here, so indices stay valid while a frame is built. Returns true if
+    // new samples arrived since the last call.
+    virtual bool sync() { return false; }
+};
+
+/*
+  Kernels shared by the sources. They work on the raw sample type and
+  convert to physical units (raw*scale+offset) only once per result.
+ */
+namespace QGraphKernels
+{
+    template<typename T>
+    void minMax(const T* data, qint64 count, double scale, double offset, double& min, double& max)
+    {
+        min = std::numeric_limits<double>::infinity();
+        max = -std::numeric_limits<double>::infinity();
+        if(count <= 0)
+            return;
+        T low = data[0];
+        T high = data[0];
+        for(qint64 i=1; i<count; i++)
+        {
+            low = data[i] < low ? data[i] : low;
+            high = data[i] > high ? data[i] : high;
+        }
+        double a = low*scale+offset;
+        double b = high*scale+offset;
+        min = a < b ? a : b;
+        max = a < b ? b : a;
+    }
+
+    // Same as minMax() for samples that are stride bytes apart and possibly unaligned
+    template<typename T>
+    void minMaxStrided(const uchar* data, qint64 stride, qint64 count, double scale, double offset, double& min, double& max)
+    {
+        if(count <= 0)
+            return;
+        T low, high;
+        memcpy(&low, data, sizeof(T));
+        high = low;
+        for(qint64 i=1; i<count; i++)
+        {
+            T value;
+            memcpy(&value, data+i*stride, sizeof(T));
+            low = value < low ? value : low;
+            high = value > high ? value : high;
+        }
+        double a = low*scale+offset;
+        double b = high*scale+offset;
+        min = qMin(min, qMin(a, b));
+        max = qMax(max, qMax(a, b));
+    }
+
+    template<typename T>
+    void transform(const T* data, qint64 count, double scale, double offset, double* out)
+    {
+        for(qint64 i=0; i<count; i++)
+            out[i] = data[i]*scale+offset;
+    }
+}
+
+namespace QGraphKernels
+{
+    // Extends sum and sumSquares by count samples which are stride bytes apart
+    template<typename T>
+    void sumsStrided(const uchar* data, qint64 stride, qint64 count, double& sum, double& sumSquares)
+    {
+        double s = 0.0;
+        double q = 0.0;
+        for(qint64 i=0; i<count; i++)
+        {
+            T value;
+            memcpy(&value, data+i*stride, sizeof(T));
+            s += double(value);
+            q += double(value)*double(value);
+        }
+        sum += s;
+        sumSquares += q;
+    }
+
+    // Converts raw sums of count samples to sums of raw*scale+offset
+    inline void sumsToPhysical(qint64 count, double scale, double offset, double& sum, double& sumSquares)
+    {
+        double rawSum = sum;
+        sum = rawSum*scale + count*offset;
+        sumSquares = sumSquares*scale*scale + 2.0*scale*offset*rawSum + count*offset*offset;
+    }
+
+    // Converts a raw range to physical units, an empty range (low > high) stays empty
+    inline void toPhysical(double low, double high, double scale, double offset, double& min, double& max)
+    {
+        min = std::numeric_limits<double>::infinity();
+        max = -std::numeric_limits<double>::infinity();
+        if(low > high)
+            return;
+        double a = low*scale+offset;
+        double b = high*scale+offset;
+        min = a < b ? a : b;
+        max = a < b ? b : a;
+    }
+
+    // Lets count intensities decay and adds the coverage (0..255) of a new frame, flushing tiny values to 0
+    inline void decayAccumulate(float* intensity, const uchar* coverage, int count, float decay, float gain)
+    {
+        for(int i=0; i<count; i++)
+        {
+            float value = intensity[i]*decay + coverage[i]*gain;
+            intensity[i] = value < 1e-4f ? 0.0f : value;
+        }
+    }
+
+    // Maps count intensities to the 256 entry lut, intensity 0 to lut[0], high ones saturate towards lut[255]
+    inline void colorMap(const float* intensity, int count, const QRgb* lut, QRgb* out)
+    {
+        for(int i=0; i<count; i++)
+        {
+            float value = intensity[i];
+            out[i] = lut[int(255.0f*value/(1.0f+value))];
+        }
+    }
+
+    // Fills the 256 entry lut by linear interpolation between the colour stops
+    inline void colorTable(const QVector<QColor>& stops, QVector<QRgb>& lut)
+    {
+        lut.resize(256);
+        for(int i=0; i<256; i++)
+        {
+            double t = stops.size() > 1 ? i/255.0*(stops.size()-1) : 0.0;
+            int stop = qMin(int(t), stops.size()-1);
+            int next = qMin(stop+1, stops.size()-1);
+            double f = t-stop;
+            lut[i] = qRgba(int(stops[stop].red()*(1.0-f) + stops[next].red()*f + 0.5),
+                           int(stops[stop].green()*(1.0-f) + stops[next].green()*f + 0.5),
+                           int(stops[stop].blue()*(1.0-f) + stops[next].blue()*f + 0.5),
+                           255);
+        }
+    }
+
+    // Maps count values linearly from [min, max] to the 256 entry lut, NaN maps to lut[0]
+    inline void colorMapRange(const double* values, int count, double min, double max, const QRgb* lut, QRgb* out)
+    {
+        double scale = max > min ? 255.0/(max-min) : 0.0;
+        for(int i=0; i<count; i++)
+        {
+            double t = (values[i]-min)*scale;
+            t = t > 0.0 ? t : 0.0;
+            t = t < 255.0 ? t : 255.0;
+            out[i] = lut[int(t)];
+        }
+    }
+
+    // Index of the first of count samples >= level, count if there is none. Groups of
+    // 16 samples are tested without branches, so the compiler can vectorize the search
+    inline qint64 findAbove(const double* data, qint64 count, double level)
+    {
+        qint64 i = 0;
+        for(; i+16<=count; i+=16)
+        {
+            int hit = 0;
+            for(int j=0; j<16; j++)
+                hit |= data[i+j] >= level;
+            if(hit)
+                break;
+        }
+        for(; i<count; i++)
+            if(data[i] >= level)
+                return i;
+        return count;
+    }
+
+    // Index of the first of count samples < level, count if there is none
+    inline qint64 findBelow(const double* data, qint64 count, double level)
+    {
+        qint64 i = 0;
+        for(; i+16<=count; i+=16)
+        {
+            int hit = 0;
+            for(int j=0; j<16; j++)
+                hit |= data[i+j] < level;
+            if(hit)
+                break;
+        }
+        for(; i<count; i++)
+            if(data[i] < level)
+                return i;
+        return count;
+    }
+}
+
+/*
+  Answers min/max of any sample range in O(log n) and its sums in O(1).
+  The samples are summarized in blocks of 2^blockBits samples and the
+  blocks in a binary tree, stored level by level, and in prefix sums
+  with Kahan compensation. Appending only updates the path above the
+  last block, so the index follows growing traces. It is locked
+  internally: one thread may append while others query.
+ */
+class QGraphRangeIndex
+{
+public:
+    enum {
+        // Shorter ranges are cheaper to scan than to index
+        Threshold = 1<<16
+    };
+
+    explicit QGraphRangeIndex(int blockBits = 8) :
+        bits(blockBits),
+        samples(0)
+    {
+    }
+
+    qint64 size() const
+    {
+        QMutexLocker locker(&mutex);
+        return samples;
+    }
+
+    void clear()
+    {
+        QMutexLocker locker(&mutex);
+        levels.clear();
+        blockSums.clear();
+        prefix.clear();
+        samples = 0;
+    }
+
+    // Adds the next count samples, which are stride elements apart
+    template<typename T>
+    void append(const T* data, qint64 count, qint64 stride = 1)
+    {
+        QMutexLocker locker(&mutex);
+        appendSamples(data, count, stride);
+    }
+
+    // Indexes count samples unless the index was built before
+    template<typename T>
+    void build(const T* data, qint64 count, qint64 stride = 1)
+    {
+        QMutexLocker locker(&mutex);
+        if(samples == 0)
+            appendSamples(data, count, stride);
+    }
+
+    // Adds the summary of the next block, all blocks but the last must be complete
+    void appendBlock(double min, double max, double sum, double sumSquares, qint64 count);
+
+    // Extends min and max by the whole blocks [from, to)
+    void blocksMinMax(qint64 from, qint64 to, double& min, double& max) const;
+
+    // Extends sum and sumSquares by the whole blocks [from, to)
+    void blocksSums(qint64 from, qint64 to, double& sum, double& sumSquares) const;
+
+    // Extends min and max by the samples [from, to). The partial blocks
+    // at both ends are read with source.scanRaw(from, to, min, max).
+    template<typename Source>
+    void minMax(const Source& source, qint64 from, qint64 to, double& min, double& max) const
+    {
+        qint64 first = (from + (qint64(1) << bits) - 1) >> bits;
+        qint64 last = qMin(to, size()) >> bits;
+        if(first >= last)
+        {
+            source.scanRaw(from, to, min, max);
+            return;
+        }
+        source.scanRaw(from, first << bits, min, max);
+        blocksMinMax(first, last, min, max);
+        source.scanRaw(last << bits, to, min, max);
+    }
+
+    // Same as minMax() for the sums, the ends are read with source.sumRaw()
+    template<typename Source>
+    void sums(const Source& source, qint64 from, qint64 to, double& sum, double& sumSquares) const
+    {
+        qint64 first = (from + (qint64(1) << bits) - 1) >> bits;
+        qint64 last = qMin(to, size()) >> bits;
+        if(first >= last)
+        {
+            source.sumRaw(from, to, sum, sumSquares);
+            return;
+        }
+        source.sumRaw(from, first << bits, sum, sumSquares);
+        blocksSums(first, last, sum, sumSquares);
+        source.sumRaw(last << bits, to, sum, sumSquares);
+    }
+
+private:
+    Q_DISABLE_COPY(QGraphRangeIndex)
+
+    struct Range {
+        double min;
+        double max;
+    };
+
+    struct Sums {
+        double sum;
+        double squares;
+    };
+
+    // Sums of all blocks before a block, with their Kahan compensations
+    struct Prefix {
+        double sum;
+        double sumError;
+        double squares;
+        double squaresError;
+    };
+
+    template<typename T>
+    void appendSamples(const T* data, qint64 count, qint64 stride)
+    {
+        qint64 blockSize = qint64(1) << bits;
+        while(count > 0)
+        {
+            qint64 n = qMin(count, blockSize - (samples & (blockSize-1)));
+            double low = double(data[0]);
+            double high = low;
+            Sums sums = {low, low*low};
+            for(qint64 i=1; i<n; i++)
+            {
+                double value = double(data[i*stride]);
+                low = value < low ? value : low;
+                high = value > high ? value : high;
+                sums.sum += value;
+                sums.squares += value*value;
+            }
+            update(samples >> bits, low, high, sums);
+            samples += n;
+            data += n*stride;
+            count -= n;
+        }
+    }
+
+    void update(qint64 block, double min, double max, const Sums& sums);
+
+    int bits;
+    qint64 samples;
+    QVector< QVector<Range> > levels;
+    QVector<Sums> blockSums;
+    QVector<Prefix> prefix;
+    mutable QMutex mutex;
+};
+
+/*
+  Keeps the samples in memory in their raw type T, e.g. qint16 for the
+  counts of an ADC. y values are returned as raw*scale+offset.
+  Uniformly sampled traces do not store x at all, the x coordinate of
+  sample i is x0+i*dx.
+ */
+template<typename T>
+class QGraphSampleSource : public QGraphDataSource
+{
+public:
+    QGraphSampleSource(const QVector<double>& xData, const QVector<T>& yData, double scale = 1.0, double offset = 0.0) :
+        xData(xData),
+        yData(yData),
+        scale(scale),
+        offset(offset),
+        uniform(false),
+        x0(0.0),
+        dx(1.0),
+        sorted(true)
+    {
+        for(int i=1; i<this->xData.size() && sorted; i++)
+            sorted = this->xData[i-1] <= this->xData[i];
+    }
+
+    QGraphSampleSource(double x0, double dx, const QVector<T>& yData, double scale = 1.0, double offset = 0.0) :
+        yData(yData),
+        scale(scale),
+        offset(offset),
+        uniform(true),
+        x0(x0),
+        dx(dx),
+        sorted(dx > 0)
+    {
+    }
+
+    qint64 size() const { return uniform ? yData.size() : qMin(xData.size(), yData.size()); }
+    double x(qint64 index) const { return uniform ? x0+index*dx : xData[index]; }
+    double y(qint64 index) const { return yData[index]*scale+offset; }
+    bool sortedX() const { return sorted; }
+    bool threadSafe() const { return true; }
+
+    qint64 lowerBound(double x) const
+    {
+        if(!sorted)
+            return QGraphDataSource::lowerBound(x);
+        if(uniform)
+            return uniformLowerBound(x, x0, dx, size());
+        return std::lower_bound(xData.constBegin(), xData.constBegin()+size(), x) - xData.constBegin();
+    }
+
+    // First index i in [0, size] with x0+i*dx >= x, dx must be positive
+    static qint64 uniformLowerBound(double x, double x0, double dx, qint64 size)
+    {
+        double estimate = ceil((x-x0)/dx);
+        if(estimate <= 0)
+            return 0;
+        if(estimate >= size)
+            estimate = double(size);
+        // The division may be off by one, correct it with the same expression x() uses
+        qint64 index = qint64(estimate);
+        while(index > 0 && x0+(index-1)*dx >= x)
+            index--;
+        while(index < size && x0+index*dx < x)
+            index++;
+        return index;
+    }
+
+    // Long ranges use a range index, which is built on the first such query
+    void minMaxY(qint64 from, qint64 to, double& min, double& max) const
+    {
+        if(to-from < QGraphRangeIndex::Threshold)
+        {
+            QGraphKernels::minMax(yData.constData()+from, to-from, scale, offset, min, max);
+            return;
+        }
+        index.build(yData.constData(), yData.size());
+        double low = std::numeric_limits<double>::infinity();
+        double high = -std::numeric_limits<double>::infinity();
+        index.minMax(*this, from, to, low, high);
+        QGraphKernels::toPhysical(low, high, scale, offset, min, max);
+    }
+
+    void sums(qint64 from, qint64 to, double& sum, double& sumSquares) const
+    {
+        sum = 0.0;
+        sumSquares = 0.0;
+        if(to-from < QGraphRangeIndex::Threshold)
+            sumRaw(from, to, sum, sumSquares);
+        else
+        {
+            index.build(yData.constData(), yData.size());
+            index.sums(*this, from, to, sum, sumSquares);
+        }
+        QGraphKernels::sumsToPhysical(qMax(to-from, qint64(0)), scale, offset, sum, sumSquares);
+    }
+
+    // Extends min and max by the raw samples [from, to)
+    void scanRaw(qint64 from, qint64 to, double& min, double& max) const
+    {
+        QGraphKernels::minMaxStrided<T>(reinterpret_cast<const uchar*>(yData.constData()+from), sizeof(T), to-from, 1.0, 0.0, min, max);
+    }
+
+    void sumRaw(qint64 from, qint64 to, double& sum, double& sumSquares) const
+    {
+        QGraphKernels::sumsStrided<T>(reinterpret_cast<const uchar*>(yData.constData()+from), sizeof(T), to-from, sum, sumSquares);
+    }
+
+    void readX(qint64 from, qint64 count, double* out) const
+    {
+        if(uniform)
+        {
+            for(qint64 i=0; i<count; i++)
+                out[i] = x0+(from+i)*dx;
+        }
+        else
+            memcpy(out, xData.constData()+from, count*sizeof(double));
+    }
+
+    void readY(qint64 from, qint64 count, double* out) const
+    {
+        QGraphKernels::transform(yData.constData()+from, count, scale, offset, out);
+    }
+
+    void setScale(double scale, double offset)
+    {
+        this->scale = scale;
+        this->offset = offset;
+    }
+
+    bool uniformX(double& x0, double& dx) const
+    {
+        x0 = this->x0;
+        dx = this->dx;
+        return uniform;
+    }
+
+    const QVector<T>& samples() const { return yData; }
+    bool isUniform() const { return uniform; }
+
+protected:
+    QVector<double> xData;
+    QVector<T> yData;
+    double scale;
+    double offset;
+    bool uniform;
+    double x0;
+    double dx;
+    bool sorted;
+    mutable QGraphRangeIndex index;
+};
+
+typedef QGraphSampleSource<double> QGraphVectorSource;
+
+/*
+  One channel of a buffer that holds the samples of several channels,
+  interleaved (c0 c1 c2 c0 c1 c2 ...) or planar (c0 c0 ... c1 c1 ...).
+  All channels share the buffer and the uniform time base x0+i*dx.
+ */
+template<typename T>
+class QGraphChannelSource : public QGraphDataSource
+{
+public:
+    QGraphChannelSource(const QVector<T>& block, int channels, int channel, Layout layout, double x0, double dx, double scale = 1.0, double offset = 0.0) :
+        block(block),
+        channels(channels),
+        channel(channel),
+        layout(layout),
+        samples(block.size()/channels),
+        x0(x0),
+        dx(dx),
+        scale(scale),
+        offset(offset)
+    {
+    }
+
+    qint64 size() const { return samples; }
+    double x(qint64 index) const { return x0+index*dx; }
+    double y(qint64 index) const { return *sample(index)*scale+offset; }
+    bool sortedX() const { return dx > 0; }
+    bool threadSafe() const { return true; }
+
+    qint64 lowerBound(double x) const
+    {
+        if(dx <= 0)
+            return QGraphDataSource::lowerBound(x);
+        return QGraphSampleSource<T>::uniformLowerBound(x, x0, dx, samples);
+    }
+
+    bool uniformX(double& x0, double& dx) const
+    {
+        x0 = this->x0;
+        dx = this->dx;
+        return true;
+    }
+
+    void minMaxY(qint64 from, qint64 to, double& min, double& max) const
+    {
+        double low = std::numeric_limits<double>::infinity();
+        double high = -std::numeric_limits<double>::infinity();
+        if(to-from < QGraphRangeIndex::Threshold)
+            scanRaw(from, to, low, high);
+        else
+        {
+            index.build(sample(0), samples, layout == Planar ? 1 : channels);
+            index.minMax(*this, from, to, low, high);
+        }
+        QGraphKernels::toPhysical(low, high, scale, offset, min, max);
+    }
+
+    void sums(qint64 from, qint64 to, double& sum, double& sumSquares) const
+    {
+        sum = 0.0;
+        sumSquares = 0.0;
+        if(to-from < QGraphRangeIndex::Threshold)
+            sumRaw(from, to, sum, sumSquares);
+        else
+        {
+            index.build(sample(0), samples, layout == Planar ? 1 : channels);
+            index.sums(*this, from, to, sum, sumSquares);
+        }
+        QGraphKernels::sumsToPhysical(qMax(to-from, qint64(0)), scale, offset, sum, sumSquares);
+    }
+
+    // Extends min and max by the raw samples [from, to)
+    void scanRaw(qint64 from, qint64 to, double& min, double& max) const
+    {
+        qint64 stride = layout == Planar ? sizeof(T) : qint64(channels)*sizeof(T);
+        QGraphKernels::minMaxStrided<T>(reinterpret_cast<const uchar*>(sample(from)), stride, to-from, 1.0, 0.0, min, max);
+    }
+
+    void sumRaw(qint64 from, qint64 to, double& sum, double& sumSquares) const
+    {
+        qint64 stride = layout == Planar ? sizeof(T) : qint64(channels)*sizeof(T);
+        QGraphKernels::sumsStrided<T>(reinterpret_cast<const uchar*>(sample(from)), stride, to-from, sum, sumSquares);
+    }
+
+    void readY(qint64 from, qint64 count, double* out) const
+    {
+        if(layout == Planar)
+        {
+            QGraphKernels::transform(sample(from), count, scale, offset, out);
+            return;
+        }
+        const T* data = sample(from);
+        for(qint64 i=0; i<count; i++)
+            out[i] = data[i*channels]*scale+offset;
+    }
+
+protected:
+    const T* sample(qint64 index) const
+    {
+        if(layout == Interleaved)
+            return block.constData() + index*channels + channel;
+        return block.constData() + channel*samples + index;
+    }
+
+    QVector<T> block;
+    int channels;
+    int channel;
+    Layout layout;
+    qint64 samples;
+    double x0;
+    double dx;
+    double scale;
+    double offset;
+    mutable QGraphRangeIndex index;
+};
+
+/*
+  Hands out memory blocks of one fixed size. Blocks are carved from
+  larger slabs and recycled when released, so growing traces do not
+  hit the heap for every chunk. There is one pool per block size, the
+  pools live until the process ends.
+ */
+class QGraphChunkPool
+{
+public:
+    static QGraphChunkPool* instance(int chunkBytes);
+
+    void* allocate();
+    void release(void* chunk);
+
+private:
+    explicit QGraphChunkPool(int chunkBytes);
+    Q_DISABLE_COPY(QGraphChunkPool)
+
+    int chunkBytes;
+    QMutex mutex;
+    QVector<void*> freeChunks;
+};
+
+/*
+  Append only storage for streaming traces. The samples are kept in
+  chunks of ChunkSize samples that are never moved or reallocated, so
+  appending is amortized O(1) without copying the history. A range
+  index follows the appended samples. A full chunk is never written
+  again: one thread may append while other threads read the samples
+  below size().
+ */
+template<typename T>
+class QGraphChunkedSource : public QGraphDataSource
+{
+public:
+    enum {
+        ChunkBits = 13,
+        ChunkSize = 1<<ChunkBits,
+        SegmentBits = 10,
+        SegmentSize = 1<<SegmentBits,
+        MaxSegments = 1024
+    };
+
+    QGraphChunkedSource() :
+        uniform(false), x0(0.0), dx(1.0), scale(1.0), offset(0.0), index(10)
+    {
+        init();
+    }
+
+    QGraphChunkedSource(double x0, double dx, double scale = 1.0, double offset = 0.0) :
+        uniform(true), x0(x0), dx(dx), scale(scale), offset(offset), index(10)
+    {
+        init();
+    }
+
+    ~QGraphChunkedSource()
+    {
+        for(qint64 c=0; c<chunks; c++)
+        {
+            yPool->release(chunkAt(c).y);
+            if(chunkAt(c).x)
+                xPool->release(chunkAt(c).x);
+        }
+        for(int segment=0; segment<MaxSegments; segment++)
+            delete[] segments[segment];
+    }
+
+    // xData is ignored for uniformly sampled traces and may be 0
+    void append(const double* xData, const T* yData, qint64 count)
+    {
+        qint64 size = written;
+        for(qint64 i=0; i<count; )
+        {
+            qint64 position = size & (ChunkSize-1);
+            if(position == 0 && !openChunk(size >> ChunkBits))
+                break;
+            Chunk& chunk = chunkAt(size >> ChunkBits);
+            qint64 n = qMin(count-i, qint64(ChunkSize)-position);
+            memcpy(chunk.y+position, yData+i, n*sizeof(T));
+            if(!uniform)
+            {
+                memcpy(chunk.x+position, xData+i, n*sizeof(double));
+                for(qint64 j=0; j<n && sorted; j++)
+                {
+                    sorted = !(xData[i+j] < lastX);
+                    lastX = xData[i+j];
+                }
+            }
+            index.append(yData+i, n);
+            size += n;
+            i += n;
+        }
+        written = size;
+        published.storeRelease(size);
+    }
+
+    // Converts the raw samples to physical units: raw*scale+offset
+    void setScale(double scale, double offset)
+    {
+        this->scale = scale;
+        this->offset = offset;
+    }
+
+    void append(double x, T y)
+    {
+        append(&x, &y, 1);
+    }
+
+    void append(const QVector<double>& xData, const QVector<T>& yData)
+    {
+        append(xData.constData(), yData.constData(), uniform ? yData.size() : qMin(xData.size(), yData.size()));
+    }
+
+    qint64 size() const { return published.loadAcquire(); }
+    double x(qint64 index) const { return uniform ? x0+index*dx : chunkAt(index >> ChunkBits).x[index & (ChunkSize-1)]; }
+    double y(qint64 index) const { return chunkAt(index >> ChunkBits).y[index & (ChunkSize-1)]*scale+offset; }
+    bool sortedX() const { return uniform ? dx > 0 : sorted; }
+    bool threadSafe() const { return true; }
+
+    qint64 lowerBound(double x) const
+    {
+        if(uniform && dx > 0)
+            return QGraphSampleSource<T>::uniformLowerBound(x, x0, dx, size());
+        return QGraphDataSource::lowerBound(x);
+    }
+
+    bool uniformX(double& x0, double& dx) const
+    {
+        x0 = this->x0;
+        dx = this->dx;
+        return uniform;
+    }
+
+    void minMaxY(qint64 from, qint64 to, double& min, double& max) const
+    {
+        double low = std::numeric_limits<double>::infinity();
+        double high = -std::numeric_limits<double>::infinity();
+        index.minMax(*this, from, qMin(to, size()), low, high);
+        QGraphKernels::toPhysical(low, high, scale, offset, min, max);
+    }
+
+    void sums(qint64 from, qint64 to, double& sum, double& sumSquares) const
+    {
+        sum = 0.0;
+        sumSquares = 0.0;
+        to = qMin(to, size());
+        index.sums(*this, from, to, sum, sumSquares);
+        QGraphKernels::sumsToPhysical(qMax(to-from, qint64(0)), scale, offset, sum, sumSquares);
+    }
+
+    // Extends min and max by the raw samples [from, to)
+    void scanRaw(qint64 from, qint64 to, double& min, double& max) const
+    {
+        while(from < to)
+        {
+            const Chunk& chunk = chunkAt(from >> ChunkBits);
+            qint64 start = from & (ChunkSize-1);
+            qint64 end = qMin(to-(from-start), qint64(ChunkSize));
+            QGraphKernels::minMaxStrided<T>(reinterpret_cast<const uchar*>(chunk.y+start), sizeof(T), end-start, 1.0, 0.0, min, max);
+            from += end-start;
+        }
+    }
+
+    void sumRaw(qint64 from, qint64 to, double& sum, double& sumSquares) const
+    {
+        while(from < to)
+        {
+            const Chunk& chunk = chunkAt(from >> ChunkBits);
+            qint64 start = from & (ChunkSize-1);
+            qint64 end = qMin(to-(from-start), qint64(ChunkSize));
+            QGraphKernels::sumsStrided<T>(reinterpret_cast<const uchar*>(chunk.y+start), sizeof(T), end-start, sum, sumSquares);
+            from += end-start;
+        }
+    }
+
+    void readY(qint64 from, qint64 count, double* out) const
+    {
+        while(count > 0)
+        {
+            const Chunk& chunk = chunkAt(from >> ChunkBits);
+            qint64 start = from & (ChunkSize-1);
+            qint64 n = qMin(count, qint64(ChunkSize)-start);
+            QGraphKernels::transform(chunk.y+start, n, scale, offset, out);
+            from += n;
+            count -= n;
+            out += n;
+        }
+    }
+
+    void readX(qint64 from, qint64 count, double* out) const
+    {
+        if(uniform)
+        {
+            for(qint64 i=0; i<count; i++)
+                out[i] = x0+(from+i)*dx;
+            return;
+        }
+        while(count > 0)
+        {
+            const Chunk& chunk = chunkAt(from >> ChunkBits);
+            qint64 start = from & (ChunkSize-1);
+            qint64 n = qMin(count, qint64(ChunkSize)-start);
+            memcpy(out, chunk.x+start, n*sizeof(double));
+            from += n;
+            count -= n;
+            out += n;
+        }
+    }
+
+protected:
+    struct Chunk {
+        T* y;
+        double* x;
+    };
+
+    void init()
+    {
+        yPool = QGraphChunkPool::instance(ChunkSize*sizeof(T));
+        xPool = uniform ? 0 : QGraphChunkPool::instance(ChunkSize*sizeof(double));
+        for(int segment=0; segment<MaxSegments; segment++)
+            segments[segment] = 0;
+        chunks = 0;
+        written = 0;
+        sorted = true;
+        lastX = -std::numeric_limits<double>::infinity();
+    }
+
+    Chunk& chunkAt(qint64 chunk) const
+    {
+        return segments[chunk >> SegmentBits][chunk & (SegmentSize-1)];
+    }
+
+    bool openChunk(qint64 chunk)
+    {
+        int segment = int(chunk >> SegmentBits);
+        if(segment >= MaxSegments)
+            return false;
+        if(!segments[segment])
+            segments[segment] = new Chunk[SegmentSize];
+        Chunk& c = chunkAt(chunk);
+        c.y = static_cast<T*>(yPool->allocate());
+        c.x = xPool ? static_cast<double*>(xPool->allocate()) : 0;
+        chunks = chunk+1;
+        return true;
+    }
+
+    // Segments are allocated once and never move, so readers need no lock
+    Chunk* segments[MaxSegments];
+    QGraphChunkPool* yPool;
+    QGraphChunkPool* xPool;
+    qint64 chunks;
+    qint64 written;
+    QAtomicInteger<qint64> published;
+    bool uniform;
+    double x0;
+    double dx;
+    double scale;
+    double offset;
+    bool sorted;
+    double lastX;
+    QGraphRangeIndex index;
+
+private:
+    Q_DISABLE_COPY(QGraphChunkedSource)
+};
+
+/*
+  Compressed storage for long histories. The samples are grouped into
+  blocks of BlockSize samples. y is encoded with the XOR scheme of
+  Facebook's Gorilla, x with delta-of-delta on the bit pattern of the
+  doubles (nothing is stored for uniformly sampled traces). Both are
+  lossless. Every block keeps its x range and y min/max uncompressed,
+  so zoomed out views are drawn from these summaries and only blocks
+  at the edges of a pixel column are decompressed. The most recently
+  decoded blocks are cached. Not thread safe.
+ */
+class QGraphCompressedSource : public QGraphDataSource
+{
+public:
+    enum {
+        BlockSize = 1024,
+        CacheBlocks = 8
+    };
+
+    QGraphCompressedSource();
+    QGraphCompressedSource(double x0, double dx);
+
+    // x is ignored for uniformly sampled traces and may be 0
+    void append(const double* x, const double* y, qint64 count);
+    void append(double x, double y);
+
+    qint64 size() const;
+    double x(qint64 index) const;
+    double y(qint64 index) const;
+    bool sortedX() const { return uniform ? dx > 0 : sorted; }
+    qint64 lowerBound(double x) const;
+    void minMaxY(qint64 from, qint64 to, double& min, double& max) const;
+    void envelopeY(qint64 from, qint64 to, double& min, double& max, double& first, double& last) const;
+    void readX(qint64 from, qint64 count, double* out) const;
+    void readY(qint64 from, qint64 count, double* out) const;
+    bool uniformX(double& x0, double& dx) const;
+    void sums(qint64 from, qint64 to, double& sum, double& sumSquares) const;
+    void scanRaw(qint64 from, qint64 to, double& min, double& max) const;
+    void sumRaw(qint64 from, qint64 to, double& sum, double& sumSquares) const;
+
+    // Bytes used by the samples, including the summaries
+    qint64 memoryUsage() const;
+    // Ranges over more blocks than this are answered from the block summaries
+    void setExactBlocks(qint64 exactBlocks) { this->exactBlocks = exactBlocks; }
+
+protected:
+    struct Block {
+        QByteArray data;
+        double firstX;
+        double lastX;
+        double firstY;
+        double lastY;
+        double min;
+        double max;
+    };
+
+    struct DecodedBlock {
+        qint64 block;
+        quint64 used;
+        QVector<double> x;
+        QVector<double> y;
+    };
+
+    void sealBlock();
+    void wholeBlocks(qint64& from, qint64& to) const;
+    const DecodedBlock& decode(qint64 block) const;
+    static QByteArray encode(const double* x, const double* y, int count);
+    static void decode(const QByteArray& data, int count, double* x, double* y);
+
+    QVector<Block> blocks;
+    QVector<double> openX;
+    QVector<double> openY;
+    bool uniform;
+    double x0;
+    double dx;
+    bool sorted;
+    qint64 exactBlocks;
+    QGraphRangeIndex index;
+    mutable DecodedBlock cache[CacheBlocks];
+    mutable quint64 cacheClock;
+};
+
+class QGraphMappedSummary;
+
+/*
+  A file mapped into memory. The file is never read as a whole, the
+  operating system loads the pages on first access. The summaries of
+  its samples are kept with the file, so all channel sources share them.
+ */
+class QGraphMappedFile
+{
+public:
+    explicit QGraphMappedFile(const QString& fileName);
+    ~QGraphMappedFile();
+
+    bool isValid() const { return data != 0; }
+    const uchar* constData() const { return data; }
+    qint64 size() const { return length; }
+    void prefetch(qint64 offset, qint64 length) const;
+
+private:
+    Q_DISABLE_COPY(QGraphMappedFile)
+    friend class QGraphMappedSummary;
+
+    QFile file;
+    uchar* data;
+    qint64 length;
+    QMutex summaryMutex;
+    QList< QSharedPointer<QGraphMappedSummary> > summaries;
+};
+
+class QGraphMappedSource : public QGraphDataSource
+{
+public:
+    enum SampleType {
+        Int8,
+        UInt8,
+        Int16,
+        UInt16,
+        Int32,
+        UInt32,
+        Float32,
+        Float64
+    };
+
+    QGraphMappedSource(QSharedPointer<QGraphMappedFile> file, SampleType type, int channels, int channel, double sampleRate, Layout layout = Interleaved, qint64 headerBytes = 0);
+
+    static int sampleSize(SampleType type);
+
+    qint64 size() const { return samples; }
+    double x(qint64 index) const { return index/sampleRate; }
+    double y(qint64 index) const;
+    bool threadSafe() const { return true; }
+    qint64 lowerBound(double x) const;
+    void minMaxX(qint64 from, qint64 to, double& min, double& max) const;
+    void minMaxY(qint64 from, qint64 to, double& min, double& max) const;
+    bool uniformX(double& x0, double& dx) const;
+    void viewChanged(qint64 from, qint64 to);
+    void sums(qint64 from, qint64 to, double& sum, double& sumSquares) const;
+    void scanRaw(qint64 from, qint64 to, double& min, double& max) const;
+    void sumRaw(qint64 from, qint64 to, double& sum, double& sumSquares) const;
+
+    // Ranges longer than this are answered from the file summary
+    void setExactLimit(qint64 exactLimit) { this->exactLimit = exactLimit; }
+    // Converts the raw samples to physical units: raw*scale+offset
+    void setScale(double scale, double offset) { this->scale = scale; this->offset = offset; }
+
+protected:
+    enum {
+        // Samples per run when a long range is probed
+        ProbeRun = 4096
+    };
+
+    const uchar* sampleAt(qint64 index) const { return base + index*stride; }
+    void prefetchSamples(qint64 from, qint64 to) const;
+
+    QSharedPointer<QGraphMappedFile> file;
+    QSharedPointer<QGraphMappedSummary> summary;
+    int channel;
+    SampleType type;
+    double sampleRate;
+    double scale;
+    double offset;
+    const uchar* base;
+    qint64 stride;
+    qint64 samples;
+    qint64 exactLimit;
+    qint64 viewFrom, viewTo;
+};
+
+class QGraph;
+
+/*
+  Block summaries of all channels of a mapped file in one sample layout.
+  They are built in one pass over the file on the scheduler pool, the
+  channel sources answer long ranges approximately until they are ready.
+ */
+class QGraphMappedSummary
+{
+public:
+    enum {
+        // A block summarizes 2^BlockBits samples of a channel
+        BlockBits = 12
+    };
+
+    // Summary of file in this layout, created on first use
+    static QSharedPointer<QGraphMappedSummary> of(const QSharedPointer<QGraphMappedFile>& file, QGraphMappedSource::SampleType type, int channels, QGraphDataSource::Layout layout, qint64 headerBytes);
+
+    qint64 size() const { return samples; }
+    const uchar* channelData(int channel) const { return base + channel*channelOffset; }
+    qint64 stride() const { return frameStride; }
+
+    bool isReady() const;
+    // Starts the summary on the scheduler pool unless it is ready or running, graph is redrawn when it is done
+    static void start(const QSharedPointer<QGraphMappedSummary>& summary, QGraph* graph);
+    // Summary of one channel, only valid once isReady()
+    const QGraphRangeIndex& channel(int channel) const { return *indexes[channel]; }
+
+private:
+    friend class QGraphMappedSummaryTask;
+
+    QGraphMappedSummary(const QSharedPointer<QGraphMappedFile>& file, QGraphMappedSource::SampleType type, int channels, QGraphDataSource::Layout layout, qint64 headerBytes);
+    void build();
+
+    QWeakPointer<QGraphMappedFile> file;
+    QGraphMappedSource::SampleType type;
+    int channels;
+    QGraphDataSource::Layout layout;
+    qint64 headerBytes;
+    const uchar* base;
+    qint64 channelOffset;
+    qint64 frameStride;
+    qint64 samples;
+    QList< QSharedPointer<QGraphRangeIndex> > indexes;
+    mutable QMutex mutex;
+    bool running;
+    bool ready;
+    QList<QGraph*> waiting;
+};
+
+struct qgraph_shm_header;
+
+/*
+  Read-only attachment to a POSIX shared-memory ring written by another
+  process through the C producer library, see QGraphShm.h for the
+  layout. The samples are read in place.
+ */
+class QGraphSharedRing
+{
+public:
+    explicit QGraphSharedRing(const QString& name);
+    ~QGraphSharedRing();
+
+    bool isValid() const { return header != 0; }
+    QGraphMappedSource::SampleType type() const { return sampleType; }
+    int channels() const { return channelCount; }
+    qint64 capacity() const { return frameCapacity; }
+    double sampleRate() const { return rate; }
+    const uchar* frames() const { return data + dataOffset; }
+    quint64 writeIndex() const;
+
+private:
+    Q_DISABLE_COPY(QGraphSharedRing)
+    uchar* data;
+    qint64 length;
+    const qgraph_shm_header* header;
+    QGraphMappedSource::SampleType sampleType;
+    int channelCount;
+    qint64 frameCapacity;
+    double rate;
+    qint64 dataOffset;
+};
+
+/*
+  One channel of a QGraphSharedRing. Index 0 is the oldest frame that is
+  still safe to read, the x coordinate is the absolute frame number
+  divided by the sample rate, so the trace scrolls as the producer
+  writes. The window is only moved by sync().
+ */
+class QGraphSharedSource : public QGraphDataSource
+{
+public:
+    QGraphSharedSource(QSharedPointer<QGraphSharedRing> ring, int channel);
+
+    qint64 size() const { return count; }
+    double x(qint64 index) const { return (first+index)/sampleRate; }
+    double y(qint64 index) const;
+    qint64 lowerBound(double x) const;
+    void minMaxX(qint64 from, qint64 to, double& min, double& max) const;
+    void minMaxY(qint64 from, qint64 to, double& min, double& max) const;
+    bool uniformX(double& x0, double& dx) const;
+    bool sync();
+
+    // Converts the raw samples to physical units: raw*scale+offset
+    void setScale(double scale, double offset) { this->scale = scale; this->offset = offset; }
+
+private:
+    const uchar* sampleAt(qint64 index) const { return base + ((first+index)%capacity)*stride; }
+
+    QSharedPointer<QGraphSharedRing> ring;
+    QGraphMappedSource::SampleType type;
+    double sampleRate;
+    double scale;
+    double offset;
+    const uchar* base;
+    qint64 stride;
+    qint64 capacity;
+    qint64 window;
+    quint64 written;
+    qint64 first;
+    qint64 count;
+};
+
+/*
+  QGraph recording files. All numbers are little endian and every
+  structure starts at a multiple of 8 bytes, so the file is used in
+  place through a memory mapping.
+
+    FileHeader
+    TraceHeader * traceCount
+    chunk records, written while recording: ChunkHeader followed by the
+      payload, the x values (unless uniform) and then the y values as
+      doubles, qCompress()ed if the Compressed flag is set, padded to 8
+    for every trace: ChunkEntry * chunkCount, then the summary levels
+    TraceIndex * traceCount
+    Footer
+
+  Summary level k holds the min/max and the sums of y and y*y of
+  LevelFanout^k consecutive chunks, the chunk entries are level 0.
+  Every chunk of a trace holds chunkSize samples except the last one. A
+  file without footer (the recording was interrupted) is recovered by
+  scanning the chunk records.
+ */
+class QGraphRecording
+{
+public:
+    enum {
+        Version = 2,
+        Compressed = 1,
+        Unsorted = 1,
+        LevelFanout = 16,
+        MaxLevels = 8
+    };
+
+    struct FileHeader {
+        char magic[8];
+        quint32 version;
+        quint32 traceCount;
+        quint32 chunkSize;
+        quint32 flags;
+        quint64 reserved[5];
+    };
+
+    struct TraceHeader {
+        quint32 uniform;
+        quint32 style;
+        double x0;
+        double dx;
+        double barWidth;
+        double penWidth;
+        quint32 penColor;
+        quint32 brushColor;
+        quint64 reserved[2];
+    };
+
+    struct ChunkHeader {
+        quint32 magic;
+        quint32 trace;
+        quint32 count;
+        quint32 flags;
+        quint64 payloadBytes;
+        double firstX;
+        double lastX;
+        double min;
+        double max;
+        double sum;
+        double sumSquares;
+    };
+
+    struct ChunkEntry {
+        quint64 offset;
+        quint32 count;
+        quint32 flags;
+        double firstX;
+        double lastX;
+        double min;
+        double max;
+        double sum;
+        double sumSquares;
+    };
+
+    struct LevelEntry {
+        double min;
+        double max;
+        double sum;
+        double sumSquares;
+    };
+
+    struct TraceIndex {
+        quint64 chunkCount;
+        quint64 sampleCount;
+        quint64 directoryOffset;
+        quint32 levelCount;
+        quint32 flags;
+        quint64 levelOffset[MaxLevels];
+    };
+
+    struct Footer {
+        quint64 indexOffset;
+        quint32 traceCount;
+        quint32 reserved;
+        char magic[8];
+        quint64 reserved2;
+    };
+
+    static QSharedPointer<QGraphRecording> open(const QString& fileName);
+
+    int traceCount() const { return traces.size(); }
+    const TraceHeader& traceHeader(int trace) const { return traces[trace].header; }
+    qint64 sampleCount(int trace) const { return traces[trace].sampleCount; }
+    bool isSorted(int trace) const { return traces[trace].sorted; }
+    qint64 chunkSize() const { return chunk; }
+    bool isRecovered() const { return recovered; }
+
+    const ChunkEntry& chunkEntry(int trace, qint64 chunk) const { return traces[trace].directory[chunk]; }
+    qint64 chunkCount(int trace) const { return traces[trace].chunkCount; }
+    // The decoded values of a chunk as doubles, x is empty for uniform
+    // traces. The arrays share the data with the cache and stay valid
+    // when the chunk is evicted.
+    QByteArray chunkX(int trace, qint64 chunk) const;
+    QByteArray chunkY(int trace, qint64 chunk) const;
+    void chunkRangeMinMax(int trace, qint64 from, qint64 to, double& min, double& max) const;
+    void chunkRangeSums(int trace, qint64 from, qint64 to, double& sum, double& sumSquares) const;
+
+    static void buildLevels(const ChunkEntry* directory, qint64 chunkCount, QVector< QVector<LevelEntry> >& levels);
+
+private:
+    QGraphRecording();
+    Q_DISABLE_COPY(QGraphRecording)
+    bool load(const QString& fileName);
+    bool loadIndex();
+    bool recover();
+    bool validChunk(int trace, const ChunkEntry& entry, qint64 dataStart) const;
+    QByteArray chunkValues(int trace, qint64 chunk, bool y) const;
+
+    struct Trace {
+        TraceHeader header;
+        qint64 sampleCount;
+        qint64 chunkCount;
+        bool sorted;
+        const ChunkEntry* directory;
+        QVector<const LevelEntry*> levels;
+        QVector<ChunkEntry> ownDirectory;
+        QVector< QVector<LevelEntry> > ownLevels;
+    };
+
+    struct CachedChunk {
+        int trace;
+        qint64 chunk;
+        quint64 used;
+        QByteArray x;
+        QByteArray y;
+    };
+
+    QSharedPointer<QGraphMappedFile> file;
+    QVector<Trace> traces;
+    qint64 chunk;
+    bool recovered;
+    mutable QMutex cacheMutex;
+    mutable QVector<CachedChunk> cache;
+    mutable quint64 cacheClock;
+};
+
+/*
+  Writes a recording file while the samples arrive. Full chunks are
+  written immediately, the index and the summary levels when the file
+  is closed.
+ */
+class QGraphRecordingWriter
+{
+public:
+    QGraphRecordingWriter();
+    ~QGraphRecordingWriter();
+
+    // Traces have to be added before the file is opened, dx <= 0 means x is stored
+    int addTrace(double x0 = 0.0, double dx = 0.0);
+    void setTraceStyle(int trace, int style, double barWidth, QRgb penColor, double penWidth, QRgb brushColor);
+
+    bool open(const QString& fileName, int chunkSize = 4096, bool compress = false);
+    bool append(int trace, const double* x, const double* y, qint64 count);
+    bool close();
+    bool isOpen() const { return file.isOpen(); }
+
+private:
+    Q_DISABLE_COPY(QGraphRecordingWriter)
+    bool writeChunk(int trace);
+    bool writePadded(const char* data, qint64 size);
+
+    struct Trace {
+        QGraphRecording::TraceHeader header;
+        QVector<double> x;
+        QVector<double> y;
+        QVector<QGraphRecording::ChunkEntry> directory;
+        qint64 sampleCount;
+        bool sorted;
+    };
+
+    QFile file;
+    QVector<Trace> traces;
+    int chunkSize;
+    bool compress;
+    bool failed;
+};
+
+class QGraphFileSource : public QGraphDataSource
+{
+public:
+    QGraphFileSource(QSharedPointer<QGraphRecording> recording, int trace);
+
+    qint64 size() const { return samples; }
+    double x(qint64 index) const;
+    double y(qint64 index) const;
+    bool sortedX() const;
+    bool threadSafe() const { return true; }
+    qint64 lowerBound(double x) const;
+    void minMaxY(qint64 from, qint64 to, double& min, double& max) const;
+    void sums(qint64 from, qint64 to, double& sum, double& sumSquares) const;
+    void readX(qint64 from, qint64 count, double* out) const;
+    void readY(qint64 from, qint64 count, double* out) const;
+    bool uniformX(double& x0, double& dx) const;
+
+    // Ranges over more chunks than this are answered from the chunk summaries
+    void setExactChunks(qint64 exactChunks) { this->exactChunks = exactChunks; }
+
+protected:
+    QSharedPointer<QGraphRecording> recording;
+    int trace;
+    qint64 samples;
+    qint64 chunkSize;
+    bool uniform;
+    double x0;
+    double dx;
+    qint64 exactChunks;
+};
+
+/*
+  Trace derived from another one by a filter. The samples are computed
+  lazily in chunks when they are read, so only the visible part is ever
+  filtered, and kept in a small LRU cache. The min/max and sums of every
+  complete chunk outlive the cached samples, so zoomed out views are
+  answered from these summaries. The filters are causal: a sample does
+  not change once its inputs exist, so appending to the source only
+  extends the last chunk.
+ */
+class QGraphDerivedSource : public QGraphDataSource
+{
+public:
+    enum Filter {
+        MovingAverage,
+        Fir,
+        Iir,
+        Difference,
+        Resample
+    };
+
+    enum {
+        ChunkSize = 4096,
+        CacheChunks = 64
+    };
+
+    // Mean of the last length samples
+    static QSharedPointer<QGraphDerivedSource> movingAverage(QSharedPointer<QGraphDataSource> source, int length);
+    // y[i] = sum of coefficients[k]*x[i-k]
+    static QSharedPointer<QGraphDerivedSource> fir(QSharedPointer<QGraphDataSource> source, const QVector<double>& coefficients);
+    // Transfer function b(z)/a(z), a[0] must not be 0
+    static QSharedPointer<QGraphDerivedSource> iir(QSharedPointer<QGraphDataSource> source, const QVector<double>& b, const QVector<double>& a);
+    // dy/dx between neighbouring samples, drawn at the right one
+    static QSharedPointer<QGraphDerivedSource> difference(QSharedPointer<QGraphDataSource> source);
+    // Mean of each group of factor samples, drawn at the group center
+    static QSharedPointer<QGraphDerivedSource> resample(QSharedPointer<QGraphDataSource> source, int factor);
+
+    qint64 size() const;
+    double x(qint64 index) const;
+    double y(qint64 index) const;
+    bool sortedX() const { return source->sortedX(); }
+    bool threadSafe() const { return source->threadSafe(); }
+    void minMaxY(qint64 from, qint64 to, double& min, double& max) const;
+    void envelopeY(qint64 from, qint64 to, double& min, double& max, double& first, double& last) const;
+    void sums(qint64 from, qint64 to, double& sum, double& sumSquares) const;
+    void readY(qint64 from, qint64 count, double* out) const;
+    bool uniformX(double& x0, double& dx) const;
+
+    // Ranges over more chunks than this are answered from the chunk summaries
+    void setExactChunks(qint64 exactChunks) { this->exactChunks = exactChunks; }
+
+protected:
+    QGraphDerivedSource(QSharedPointer<QGraphDataSource> source, Filter filter, const QVector<double>& b, const QVector<double>& a, int factor);
+
+    struct Summary {
+        double min;
+        double max;
+        double sum;
+        double sumSquares;
+        double first;
+        double last;
+    };
+
+    struct CachedChunk {
+        qint64 chunk;
+        quint64 used;
+        QVector<double> y;
+    };
+
+    const QVector<double>& chunkY(qint64 chunk) const;
+    void rangeY(qint64 from, qint64 to, double& min, double& max, double& first, double& last) const;
+    void compute(qint64 chunk, qint64 count, QVector<double>& out) const;
+    void runIir(const double* in, qint64 count, QVector<double>& state, double* out) const;
+
+    QSharedPointer<QGraphDataSource> source;
+    Filter filter;
+    QVector<double> b;
+    QVector<double> a;
+    int factor;
+    qint64 exactChunks;
+    mutable QMutex mutex;
+    mutable QVector<CachedChunk> cache;
+    mutable quint64 cacheClock;
+    mutable QHash<qint64, Summary> summaries;
+    mutable QVector< QVector<double> > states;
+};
+
+/*
+  Level of detail for curves with unsorted x, e.g. XY phase plots, which
+  cannot be decimated per pixel column. Every point gets the tolerance
+  down to which Ramer-Douglas-Peucker keeps it, measured in coordinates
+  normalized to the data range. Each level keeps the points above a
+  tolerance, the tolerance halves from level to level, so the renderer
+  can pick the coarsest level with an error below half a pixel.
+ */
+class QGraphCurveLod
+{
+public:
+    explicit QGraphCurveLod(const QGraphDataSource* source);
+
+    qint64 sourceSize() const { return size; }
+    // Indices of the coarsest level with an error below maxError pixels, 0 if all points are needed
+    const QVector<qint64>* level(double pixelWidth, double pixelHeight, double maxError = 0.5) const;
+
+private:
+    qint64 size;
+    double width;
+    double height;
+    QVector<double> tolerances;
+    QVector< QVector<qint64> > levels;
+};
+
+/*
+  Keeps the levels of one unsorted curve up to date. Once a curve has
+  levels, those for a grown source are built on the scheduler pool and
+  the previous levels are drawn until they are done. The first levels,
+  and all levels of sources that are not threadSafe(), are built at once.
+ */
+class QGraphCurveLodBuilder
+{
+public:
+    QGraphCurveLodBuilder();
+
+    // Newest levels of source, they may cover fewer samples than it holds now
+    static QSharedPointer<QGraphCurveLod> levels(const QSharedPointer<QGraphCurveLodBuilder>& builder, const QSharedPointer<QGraphDataSource>& source, QGraph* graph);
+
+private:
+    friend class QGraphCurveLodTask;
+
+    QMutex mutex;
+    QSharedPointer<QGraphCurveLod> ready;
+    QWeakPointer<QGraphDataSource> readySource;
+    bool running;
+};
+
+/*
+  Matrix of values shown as an image, e.g. a spectrogram. Values are
+  colour mapped once when they arrive and kept in an image, so drawing
+  is one blit of the visible part. The image holds every row twice and
+  the rows on screen are one contiguous window of it: pushRow() moves
+  the window up by one row and only maps the new row into both copies.
+  Row 0 is the oldest and is drawn at y0, the newest row at the top.
+ */
+class QGraphWaterfall
+{
+public:
+    QGraphWaterfall(int columns, int rows, double x0 = 0.0, double dx = 1.0, double y0 = 0.0, double dy = 1.0);
+
+    void setRange(double min, double max);
+    void setColors(const QVector<QColor>& colors);
+    // rows*columns values, row by row from the oldest
+    void setMatrix(const double* values);
+    void pushRow(const double* values);
+    void clear();
+
+    int columns() const { return columnCount; }
+    int rows() const { return rowCount; }
+    QRectF rect() const { return QRectF(x0, y0, columnCount*dx, rowCount*dy); }
+    const QImage& image() const { return buffer; }
+    QRect window() const { return QRect(0, head, columnCount, rowCount); }
+
+protected:
+    void mapRow(const double* values, int row);
+
+    int columnCount;
+    int rowCount;
+    double x0;
+    double dx;
+    double y0;
+    double dy;
+    double min;
+    double max;
+    QVector<QRgb> lut;
+    QImage buffer;
+    int head;
+};
+
+class QGraphImportTask;
+
+/*
+  Imports CSV or raw binary files in parallel. The file is split into
+  blocks which are parsed on the global thread pool, finished blocks
+  are appended in file order to one chunked source per column, so the
+  data can be displayed while the import is still running.
+ */
+class QGraphImporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QGraphImporter(QObject* parent = 0);
+    ~QGraphImporter();
+
+    // xColumn < 0 uses the row number as x, every other column becomes a source
+    bool startCsv(const QString& fileName, int xColumn = 0);
+    bool startBinary(const QString& fileName, QGraphMappedSource::SampleType type, int channels, double sampleRate, qint64 headerBytes = 0);
+    void cancel();
+    bool isRunning() const;
+    void waitForFinished();
+
+    const QVector< QSharedPointer<QGraphChunkedSource<double> > >& sources() const { return columnSources; }
+    void setBlockBytes(qint64 blockBytes) { this->blockBytes = qMax(blockBytes, qint64(4096)); }
+
+    static bool parseDouble(const char* begin, const char* end, double& value);
+
+signals:
+    void progress(qint64 bytesDone, qint64 bytesTotal);
+    void dataAvailable();
+    void finished(bool completed);
+
+protected:
+    friend class QGraphImportTask;
+
+    enum Format {
+        Csv,
+        Binary
+    };
+
+    struct Block {
+        QVector<double> x;
+        QVector<double> values;
+        qint64 rows;
+        qint64 bytes;
+    };
+
+    bool open(const QString& fileName);
+    void start(qint64 dataBytes, qint64 alignment);
+    void runBlock(int block);
+    void parseCsv(qint64 from, qint64 to, Block& block) const;
+    void parseBinary(qint64 from, qint64 to, Block& block) const;
+    void blockDone(int index, const Block& block);
+    int splitCsvLine(const char* line, const char* end, double* values) const;
+
+    Format format;
+    QSharedPointer<QGraphMappedFile> file;
+    QVector< QSharedPointer<QGraphChunkedSource<double> > > columnSources;
+    qint64 blockBytes;
+    qint64 dataStart;
+    qint64 dataEnd;
+    qint64 alignment;
+    int blockCount;
+
+    char delimiter;
+    int columns;
+    int xColumn;
+    QGraphMappedSource::SampleType type;
+    int channels;
+
+    mutable QMutex mutex;
+    QWaitCondition idle;
+    QHash<int, Block> pending;
+    int nextBlock;
+    int remaining;
+    int running;
+    qint64 bytesDone;
+    QAtomicInt cancelled;
+};
+
+/*
+  Scope style trigger in front of the trace storage. The acquisition
+  thread feeds blocks of samples, which are searched for the trigger
+  condition a block at a time, not sample by sample. Only the window of
+  pre and post trigger samples around each trigger is kept and
+  published as a new source with x = 0 at the trigger sample. The GUI
+  thread is notified by a queued signal which is not repeated until
+  the capture has been fetched, so fast triggers never flood the event
+  loop, the GUI just shows the latest capture.
+ */
+class QGraphTrigger : public QObject
+{
+    Q_OBJECT
+public:
+    enum Mode {
+        Edge,   // Fires when the level is crossed after the signal was beyond the hysteresis
+        Level   // Fires whenever the signal is at or beyond the level
+    };
+
+    enum Slope {
+        Rising,
+        Falling
+    };
+
+    explicit QGraphTrigger(double dx = 1.0, QObject* parent = 0);
+
+    void setMode(Mode mode, Slope slope = Rising);
+    void setLevel(double level, double hysteresis = 0.0);
+    void setWindow(int preSamples, int postSamples);
+    void setHoldoff(qint64 samples);
+    void reset();
+
+    void feed(const double* data, qint64 count);
+    void feed(const QVector<double>& data) { feed(data.constData(), data.size()); }
+
+    QSharedPointer<QGraphDataSource> capture();
+    qint64 captureCount() const;
+
+signals:
+    void captureReady();
+
+protected:
+    enum State {
+        Disarmed,
+        Armed,
+        Capturing,
+        Holding
+    };
+
+    void startCapture(const double* data, qint64 at);
+    void keepHistory(const double* data, qint64 count);
+
+    mutable QMutex mutex;
+    Mode mode;
+    Slope slope;
+    double level;
+    double hysteresis;
+    int preSamples;
+    int postSamples;
+    qint64 holdoff;
+    double dx;
+
+    State state;
+    QVector<double> history;
+    QVector<double> window;
+    int windowPre;
+    qint64 holdoffLeft;
+    qint64 captures;
+    QSharedPointer<QGraphDataSource> lastCapture;
+    QAtomicInt notified;
+};
+
+class QGraphSpectrumTask;
+
+/*
+  Spectrum of another trace, computed on the thread pool. The source is
+  cut into segments of size samples, which overlap by half when several
+  are averaged (Welch). The power of each segment is cached, so while
+  the source grows only the new segments are transformed. The result
+  is published as a new source, fetching it never waits for the
+  computation. Sources that are not threadSafe() are never read by the
+  pool: update() copies the samples of the segments on the calling
+  thread.
+ */
+class QGraphSpectrum : public QObject
+{
+    Q_OBJECT
+public:
+    enum Window {
+        Rectangular,
+        Hann,
+        Hamming,
+        Blackman
+    };
+
+    enum Scale {
+        Linear,
+        Decibel
+    };
+
+    explicit QGraphSpectrum(QSharedPointer<QGraphDataSource> source, int size = 1024, Window window = Hann, int averages = 1, QObject* parent = 0);
+    ~QGraphSpectrum();
+
+    void setSource(QSharedPointer<QGraphDataSource> source);
+    void setSize(int size);
+    void setWindow(Window window);
+    void setAverages(int averages);
+    void setScale(Scale scale);
+    void setUpdateInterval(int ms);
+
+    QSharedPointer<QGraphDataSource> spectrum();
+    bool isRunning() const;
+    void waitForFinished();
+
+public slots:
+    void update();
+
+signals:
+    void spectrumReady();
+
+protected:
+    friend class QGraphSpectrumTask;
+
+    void timerEvent(QTimerEvent* event);
+    void configure();
+    void run();
+    void segments(qint64 size, QVector<qint64>& starts) const;
+    void takeSnapshot();
+
+    mutable QMutex mutex;
+    QWaitCondition idle;
+    QSharedPointer<QGraphDataSource> source;
+    int fftSize;
+    Window window;
+    int averages;
+    Scale scale;
+    int timerId;
+    qint64 lastSize;
+    bool running;
+    bool pending;
+    QAtomicInt generation;
+    QHash<qint64, QVector<double> > cache;
+    QSharedPointer<QGraphDataSource> result;
+    QAtomicInt notified;
+    // Samples [snapshotFrom, snapshotSize) of a source that is not thread safe
+    QVector<double> snapshot;
+    qint64 snapshotFrom;
+    qint64 snapshotSize;
+    double snapshotDx;
+};
+
+/*
+  Process-wide render scheduler that every QGraph registers with. Work
+  that is not a direct answer to user input (resizes, new data from
+  importers, triggers, spectra and shared memory) is queued here and
+  done from the event loop, focused widgets first, then visible ones,
+  until the frame budget is used up. The rest is spread over the next
+  frames. Hidden and fully covered widgets keep their request until
+  they are painted again. The background work of QGraphImporter and
+  QGraphSpectrum runs on the shared pool().
+ */
+class QGraphScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    enum Work {
+        NoWork,
+        Redraw,
+        // Refresh that keeps a view the user chose during an import
+        Import,
+        Refresh
+    };
+
+    static QGraphScheduler* instance();
+
+    QThreadPool* pool() { return &workers; }
+    void setFrameBudget(int ms);
+    int getFrameBudget() const { return frameBudget; }
+    void setFrameInterval(int ms);
+    int getFrameInterval() const { return frameInterval; }
+
+    void request(QGraph* graph, Work work);
+    void exposed(QGraph* graph);
+    void registerGraph(QGraph* graph);
+    void unregisterGraph(QGraph* graph);
+
+protected:
+    void timerEvent(QTimerEvent* event);
+
+private slots:
+    // Queued by pool work whose result graph has to show
+    void redraw(QGraph* graph);
+
+private:
+    QGraphScheduler();
+    void wake(int delay);
+    int priority(QGraph* graph) const;
+
+    QThreadPool workers;
+    QVector<QGraph*> graphs;
+    QHash<QGraph*, Work> pending;
+    int frameBudget;
+    int frameInterval;
+    int timerId;
+};
+
+/*
+  Links the x axes of several graphs, e.g. stacked plots over a common
+  time axis. A zoom or pan on one graph is applied to the others in one
+  pass from the event loop, so a burst of wheel or pan events renders
+  each graph once. The x ticks of the common range are computed once.
+  Traces can be shared by appending the same source to several graphs
+  (see QGraph::getSource()), the simplified levels of unsorted curves
+  are then built once and shared as well.
+ */
+class QGraphAxisGroup : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QGraphAxisGroup(QObject* parent = 0);
+
+    void addGraph(QGraph* graph);
+    void removeGraph(QGraph* graph);
+    QList<QGraph*> graphs() const;
+
+    QSharedPointer<QGraphCurveLodBuilder> curveLod(QSharedPointer<QGraphDataSource> source);
+
+protected:
+    friend class QGraph;
+
+    void timerEvent(QTimerEvent* event);
+    void follow(QGraph* leader);
+    void fullX(QGraph* graph);
+    const QVector<double>& ticks(QGraph* graph, double min, double max);
+
+    struct SharedLod {
+        QWeakPointer<QGraphDataSource> source;
+        QWeakPointer<QGraphCurveLodBuilder> lod;
+    };
+
+    QList< QPointer<QGraph> > members;
+    QPointer<QGraph> leader;
+    double left;
+    double width;
+    int timerId;
+    double ticksMin;
+    double ticksMax;
+    QVector<double> tickCache;
+    QHash<const QGraphDataSource*, SharedLod> lods;
+};
 
 class QGraph : public QWidget
 {
@@ -46,27 +2015,109 @@ public:
     enum GraphStyle {
         Line,
         Bar,
-        Stem
+        Stem,
+        Envelope,
+        Scatter
+    };
+
+    // Line drawn on top of an Envelope trace
+    enum EnvelopeLine {
+        NoEnvelopeLine,
+        MeanLine,
+        LastValueLine
     };
 
     struct LineInfo {
-        QVector<double> xData;
-        QVector<double> yData;
+        LineInfo() : style(Line), barWidth(0.9), envelopeLine(NoEnvelopeLine) {}
+        QSharedPointer<QGraphDataSource> source;
         QPen pen;
         QBrush brush;
         GraphStyle style;
         double barWidth;
+        EnvelopeLine envelopeLine;
+        QPointer<QGraphTrigger> trigger;
+        QPointer<QGraphSpectrum> spectrum;
+        QVector<QRgb> scatterPalette;
+        QVector<quint8> scatterColors;
+        QVector<quint8> scatterSizes;
+        QSharedPointer<QGraphCurveLodBuilder> lod;
+    };
+
+    struct Statistics {
+        qint64 count;
+        double mean;
+        double rms;
+        double min;
+        double max;
+    };
+
+    struct FrameStats {
+        qint64 frame;
+        double layoutMs;
+        double geometryMs;
+        double renderMs;
+        double paintMs;
+        double totalMs;
     };
 
     void setAntializing(bool antializing);
     void setGrid(bool grid);
     void clearData();
     void setData(QVector<double> xData, QVector<double> yData, GraphStyle style = Line, double barWidth = 0.9, QPen pen = QPen(Qt::black,0), QBrush brush = QBrush(Qt::transparent));
-    void setData(QVector< QVector<double> > xData, QVector< QVector<double> > yData, QVector<GraphStyle> styles = QVector<GraphStyle>(), QVector<double> barWidths = QVector<double>(), QVector<QPen> pens = QVector<QPen>(), QVector<QBrush> brushes = QVector<QBrush>());
+    void setData(const QVector< QVector<double> >& xData, const QVector< QVector<double> >& yData, const QVector<GraphStyle>& styles = QVector<GraphStyle>(), const QVector<double>& barWidths = QVector<double>(), const QVector<QPen>& pens = QVector<QPen>(), const QVector<QBrush>& brushes = QVector<QBrush>());
+    template<typename T>
+    int setChannelData(const QVector<T>& data, int channels, QGraphDataSource::Layout layout, double x0, double dx, double scale = 1.0, double offset = 0.0, const QVector<QPen>& pens = QVector<QPen>());
+    template<typename T>
+    int setChannelData(const T* data, int channels, qint64 samples, QGraphDataSource::Layout layout, double x0, double dx, double scale = 1.0, double offset = 0.0, const QVector<QPen>& pens = QVector<QPen>());
     void appendData(QVector<double> xData, QVector<double> yData, GraphStyle style = Line, double barWidth = 0.9, QPen pen = QPen(Qt::black,0), QBrush brush = QBrush(Qt::transparent));
+    template<typename T>
+    void appendSamples(const QVector<double>& xData, const QVector<T>& yData, double scale = 1.0, double offset = 0.0, GraphStyle style = Line, double barWidth = 0.9, QPen pen = QPen(Qt::black,0), QBrush brush = QBrush(Qt::transparent))
+    {
+        appendSource(QSharedPointer<QGraphDataSource>(new QGraphSampleSource<T>(xData, yData, scale, offset)), style, barWidth, pen, brush);
+    }
+    void appendUniformData(double x0, double dx, QVector<double> yData, GraphStyle style = Line, double barWidth = 0.9, QPen pen = QPen(Qt::black,0), QBrush brush = QBrush(Qt::transparent));
+    template<typename T>
+    void appendUniformSamples(double x0, double dx, const QVector<T>& yData, double scale = 1.0, double offset = 0.0, GraphStyle style = Line, double barWidth = 0.9, QPen pen = QPen(Qt::black,0), QBrush brush = QBrush(Qt::transparent))
+    {
+        appendSource(QSharedPointer<QGraphDataSource>(new QGraphSampleSource<T>(x0, dx, yData, scale, offset)), style, barWidth, pen, brush);
+    }
+    void appendSource(QSharedPointer<QGraphDataSource> source, GraphStyle style = Line, double barWidth = 0.9, QPen pen = QPen(Qt::black,0), QBrush brush = QBrush(Qt::transparent));
+    QSharedPointer<QGraphDataSource> getSource(int set);
+    int appendWaterfall(QSharedPointer<QGraphWaterfall> waterfall);
+    void pushWaterfallRow(int waterfall, const QVector<double>& row);
+    void setEnvelopeLine(int set, EnvelopeLine envelopeLine);
+    void setScatterPoints(int set, const QVector<QColor>& palette, const QVector<quint8>& colorIndices = QVector<quint8>(), const QVector<quint8>& sizes = QVector<quint8>());
+    bool saveRecording(QString fileName, bool compress = false);
+    int loadRecording(QString fileName);
+    int appendMappedFile(QString fileName, QGraphMappedSource::SampleType type, int channels, double sampleRate, QGraphMappedSource::Layout layout = QGraphMappedSource::Interleaved, qint64 headerBytes = 0, QVector<QPen> pens = QVector<QPen>());
+    int appendSharedMemory(QString name, QVector<QPen> pens = QVector<QPen>(), int pollInterval = 16);
+    QGraphImporter* importCsv(QString fileName, int xColumn = 0, QVector<QPen> pens = QVector<QPen>());
+    QGraphImporter* importBinary(QString fileName, QGraphMappedSource::SampleType type, int channels, double sampleRate, qint64 headerBytes = 0, QVector<QPen> pens = QVector<QPen>());
+    void appendTrigger(QGraphTrigger* trigger, QPen pen = QPen(Qt::black,0));
+    void appendSpectrum(QGraphSpectrum* spectrum, QPen pen = QPen(Qt::black,0));
 
     void useLimit(bool limitedX, bool limitedY);
     void useZoomLimit(bool zoomLimit);
+    void zoomBack();
+    void zoomForward();
+    bool canZoomBack();
+    bool canZoomForward();
+    void setZoomHistory(int entries, qint64 cacheBytes = 64*1024*1024);
+    void clearZoomHistory();
+    void setAutoscaleY(bool autoscaleY);
+    bool getAutoscaleY();
+    Statistics visibleStatistics(int set);
+    void setStatisticsReadout(bool readout);
+    bool getStatisticsReadout();
+    void setStripChart(bool stripChart, double window = 1.0);
+    bool getStripChart();
+    QGraphAxisGroup* getAxisGroup();
+    void setPersistence(bool persistence);
+    bool getPersistence();
+    void setPersistenceDecay(double ms);
+    double getPersistenceDecay();
+    void setPersistenceColors(const QVector<QColor>& colors);
+    void clearPersistence();
     void limitX(double xmin, double xmax);
     void limitY(double ymin, double ymax);
 
@@ -98,8 +2149,41 @@ public:
     void setDefaultBorder();
     void setNoBorder();
 
+    void setFrameStatsEnabled(bool enabled);
+    bool getFrameStatsEnabled();
+    void setFrameStatsOverlay(bool overlay);
+    FrameStats frameStats();
+    bool startTrace(QString fileName);
+    void stopTrace();
+
+signals:
+    void frameRendered(const QGraph::FrameStats& stats);
+
 protected:
+    class StageTimer {
+    public:
+        StageTimer(QGraph* graph, double* stage, const char* name);
+        ~StageTimer();
+    private:
+        QGraph* graph;
+        double* stage;
+        const char* name;
+        qint64 start;
+    };
+    friend class StageTimer;
+    friend class QGraphScheduler;
+    friend class QGraphAxisGroup;
+
+    struct TraceEvent {
+        const char* name;
+        qint64 start;
+        qint64 duration;
+    };
+
     void dataMinMax();
+    void visibleRange(const QGraphDataSource* source, double left, double right, qint64& from, qint64& to);
+    bool visibleMinMaxY(const QGraphDataSource* source, double left, double right, double& min, double& max);
+    void fitY();
     void xyPoints();
     void repaint();
     void mousePressEvent(QMouseEvent* event);
@@ -109,8 +2193,23 @@ protected:
     void wheelEvent(QWheelEvent* event);
     void resizeEvent(QResizeEvent* event);
     void paintEvent(QPaintEvent* );
+    void paintWidget();
     void keyPressEvent(QKeyEvent* event);
+    void timerEvent(QTimerEvent* event);
+    void runScheduled(QGraphScheduler::Work work);
     void insertLines();
+    void insertGeometry();
+    struct Column {
+        double x;
+        double min;
+        double max;
+        double first;
+        double last;
+        qint64 from;
+        qint64 to;
+    };
+    void decimate(const QGraphDataSource* source, qint64 from, qint64 to, int columns, QVector<Column>& envelope);
+    void insertEnvelope(const LineInfo& line, qint64 from, qint64 to, bool decimated, QVector<Column>& envelope);
     void calcPoints(QVector<double>& points, double min, double max);
     void checkZoomLimit();
     int src2dstX(double srcX);
@@ -119,29 +2218,89 @@ protected:
     double dst2srcY(int dstY);
     double dst2srcW(int dstW);
     double dst2srcH(int dstH);
+    struct TextLayout {
+        TextLayout() : width(-1), height(0) {}
+        QString text;
+        QFont font;
+        int width;
+        int height;
+    };
+    int wrappedHeight(TextLayout& layout, const QString& text, const QFont& font, int width);
+    const QStaticText& tickLabel(double value);
     void textSize();
     void calcDstRect();
+    struct ViewEntry {
+        ViewEntry() : layerGeneration(0) {}
+        QRectF srcRect;
+        QImage layer;
+        QRect layerArea;
+        quint64 layerGeneration;
+    };
+    void beginViewChange();
+    void endViewChange(bool coalesce = false);
+    void storeViewLayer();
+    void showView(int index);
+    void trimViewCache();
+    void updateHistoryMenu();
     void updatePanning();
     void findGraphAt(QPoint pos);
+    void setSources(const QVector< QSharedPointer<QGraphDataSource> >& sources, const QVector<QPen>& pens);
+    void beginFrame();
+    void endFrame();
+    void updateInstrumentation();
+    void accumulatePersistence();
+    void updateStripChart();
+    void rasterizeStrip(int firstColumn);
+    void drawWaterfalls(QPainter& painter);
+    void stampScatter(const LineInfo& line, QImage& target, const QPoint& origin);
+    int scatterSprite(QRgb color, int size);
 
     QGraphicsScene* scene;
     QImage graphImage;
     QRectF srcRect;
+    QPointer<QGraphAxisGroup> axisGroup;
     QRect dstRect;
     QFont axisLabelFont;
 
     QVector<LineInfo> lines;
+    QVector< QSharedPointer<QGraphWaterfall> > waterfalls;
+    QVector<QImage> sprites;
+    QHash<quint64, int> spriteIndex;
+    QVector<quint32> scatterStamps;
 
     bool autoRefresh;
     bool antializing;
     bool grid;
     bool limitedX, limitedY;
     bool zoomLimit;
+    bool autoscaleY;
+    bool statisticsReadout;
+
+    int pollTimer;
+
+    bool stripChart;
+    double stripWindow;
+    double stripRight;
+    QImage stripLayer;
+    QRect stripArea;
+    QRectF stripSrcRect;
+
+    bool persistence;
+    double persistenceDecay;
+    QVector<float> persistenceBuffer;
+    QVector<QRgb> persistenceLut;
+    QImage persistenceHits;
+    QImage persistenceImage;
+    QRect persistenceArea;
+    // Set by zoom, pan and limit changes, auto-fits keep the accumulation
+    bool persistenceReset;
+    QElapsedTimer persistenceClock;
 
     bool rightClickMenu;
     QMenu menu;
     QAction* menuSavePicture;
     QAction* menuGrid;
+    QAction* menuAutoscaleY;
     QAction* menuAntializing;
     QAction* menuTitle;
     QAction* menuUndertitle;
@@ -151,10 +2310,34 @@ protected:
     QAction* menuYNumbers;
     QAction* menuNoBorder;
     QAction* menuDefaultBorder;
+    QAction* menuZoomBack;
+    QAction* menuZoomForward;
+
+    // Zoom history, the entries keep the rendered data layer while memory allows
+    QVector<ViewEntry> history;
+    int historyIndex;
+    int historyLimit;
+    qint64 historyCacheBytes;
+    bool historyCoalesce;
+    QElapsedTimer historyClock;
+    // Incremented whenever the rendered data changes for the same view
+    quint64 viewGeneration;
+    QImage viewLayer;
+    QRectF viewLayerRect;
+    QRect viewLayerArea;
+    quint64 viewLayerGeneration;
+    bool sceneStale;
 
     double dataMinX, dataMinY, dataMaxX, dataMaxY;
     QVector<double> xPoints;
     QVector<double> yPoints;
+    QRectF ticksRect;
+
+    // Layout results and tick labels are kept until their inputs change
+    TextLayout titleLayout, undertitleLayout, xLabelLayout, yLabelLayout;
+    QFont labelCacheFont;
+    int axisFontHeight;
+    QHash<double, QStaticText> tickLabels;
 
     bool zooming;
     QRect zoomRect;
@@ -164,7 +2347,7 @@ protected:
 
     bool tracking;
     int trackingSet;
-    int trackingIndex;
+    qint64 trackingIndex;
 
     int sizeYLabel, sizeXLabel, sizeTitle, sizeYNumbers, sizeXNumbers, sizeUndertitle;
 
@@ -192,9 +2375,32 @@ protected:
     bool yNumbersEnabled;
 
     int leftBorder, topBorder, rightBorder, bottomBorder;
+
+    bool instrumented;
+    bool frameStatsEnabled;
+    bool frameStatsOverlay;
+    bool frameOpen;
+    qint64 frameStart;
+    qint64 frameCounter;
+    QElapsedTimer statsClock;
+    FrameStats currentStats;
+    FrameStats lastStats;
+    bool tracing;
+    enum { TraceBatch = 1024 };
+    void addTraceEvent(const char* name, qint64 start, qint64 duration);
+    void flushTrace();
+    QFile traceFile;
+    QVector<TraceEvent> traceEvents;
+    qint64 traceWritten;
+
+    QElapsedTimer importRefreshClock;
+    QRectF importView;
+    void refreshImport();
+    QGraphImporter* addImporter(QGraphImporter* importer, const QVector<QPen>& pens);
     
 private slots:
     void onMenuGrid(bool grid);
+    void onMenuAutoscaleY(bool autoscaleY);
     void onMenuAntializing(bool antializing);
     void onMenuSavePicture();
     void onMenuTitle(bool enableTitle);
@@ -205,6 +2411,52 @@ private slots:
     void onMenuYNumbers(bool enableYNumbers);
     void onMenuNoBorder();
     void onMenuDefaultBorder();
+    void onMenuZoomBack();
+    void onMenuZoomForward();
+    void onImportData();
+    void onImportFinished();
+    void onTriggerCapture();
+    void onSpectrumReady();
 };
 
+/**
+  \fn int QGraph::setChannelData(const QVector<T>& data, int channels, QGraphDataSource::Layout layout, double x0, double dx, double scale, double offset, const QVector<QPen>& pens)
+  Replaces all traces by the channels of one buffer. The buffer holds
+  data.size()/channels samples per channel in the given layout and is
+  shared by all channels, it is neither copied nor split. Sample i of
+  every channel is drawn at x0+i*dx. Returns the number of traces.
+ **/
+template<typename T>
+int QGraph::setChannelData(const QVector<T>& data, int channels, QGraphDataSource::Layout layout, double x0, double dx, double scale, double offset, const QVector<QPen>& pens)
+{
+    QVector< QSharedPointer<QGraphDataSource> > sources;
+    if(channels > 0)
+    {
+        sources.reserve(channels);
+        for(int channel=0; channel<channels; channel++)
+            sources.push_back(QSharedPointer<QGraphDataSource>(new QGraphChannelSource<T>(data, channels, channel, layout, x0, dx, scale, offset)));
+    }
+    setSources(sources, pens);
+    return sources.size();
+}
+
+/**
+  \fn int QGraph::setChannelData(const T* data, int channels, qint64 samples, QGraphDataSource::Layout layout, double x0, double dx, double scale, double offset, const QVector<QPen>& pens)
+  Same as above for a raw buffer of channels*samples values, which is
+  copied once into a single block.
+ **/
+template<typename T>
+int QGraph::setChannelData(const T* data, int channels, qint64 samples, QGraphDataSource::Layout layout, double x0, double dx, double scale, double offset, const QVector<QPen>& pens)
+{
+    QVector<T> block;
+    if(channels > 0 && samples > 0)
+    {
+        block.resize(int(channels*samples));
+        memcpy(block.data(), data, channels*samples*sizeof(T));
+    }
+    return setChannelData(block, channels, layout, x0, dx, scale, offset, pens);
+}
+
+Q_DECLARE_METATYPE(QGraph::FrameStats)
+
 #endif // QGRAPH_H
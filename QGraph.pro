@@ -1,26 +1,13 @@
 #-------------------------------------------------
 #
-# Project created by QtCreator 2012-07-11T22:06:03
+# Example application and unit tests, "make check"
+# runs the tests
 #
 #-------------------------------------------------
 
-QT       += core gui svg
+TEMPLATE = subdirs
 
-TARGET = QGraph
-TEMPLATE = app
+SUBDIRS = example tests
 
-
-SOURCES += main.cpp\
-        MainWindow.cpp \
-    QGraph.cpp
-
-HEADERS  += MainWindow.h \
-    QGraph.h
-
-FORMS    +=
-
-DESTDIR = build
-OBJECTS_DIR = build
-MOC_DIR = build
-RCC_DIR = build
-UI_DIR = build
+example.file = QGraphExample.pro
+tests.file = tests/tests.pro
@@ -0,0 +1,33 @@
+#-------------------------------------------------
+#
+# Project created by QtCreator 2012-07-11T22:06:03
+#
+#-------------------------------------------------
+
+QT       += core gui svg
+
+TARGET = QGraph
+TEMPLATE = app
+
+
+SOURCES += main.cpp\
+        MainWindow.cpp \
+    QGraph.cpp
+
+HEADERS  += MainWindow.h \
+    QGraph.h
+
+# Shared-memory producer library, POSIX only
+unix: SOURCES += QGraphShm.c
+unix: HEADERS += QGraphShm.h
+
+# shm_open() lives in librt on older glibc
+linux: LIBS += -lrt
+
+FORMS    +=
+
+DESTDIR = build
+OBJECTS_DIR = build
+MOC_DIR = build
+RCC_DIR = build
+UI_DIR = build
@@ -0,0 +1,154 @@
+/*
+    (c) Copyright 2012-2013 by Fabian Schwartau
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "QGraphShm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct qgraph_shm {
+    char* name;
+    unsigned char* data;
+    size_t length;
+    size_t frame_bytes;
+    struct qgraph_shm_header* header;
+};
+
+size_t qgraph_shm_sample_size(uint32_t dtype)
+{
+    switch(dtype)
+    {
+    case QGRAPH_SHM_INT8:
+    case QGRAPH_SHM_UINT8:
+        return 1;
+    case QGRAPH_SHM_INT16:
+    case QGRAPH_SHM_UINT16:
+        return 2;
+    case QGRAPH_SHM_INT32:
+    case QGRAPH_SHM_UINT32:
+    case QGRAPH_SHM_FLOAT32:
+        return 4;
+    case QGRAPH_SHM_FLOAT64:
+        return 8;
+    }
+    return 0;
+}
+
+qgraph_shm* qgraph_shm_create(const char* name, uint32_t dtype, uint32_t channels, uint64_t capacity, double sample_rate)
+{
+    size_t sample = qgraph_shm_sample_size(dtype);
+    if(!name || sample == 0 || channels == 0 || capacity == 0 || !(sample_rate > 0.0) || capacity > (SIZE_MAX-QGRAPH_SHM_HEADER_SIZE)/channels/sample)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    qgraph_shm* shm = (qgraph_shm*)calloc(1, sizeof(qgraph_shm));
+    if(!shm)
+        return NULL;
+    shm->name = strdup(name);
+    shm->frame_bytes = channels*sample;
+    shm->length = QGRAPH_SHM_HEADER_SIZE + capacity*shm->frame_bytes;
+
+    // Truncating an object that readers have mapped would make them fault, a new one leaves them their old ring
+    int fd = -1;
+    if(shm->name)
+    {
+        shm_unlink(name);
+        fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+    if(fd < 0 || ftruncate(fd, (off_t)shm->length) != 0)
+        goto fail;
+    shm->data = (unsigned char*)mmap(NULL, shm->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(shm->data == MAP_FAILED)
+    {
+        shm->data = NULL;
+        goto fail;
+    }
+    close(fd);
+
+    shm->header = (struct qgraph_shm_header*)shm->data;
+    shm->header->version = QGRAPH_SHM_VERSION;
+    shm->header->dtype = dtype;
+    shm->header->channels = channels;
+    shm->header->capacity = capacity;
+    shm->header->sample_rate = sample_rate;
+    shm->header->data_offset = QGRAPH_SHM_HEADER_SIZE;
+    shm->header->write_index = 0;
+    // A reader that sees the magic sees the complete header
+    __atomic_store_n(&shm->header->magic, QGRAPH_SHM_MAGIC, __ATOMIC_RELEASE);
+    return shm;
+
+fail:
+    {
+        int error = errno;
+        if(fd >= 0)
+        {
+            close(fd);
+            shm_unlink(name);
+        }
+        free(shm->name);
+        free(shm);
+        errno = error;
+    }
+    return NULL;
+}
+
+void qgraph_shm_write(qgraph_shm* shm, const void* frames, uint64_t count)
+{
+    if(!shm || !frames || count == 0)
+        return;
+    struct qgraph_shm_header* header = shm->header;
+    const unsigned char* source = (const unsigned char*)frames;
+    uint64_t capacity = header->capacity;
+    // Only the producer writes the index, so a relaxed load is enough
+    uint64_t index = __atomic_load_n(&header->write_index, __ATOMIC_RELAXED);
+    uint64_t end = index + count;
+    if(count > capacity)
+    {
+        source += (count-capacity)*shm->frame_bytes;
+        index = end-capacity;
+        count = capacity;
+    }
+
+    unsigned char* ring = shm->data + header->data_offset;
+    uint64_t position = index % capacity;
+    uint64_t first = capacity-position < count ? capacity-position : count;
+    memcpy(ring + position*shm->frame_bytes, source, first*shm->frame_bytes);
+    if(first < count)
+        memcpy(ring, source + first*shm->frame_bytes, (count-first)*shm->frame_bytes);
+
+    __atomic_store_n(&header->write_index, end, __ATOMIC_RELEASE);
+}
+
+void qgraph_shm_close(qgraph_shm* shm, int unlink)
+{
+    if(!shm)
+        return;
+    munmap(shm->data, shm->length);
+    if(unlink)
+        shm_unlink(shm->name);
+    free(shm->name);
+    free(shm);
+}
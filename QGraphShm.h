@@ -0,0 +1,107 @@
+/*
+    (c) Copyright 2012-2013 by Fabian Schwartau
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef QGRAPHSHM_H
+#define QGRAPHSHM_H
+
+/*
+  Shared-memory ring buffer that feeds QGraph::appendSharedMemory() from
+  another process. This header is plain C so it can be used by the
+  acquisition program without Qt.
+
+  The POSIX shared-memory object starts with a qgraph_shm_header, the
+  frames follow at data_offset. A frame holds one sample of every
+  channel (interleaved), frame i is stored at
+
+    data_offset + (i % capacity) * channels * qgraph_shm_sample_size(dtype)
+
+  write_index counts the frames written since the ring was created. The
+  producer stores the frames first and then publishes the new
+  write_index with release semantics, the reader loads it with acquire
+  semantics. There is no lock: the reader only shows the newest
+  capacity - capacity/QGRAPH_SHM_MARGIN frames, so the producer may
+  write that many frames while a frame is rendered without touching a
+  visible sample. All numbers are in native byte order.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QGRAPH_SHM_MAGIC 0x4d534751u /* "QGSM" */
+#define QGRAPH_SHM_VERSION 1u
+#define QGRAPH_SHM_HEADER_SIZE 64u
+#define QGRAPH_SHM_MARGIN 8
+
+/* Same order as QGraphMappedSource::SampleType */
+enum qgraph_shm_dtype {
+    QGRAPH_SHM_INT8,
+    QGRAPH_SHM_UINT8,
+    QGRAPH_SHM_INT16,
+    QGRAPH_SHM_UINT16,
+    QGRAPH_SHM_INT32,
+    QGRAPH_SHM_UINT32,
+    QGRAPH_SHM_FLOAT32,
+    QGRAPH_SHM_FLOAT64
+};
+
+struct qgraph_shm_header {
+    uint32_t magic;        /* QGRAPH_SHM_MAGIC, written last when the ring is created */
+    uint32_t version;      /* QGRAPH_SHM_VERSION */
+    uint32_t dtype;        /* enum qgraph_shm_dtype */
+    uint32_t channels;     /* samples per frame */
+    uint64_t capacity;     /* frames in the ring */
+    double sample_rate;    /* frames per second, x of frame i is i/sample_rate */
+    uint64_t data_offset;  /* byte offset of frame 0 from the start of the object */
+    uint64_t write_index;  /* frames written so far, accessed atomically */
+    uint64_t reserved[2];
+};
+
+typedef struct qgraph_shm qgraph_shm;
+
+static inline uint64_t qgraph_shm_load_index(const struct qgraph_shm_header* header)
+{
+    return __atomic_load_n(&header->write_index, __ATOMIC_ACQUIRE);
+}
+
+size_t qgraph_shm_sample_size(uint32_t dtype);
+
+/*
+  Creates the shared-memory object name, e.g. "/scope0", for capacity
+  frames of channels samples of type dtype. An existing object of that
+  name is unlinked first, readers that have it mapped keep the old ring.
+  Returns NULL and sets errno on failure.
+ */
+qgraph_shm* qgraph_shm_create(const char* name, uint32_t dtype, uint32_t channels, uint64_t capacity, double sample_rate);
+
+/*
+  Appends count interleaved frames and publishes them. Never blocks; if
+  count exceeds the capacity only the newest frames are kept.
+ */
+void qgraph_shm_write(qgraph_shm* shm, const void* frames, uint64_t count);
+
+/* Unmaps the ring and, if unlink is non-zero, removes the object name */
+void qgraph_shm_close(qgraph_shm* shm, int unlink);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QGRAPHSHM_H
@@ -0,0 +1,32 @@
+#-------------------------------------------------
+#
+# Unit tests of the recording file format, the
+# compressed sample codec and the CSV number parser
+#
+#-------------------------------------------------
+
+QT       += core gui widgets svg testlib
+
+TARGET = tst_qgraph
+TEMPLATE = app
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+INCLUDEPATH += ..
+
+SOURCES += tst_qgraph.cpp \
+    ../QGraph.cpp
+
+HEADERS  += ../QGraph.h
+
+unix: SOURCES += ../QGraphShm.c
+unix: HEADERS += ../QGraphShm.h
+
+# shm_open() lives in librt on older glibc
+linux: LIBS += -lrt
+
+DESTDIR = build
+OBJECTS_DIR = build
+MOC_DIR = build
+RCC_DIR = build
+UI_DIR = build
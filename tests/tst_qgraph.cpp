@@ -0,0 +1,236 @@
+/*
+    (c) Copyright 2012-2013 by Fabian Schwartau
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QtTest>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include "QGraph.h"
+
+// Doubles are compared by their bits, so -0 and NaN payloads count
+static quint64 bits(double value)
+{
+    quint64 result;
+    memcpy(&result, &value, sizeof(result));
+    return result;
+}
+
+class tst_QGraph : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void recordingRoundTrip_data();
+    void recordingRoundTrip();
+    void recordingRecover();
+
+    void codecRoundTrip_data();
+    void codecRoundTrip();
+
+    void parseDouble_data();
+    void parseDouble();
+
+private:
+    bool writeRecording(const QString& fileName, bool compress, int chunkSize, int traces);
+
+    QTemporaryDir dir;
+    QVector<double> x;
+    QVector<double> y;
+};
+
+void tst_QGraph::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    // Unsorted x with a jump, y with repeated values and a wide range
+    for(int i=0; i<10000; i++)
+    {
+        x.push_back(i%1000 == 999 ? i*0.01-5.0 : i*0.01);
+        y.push_back(i%3 == 0 ? 0.0 : sin(i*0.001)*100.0 + (i%7)*0.125);
+    }
+}
+
+/*
+  Writes y as a uniform trace (x0 = 1, dx = 0.5) and, with two traces,
+  x and y as a trace with stored x.
+ */
+bool tst_QGraph::writeRecording(const QString& fileName, bool compress, int chunkSize, int traces)
+{
+    QGraphRecordingWriter writer;
+    int uniform = writer.addTrace(1.0, 0.5);
+    int stored = traces > 1 ? writer.addTrace() : -1;
+    if(!writer.open(fileName, chunkSize, compress))
+        return false;
+    for(int i=0; i<y.size(); i+=777)
+    {
+        int count = qMin(777, y.size()-i);
+        if(!writer.append(uniform, 0, y.constData()+i, count))
+            return false;
+        if(stored >= 0 && !writer.append(stored, x.constData()+i, y.constData()+i, count))
+            return false;
+    }
+    return writer.close();
+}
+
+void tst_QGraph::recordingRoundTrip_data()
+{
+    QTest::addColumn<bool>("compress");
+    QTest::newRow("plain") << false;
+    QTest::newRow("compressed") << true;
+}
+
+void tst_QGraph::recordingRoundTrip()
+{
+    QFETCH(bool, compress);
+    QString fileName = dir.filePath("roundtrip.qgr");
+    QVERIFY(writeRecording(fileName, compress, 1000, 2));
+
+    QSharedPointer<QGraphRecording> recording = QGraphRecording::open(fileName);
+    QVERIFY(recording);
+    QVERIFY(!recording->isRecovered());
+    QCOMPARE(recording->traceCount(), 2);
+    QVERIFY(!recording->isSorted(1));
+
+    QGraphFileSource uniform(recording, 0);
+    QGraphFileSource stored(recording, 1);
+    QCOMPARE(uniform.size(), qint64(y.size()));
+    QCOMPARE(stored.size(), qint64(y.size()));
+    double x0, dx;
+    QVERIFY(uniform.uniformX(x0, dx));
+    QCOMPARE(x0, 1.0);
+    QCOMPARE(dx, 0.5);
+    for(int i=0; i<y.size(); i++)
+    {
+        QCOMPARE(bits(uniform.y(i)), bits(y[i]));
+        QCOMPARE(bits(stored.x(i)), bits(x[i]));
+        QCOMPARE(bits(stored.y(i)), bits(y[i]));
+    }
+
+    // Ranges over many chunks come from the summary levels
+    double min, max;
+    uniform.minMaxY(0, y.size(), min, max);
+    QCOMPARE(min, *std::min_element(y.constBegin(), y.constEnd()));
+    QCOMPARE(max, *std::max_element(y.constBegin(), y.constEnd()));
+}
+
+void tst_QGraph::recordingRecover()
+{
+    QString fileName = dir.filePath("recover.qgr");
+    QVERIFY(writeRecording(fileName, false, 1000, 1));
+
+    // Cut the file inside the fourth chunk, which also drops the index
+    qint64 cut;
+    {
+        QSharedPointer<QGraphRecording> recording = QGraphRecording::open(fileName);
+        QVERIFY(recording);
+        QVERIFY(recording->chunkCount(0) > 4);
+        cut = recording->chunkEntry(0, 3).offset + sizeof(QGraphRecording::ChunkHeader) + 100;
+    }
+    QVERIFY(QFile::resize(fileName, cut));
+
+    QSharedPointer<QGraphRecording> recording = QGraphRecording::open(fileName);
+    QVERIFY(recording);
+    QVERIFY(recording->isRecovered());
+    QCOMPARE(recording->sampleCount(0), qint64(3000));
+    QGraphFileSource source(recording, 0);
+    for(int i=0; i<3000; i++)
+        QCOMPARE(bits(source.y(i)), bits(y[i]));
+}
+
+void tst_QGraph::codecRoundTrip_data()
+{
+    QTest::addColumn<bool>("uniform");
+    QTest::newRow("uniform") << true;
+    QTest::newRow("stored x") << false;
+}
+
+void tst_QGraph::codecRoundTrip()
+{
+    QFETCH(bool, uniform);
+    const double edges[] = {
+        std::numeric_limits<double>::quiet_NaN(), -std::numeric_limits<double>::quiet_NaN(),
+        0.0, -0.0, std::numeric_limits<double>::denorm_min(), -std::numeric_limits<double>::denorm_min(),
+        DBL_MIN*0.5, DBL_MIN, DBL_MAX, -DBL_MAX,
+        std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), 1.0, 1.0
+    };
+    const int edgeCount = sizeof(edges)/sizeof(edges[0]);
+
+    // Several sealed blocks and an open one, edge values between smooth runs
+    QVector<double> values;
+    for(int i=0; i<3000; i++)
+        values.push_back(i%50 < edgeCount ? edges[i%50] : i*0.25);
+    QScopedPointer<QGraphCompressedSource> source(uniform ? new QGraphCompressedSource(0.0, 1.0) : new QGraphCompressedSource());
+    source->append(values.constData(), values.constData(), values.size());
+    QCOMPARE(source->size(), qint64(values.size()));
+
+    QVector<double> read(values.size());
+    source->readY(0, read.size(), read.data());
+    for(int i=0; i<values.size(); i++)
+    {
+        QCOMPARE(bits(read[i]), bits(values[i]));
+        QCOMPARE(bits(source->y(i)), bits(values[i]));
+    }
+    if(!uniform)
+    {
+        source->readX(0, read.size(), read.data());
+        for(int i=0; i<values.size(); i++)
+            QCOMPARE(bits(read[i]), bits(values[i]));
+    }
+}
+
+void tst_QGraph::parseDouble_data()
+{
+    QTest::addColumn<QByteArray>("text");
+    QTest::addColumn<bool>("valid");
+    QTest::newRow("zero") << QByteArray("0") << true;
+    QTest::newRow("negative zero") << QByteArray("-0") << true;
+    QTest::newRow("fraction") << QByteArray("-2.5e-10") << true;
+    QTest::newRow("tenth") << QByteArray("0.1") << true;
+    QTest::newRow("padded") << QByteArray("  \"3.25\" ") << true;
+    QTest::newRow("no leading digit") << QByteArray(".5") << true;
+    QTest::newRow("exact limit") << QByteArray("1e22") << true;
+    QTest::newRow("large exponent") << QByteArray("1e23") << true;
+    QTest::newRow("above 2^53") << QByteArray("9007199254740993") << true;
+    QTest::newRow("long mantissa") << QByteArray("123456789012345678901234.5") << true;
+    QTest::newRow("denormal") << QByteArray("4.9e-324") << true;
+    QTest::newRow("maximum") << QByteArray("1.7976931348623157e308") << true;
+    QTest::newRow("empty") << QByteArray("  ") << false;
+    QTest::newRow("text") << QByteArray("abc") << false;
+    QTest::newRow("sign only") << QByteArray("-") << false;
+}
+
+void tst_QGraph::parseDouble()
+{
+    QFETCH(QByteArray, text);
+    QFETCH(bool, valid);
+    double value = 0.0;
+    QCOMPARE(QGraphImporter::parseDouble(text.constData(), text.constData()+text.size(), value), valid);
+    if(!valid)
+        return;
+    QByteArray number = text.trimmed();
+    number.replace('"', "");
+    QCOMPARE(bits(value), bits(strtod(number.constData(), 0)));
+}
+
+QTEST_MAIN(tst_QGraph)
+
+#include "tst_qgraph.moc"